@@ -0,0 +1,119 @@
+#!/usr/bin/env bash
+#
+# Startup benchmark for the checkrt hook and exec.so.
+#
+# Synthetic libstdc++.so.6 libraries with different numbers of version
+# definitions are created with linker version scripts and used as the
+# bundled and the system library (the latter through LD_LIBRARY_PATH).
+# All times are wall clock times in microseconds.
+
+set -e
+
+RUNS="${RUNS:-200}"
+SIZES="${SIZES:-10 100 1000 10000}"
+
+cd "$(dirname "$0")"
+bench="$PWD"
+work="$bench/work"
+
+rm -rf "$work"
+mkdir -p "$work"
+make -s timeit
+
+# build the plugin script and install it into a template AppDir
+(cd .. && ./generate.sh "$work/linuxdeploy-plugin-checkrt.sh")
+bash "$work/linuxdeploy-plugin-checkrt.sh" --appdir "$work/appdir" > /dev/null
+rm -rf "$work/appdir/checkrt/"*/ "$work/appdir/checkrt/manifest"
+mkdir -p "$work/appdir/usr/bin"
+cp /bin/true "$work/appdir/usr/bin"
+
+
+# gen_lib <count> <highest version> <output directory>
+# creates a libstdc++.so.6 with the version definitions
+# GLIBCXX_3.4.<highest-count+1> to GLIBCXX_3.4.<highest>
+gen_lib() {
+    local src="$work/src-$1-$2"
+
+    if [ ! -f "$src/libstdc++.so.6" ]; then
+        mkdir -p "$src"
+        seq $(($2 - $1 + 1)) $2 | awk '{ print "int f" $1 "(void) { return " $1 "; }" }' > "$src/lib.c"
+        seq $(($2 - $1 + 1)) $2 | awk '
+            NR == 1 { print "GLIBCXX_3.4." $1 " { global: f" $1 "; local: *; };" }
+            NR > 1  { print "GLIBCXX_3.4." $1 " { global: f" $1 "; } GLIBCXX_3.4." prev ";" }
+            { prev = $1 }' > "$src/lib.map"
+        cc -g -shared -fPIC -Wl,--version-script="$src/lib.map" -Wl,-soname,libstdc++.so.6 \
+            "$src/lib.c" -o "$src/libstdc++.so.6"
+    fi
+
+    mkdir -p "$3"
+    cp -f "$src/libstdc++.so.6" "$3"
+}
+
+
+# timing <env...> -- prints "median p99" of checkrt and the hook
+run_checkrt() {
+    env "$@" "$bench/timeit" "$RUNS" "$appdir/checkrt/checkrt"
+}
+
+run_hook() {
+    env "$@" APPDIR="$appdir" "$bench/timeit" "$RUNS" \
+        bash -c '. "$0"' "$appdir/apprun-hooks/linuxdeploy-plugin-checkrt.sh"
+}
+
+
+printf "checkrt startup, %s runs (median / p99 in us)\n\n" "$RUNS"
+printf "%-8s %-14s %-10s %-10s %-21s %-21s %-21s\n" \
+    "verdefs" "case" "strip" "result" "checkrt cold" "checkrt warm" "AppRun hook"
+
+for n in $SIZES ; do
+    for case in equal bundled-newer system-newer ; do
+        for strip in no yes ; do
+            appdir="$work/appdir-$n-$case-$strip"
+            sys="$appdir.sys"
+            cp -a "$work/appdir" "$appdir"
+
+            case $case in
+                equal)          b=$n; s=$n ;;
+                bundled-newer)  b=$((n + 1)); s=$n ;;
+                system-newer)   b=$n; s=$((n + 1)) ;;
+            esac
+
+            gen_lib $n $b "$appdir/checkrt/cxx"
+            gen_lib $n $s "$sys"
+
+            if [ $strip = yes ]; then
+                strip --strip-all "$appdir/checkrt/cxx/libstdc++.so.6" "$sys/libstdc++.so.6"
+            fi
+
+            cache="$appdir.cache"
+            envs=(LD_LIBRARY_PATH="$sys" XDG_CACHE_HOME="$cache")
+
+            result="$(env "${envs[@]}" CHECKRT_NOCACHE=1 "$appdir/checkrt/checkrt")"
+            result="$([ -n "$result" ] && echo bundled || echo system)"
+            cold="$(run_checkrt "${envs[@]}" CHECKRT_NOCACHE=1)"
+
+            # populate the cache
+            env "${envs[@]}" "$appdir/checkrt/checkrt" > /dev/null
+            warm="$(run_checkrt "${envs[@]}")"
+            hook="$(run_hook "${envs[@]}")"
+
+            printf "%-8s %-14s %-10s %-10s %-21s %-21s %-21s\n" \
+                $n $case $strip $result "${cold/ / / }" "${warm/ / / }" "${hook/ / / }"
+        done
+    done
+done
+
+
+appdir="$work/appdir"
+
+printf "\nexec.so, %s runs of fork() and exec (median / p99 in us)\n\n" "$RUNS"
+printf "%-32s %-21s\n" "case" "time"
+
+t="$("$bench/timeit" "$RUNS" /bin/true)"
+printf "%-32s %-21s\n" "without exec.so" "${t/ / / }"
+
+t="$(APPDIR="$appdir" LD_PRELOAD="$appdir/checkrt/exec.so" "$bench/timeit" "$RUNS" /bin/true)"
+printf "%-32s %-21s\n" "exec.so, external process" "${t/ / / }"
+
+t="$(APPDIR="$appdir" LD_PRELOAD="$appdir/checkrt/exec.so" "$bench/timeit" "$RUNS" "$appdir/usr/bin/true")"
+printf "%-32s %-21s\n" "exec.so, internal process" "${t/ / / }"
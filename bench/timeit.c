@@ -0,0 +1,79 @@
+/* Run a command repeatedly and print the median and the 99th percentile
+ * of its wall clock time in microseconds. The command's output is discarded.
+ *
+ * usage: timeit <runs> <command> [<args>...]
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <err.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static int compare(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+
+int main(int argc, char **argv)
+{
+    int status;
+
+    if (argc < 3 || atoi(argv[1]) < 1) {
+        fprintf(stderr, "usage: %s <runs> <command> [<args>...]\n", argv[0]);
+        return 1;
+    }
+
+    int runs = atoi(argv[1]);
+    int64_t *t = malloc(runs * sizeof(int64_t));
+    int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+    for (int i = 0; i < runs; i++) {
+        int64_t start = now_ns();
+        pid_t pid = fork();
+
+        if (pid == -1) {
+            err(1, "fork()");
+        } else if (pid == 0) {
+            dup2(devnull, STDOUT_FILENO);
+            execvp(argv[2], argv + 2);
+            _exit(127);
+        }
+
+        if (waitpid(pid, &status, 0) == -1) {
+            err(1, "waitpid()");
+        }
+
+        t[i] = now_ns() - start;
+
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            errx(1, "command failed: %s", argv[2]);
+        }
+    }
+
+    qsort(t, runs, sizeof(int64_t), compare);
+
+    /* nearest-rank percentiles */
+    printf("%.1f %.1f\n", t[(runs - 1) / 2] / 1000.0, t[(runs * 99 + 99) / 100 - 1] / 1000.0);
+
+    free(t);
+
+    return 0;
+}
@@ -23,33 +23,107 @@
 #define _GNU_SOURCE
 #endif
 #include <ctype.h>
+#include <dirent.h>
+#ifndef CHECKRT_STATIC
 #include <dlfcn.h>
+#endif
 #include <elf.h>
 #include <err.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <libgen.h>
 #include <link.h>
+#if __has_include(<linux/fs.h>)
+#include <linux/fs.h>
+#endif
+#include <pthread.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "checkrt.h"
+
 
 /* enable terminal colors to make the debug
  * output more pleasent to read */
 #define ENABLE_COLORS 1
 
 
+/* read only the needed parts of ELF files with pread() instead of
+ * mapping the whole file; this avoids page faults and decompression
+ * of unused squashfs blocks on FUSE-mounted AppImages. Define
+ * CHECKRT_MMAP on the command line to map the files instead. */
+#ifndef CHECKRT_MMAP
+#define ENABLE_PREAD 1
+#endif
+
+
+/* CHECKRT_STATIC can be defined on the command line to build a static binary
+ * without the dlmopen() fallback and libdl, which saves the dynamic loader's
+ * work at every start; system libraries must then be found through
+ * ld.so.cache or the default directories. It still uses the C library
+ * (stdio included), so its size depends on the one it's linked against;
+ * musl gives a much smaller binary than glibc:
+ * musl-gcc -Os -DCHECKRT_STATIC -static -pthread checkrt.c -o checkrt -s */
+
+
+/* missing in older kernel headers, or without them (musl-gcc) */
+#ifndef FICLONE
+#define FICLONE  _IOW(0x94, 9, int)
+#endif
+
+/* missing in older C library headers */
+#ifndef DF_1_PIE
+#define DF_1_PIE  0x08000000
+#endif
+
+
 /* library names */
 #define LIBGCC_SO  "libgcc_s.so.1"
 #define STDCXX_SO  "libstdc++.so.6"
 
 
+/* decision cache */
+#define CACHE_MAGIC   "checkrt-cache 2"
+#define CACHE_SUBDIR  "checkrt"
+#define LDSO_CACHE    "/etc/ld.so.cache"
+
+
+/* result inherited by processes started from the same AppDir,
+ * see read_token() */
+#define TOKEN_MAGIC  "checkrt-token 1"
+#define TOKEN_ENV    "CHECKRT_TOKEN"
+
+
+/* versions of the bundled libraries, written by --copy */
+#define MANIFEST_MAGIC  "checkrt-manifest 4"
+#define MANIFEST_FILE   "manifest"
+
+
+/* versioned symbols imported by the AppDir, written by --copy if
+ * CHECKRT_PRECISE is set */
+#define SYMBOLS_MAGIC  "checkrt-symbols 1"
+#define SYMBOLS_FILE   "symbols"
+
+
+/* empty file written by --copy if CHECKRT_PRELOAD is set; the AppRun hook
+ * and --exec then preload the bundled libraries instead of prepending
+ * their directories to LD_LIBRARY_PATH */
+#define PRELOAD_FILE   "preload"
+
+
 /* terminal-colors.d(5) */
 #define STR(x) #x
 
@@ -86,17 +160,146 @@
 /* global variables */
 static bool debug_mode = false;
 static bool full_debug_mode = false;
-static void *addr = MAP_FAILED;
-static size_t size = 0;
-static ElfW(Ehdr) *ehdr = NULL;
-static ElfW(Shdr) *shdr = NULL;
+static FILE *trace_file = NULL;
+
+
+/* monotonic timestamp in nanoseconds, or 0 if tracing is disabled */
+static uint64_t trace_begin()
+{
+    struct timespec ts;
+
+    if (!trace_file) {
+        return 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
 
+/* write a string as JSON to the locked trace file */
+static void trace_string(const char *str)
+{
+    if (!str) {
+        fputs_unlocked("null", trace_file);
+        return;
+    }
+
+    putc_unlocked('"', trace_file);
+
+    for (const unsigned char *p = (const unsigned char *)str; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            putc_unlocked('\\', trace_file);
+            putc_unlocked(*p, trace_file);
+        } else if (*p < 0x20) {
+            fprintf(trace_file, "\\u%04x", *p);
+        } else {
+            putc_unlocked(*p, trace_file);
+        }
+    }
+
+    putc_unlocked('"', trace_file);
+}
+
+
+/* Write a JSON line for a phase that started at "start" (from trace_begin())
+ * to CHECKRT_TRACE; the phase name is followed by NULL terminated pairs of
+ * keys and string values, a NULL value is written as null */
+static void trace_event(uint64_t start, const char *phase, ...)
+{
+    va_list ap;
+    const char *key;
+
+    if (!trace_file) {
+        return;
+    }
+
+    uint64_t end = trace_begin();
+
+    flockfile(trace_file);
+    fprintf(trace_file, "{\"ts\":%" PRIu64 ",\"dur\":%" PRIu64 ",\"phase\":\"%s\"", start, end - start, phase);
+
+    va_start(ap, phase);
+
+    while ((key = va_arg(ap, const char *)) != NULL) {
+        const char *value = va_arg(ap, const char *);
+        fprintf(trace_file, ",\"%s\":", key);
+        trace_string(value);
+    }
+
+    va_end(ap);
+
+    fputs_unlocked("}\n", trace_file);
+    funlockfile(trace_file);
+}
+
+
+/* managed runtime libraries, listed in load order (dependencies first) */
+struct runtime_lib {
+    const char *soname;
+    const char *subdir;
+    const char *prefix;
+    bool optional;  /* only copied if the AppDir links against it and it's installed */
+};
+
+static const struct runtime_lib runtime_libs[] = {
+    { LIBGCC_SO,           "gcc",       "GCC_",        false },
+    { STDCXX_SO,           "cxx",       "GLIBCXX_",    false },
+    { "libquadmath.so.0",  "quadmath",  "QUADMATH_",   true },
+    { "libgfortran.so.5",  "gfortran",  "GFORTRAN_",   true },
+    { "libgomp.so.1",      "gomp",      "GOMP_",       true },
+    { "libatomic.so.1",    "atomic",    "LIBATOMIC_",  true }
+};
+
+#define RUNTIME_LIBS_NUM  (sizeof(runtime_libs) / sizeof(runtime_libs[0]))
+
+
+/* part of an ELF file that was read into memory */
+struct elf_region {
+    uint8_t *data;
+    size_t size;    /* allocated size of data */
+    size_t offset;
+    size_t len;
+    uint64_t used;  /* time of the last access, 0 if unused */
+};
+
+/* Number of regions kept per ELF file; the least recently used one is
+ * reused for the next read. The parsers read the tables they loop over
+ * at once, so the regions they still hold pointers to are accessed again
+ * and won't be reused while they need them. */
+#define ELF_REGIONS  16
+
+/* opened ELF file */
+struct elf_file {
+    const char *path;
+    size_t size;
+#ifdef ENABLE_PREAD
+    int fd;
+    uint64_t clock;  /* counts region accesses */
+    struct elf_region regions[ELF_REGIONS];
+#else
+    uint8_t *addr;
+#endif
+    ElfW(Ehdr) *ehdr;
+    ElfW(Shdr) *shdr;
+    int error;  /* first error, see elf_fail() */
+};
+
+
+#ifndef CHECKRT_STATIC
 static void errx_dlerror(const char *filename, const char *msg) __attribute__((noreturn));
 static void *load_lib_new_namespace(const char *filename) __attribute__((returns_nonnull));
+#endif
+#ifndef CHECKRT_LIBRARY
+static void exec_program(const char *dir, char **argv) __attribute__((noreturn));
+static int strip_library(const char *src, int fd_out, const char *target);
+#endif
+static void elf_close(struct elf_file *elf);
 
 
 
+#ifndef CHECKRT_STATIC
 static void errx_dlerror(const char *filename, const char *msg)
 {
     const char *p = dlerror();
@@ -121,378 +324,3416 @@ static void *load_lib_new_namespace(const char *filename)
 
     return handle;
 }
+#endif
 
 
-/* retrieve full path of system library */
-static char *get_system_library_path(const char *filename)
-{
-    struct link_map *map = NULL;
-    void *handle = load_lib_new_namespace(filename);
-
-    if (dlinfo(handle, RTLD_DI_LINKMAP, &map) == -1) {
-        errx_dlerror(filename, "dlinfo() could not retrieve information from library");
-    }
-
-    if (!map->l_name || map->l_name[0] == 0) {
-        errx(1, "%s: %s", filename, "dlinfo() failed to get absolute pathname");
-    }
-
-    char *path = strdup(map->l_name);
-    DEBUG_PRINT(COL_LIB " resolved to: " COL_PATH, filename, path);
+/* ELF header of our own executable, provided by the linker */
+extern const ElfW(Ehdr) __ehdr_start;
 
-    dlclose(handle);
 
-    return path;
-}
+/* highest EI_ABIVERSION for ELFOSABI_GNU accepted by glibc */
+#define ELF_ABIVERSION_MAX  2
 
 
-/* copy library from system into directory next to binary */
-static void copy_lib(const char *dir, const char *subdir, const char *libname)
+/* validate ELF header the same way ld.so does before loading a library;
+ * returns an error message or NULL if the header is fine */
+static const char *check_elf_header(const ElfW(Ehdr) *e)
 {
-    int fd_in, fd_out;
-    ssize_t nread;
-    uint8_t buf[512*1024];
+    const uint8_t *id = e->e_ident;
 
-    /* find library */
-    char *src = get_system_library_path(libname);
-    printf("Copy library: %s\n", src);
+    if (memcmp(id, ELFMAG, SELFMAG) != 0) {
+        return "invalid ELF header";
+    }
 
-    /* create target directory */
-    char *target = malloc(strlen(dir) + strlen(subdir) + strlen(libname) + 3);
-    sprintf(target, "%s/%s/", dir, subdir);
-    mkdir(target, 0775);
+    if (id[EI_CLASS] != __ehdr_start.e_ident[EI_CLASS]) {
+        return "wrong ELF class";
+    }
 
-    /* open source file for reading */
-    if ((fd_in = open(src, O_RDONLY)) < 0) {
-        err(1, "cannot open file for reading: %s", src);
+    if (id[EI_DATA] != __ehdr_start.e_ident[EI_DATA]) {
+        return "ELF file data encoding not native";
     }
 
-    /* open target file for writing */
-    strcat(target, libname);
+    if (id[EI_VERSION] != EV_CURRENT || e->e_version != EV_CURRENT) {
+        return "ELF file version does not match current one";
+    }
 
-    if ((fd_out = open(target, O_WRONLY | O_CREAT | O_TRUNC, 0664)) < 0) {
-        err(1, "cannot open file for writing: %s", target);
+    if (!(id[EI_OSABI] == ELFOSABI_SYSV && id[EI_ABIVERSION] == 0) &&
+        !(id[EI_OSABI] == ELFOSABI_GNU && id[EI_ABIVERSION] <= ELF_ABIVERSION_MAX))
+    {
+        return "ELF file OS ABI invalid";
     }
 
-    /* copy file content */
-    while ((nread = read(fd_in, buf, sizeof(buf))) > 0) {
-        if (write(fd_out, buf, nread) != nread) {
-            err(1, "error writing to file: %s", target);
+    for (size_t i = EI_PAD; i < EI_NIDENT; i++) {
+        if (id[i] != 0) {
+            return "nonzero padding in e_ident";
         }
     }
 
-    if (nread == -1) {
-        err(1, "error reading from file: %s", src);
+    if (e->e_machine != __ehdr_start.e_machine) {
+        return "ELF file machine does not match";
     }
 
-    /* free resources */
-    close(fd_out);
-    close(fd_in);
-    free(src);
-    free(target);
-}
-
+    if (e->e_type != ET_DYN) {
+        return "only ET_DYN can be loaded";
+    }
 
-/* perform filesize check and get offset */
-static void *get_offset(ElfW(Off) offset)
-{
-    if (offset >= size) {
-        errx(1, "%s", "*** offset exceeds filesize ***"); \
+    if (e->e_phentsize != sizeof(ElfW(Phdr))) {
+        return "ELF file's phentsize not the expected size";
     }
 
-    return (addr + offset);
+    return NULL;
 }
 
 
-/* value is stored in shdr[0].sh_size if it's too large */
-static size_t get_shnum() {
-    return (ehdr->e_shnum == 0) ? shdr[0].sh_size : ehdr->e_shnum;
-}
+/* check if a file is an ELF object that could be loaded into our process */
+static bool is_compatible_elf(const char *path)
+{
+    ElfW(Ehdr) e;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1) {
+        return false;
+    }
 
+    ssize_t n = pread(fd, &e, sizeof(e), 0);
+    close(fd);
 
-/* value is stored in shdr[0].sh_link if it's too large */
-static size_t get_shstrndx() {
-    return (ehdr->e_shstrndx == SHN_XINDEX) ? shdr[0].sh_link : ehdr->e_shstrndx;
+    return (n == sizeof(e) && check_elf_header(&e) == NULL);
 }
 
 
-/* get section header by name */
-static ElfW(Shdr) *get_shdr(ElfW(Word) type, const char *name)
+/**
+ * Resolve "path" as if "root" was the root directory: symbolic links are
+ * followed component by component and absolute link targets are taken
+ * relative to the root. Returns the malloc'd path including the root, or
+ * NULL if it doesn't exist.
+ */
+static char *resolve_in_root(const char *root, const char *path)
 {
-    size_t shnum = get_shnum();
-    size_t shstrndx = get_shstrndx();
+    char resolved[PATH_MAX], rest[PATH_MAX], target[PATH_MAX], full[PATH_MAX * 2];
+    struct stat st;
+    int links = 0;
+
+    size_t rootlen = strlen(root);
 
-    if (shnum == 0 || shstrndx == 0) {
+    while (rootlen > 0 && root[rootlen - 1] == '/') {
+        rootlen--;
+    }
+
+    if (strlen(path) >= sizeof(rest)) {
         return NULL;
     }
 
-    ElfW(Shdr) *strtab = &shdr[shstrndx];
+    /* path inside the root, "" is the root itself */
+    resolved[0] = 0;
+    strcpy(rest, path);
 
-    for (size_t i = 1; i < shnum; i++) {
-        if (shdr[i].sh_type != type) {
+    char *p = rest;
+
+    while (*p) {
+        while (*p == '/') {
+            p++;
+        }
+
+        size_t len = strcspn(p, "/");
+
+        if (len == 0 || (len == 1 && p[0] == '.')) {
+            p += len;
             continue;
         }
 
-        const char *ptr = get_offset(strtab->sh_offset + shdr[i].sh_name);
+        if (len == 2 && p[0] == '.' && p[1] == '.') {
+            char *slash = strrchr(resolved, '/');
 
-        if (strcmp(ptr, name) == 0) {
-            return &shdr[i];
+            if (slash) {
+                *slash = 0;
+            }
+
+            p += len;
+            continue;
+        }
+
+        size_t rlen = strlen(resolved);
+
+        if (rlen + len + 2 > sizeof(resolved)) {
+            return NULL;
+        }
+
+        resolved[rlen] = '/';
+        memcpy(resolved + rlen + 1, p, len);
+        resolved[rlen + len + 1] = 0;
+        p += len;
+
+        snprintf(full, sizeof(full), "%.*s%s", (int)rootlen, root, resolved);
+
+        if (lstat(full, &st) == -1) {
+            return NULL;
+        }
+
+        if (!S_ISLNK(st.st_mode)) {
+            continue;
+        }
+
+        ssize_t n = readlink(full, target, sizeof(target) - 1);
+
+        if (n == -1 || ++links > 40 || n + strlen(p) + 1 > sizeof(rest)) {
+            return NULL;
+        }
+
+        /* continue with the link target followed by the unresolved rest */
+        memmove(rest + n, p, strlen(p) + 1);
+        memcpy(rest, target, n);
+        p = rest;
+
+        if (target[0] == '/') {
+            resolved[0] = 0;
+        } else {
+            *strrchr(resolved, '/') = 0;
         }
     }
 
-    return NULL;
+    snprintf(full, sizeof(full), "%.*s%s", (int)rootlen, root, resolved[0] ? resolved : "/");
+
+    return strdup(full);
 }
 
 
-/* get dynamic entry value by tag */
-static size_t get_dyn_val(ElfW(Shdr) *dynamic, ElfW(Sword) tag)
+/* return a malloc'd copy of "path", resolved inside "root" unless it's
+ * NULL, or NULL if it isn't a compatible ELF file */
+static char *compatible_path(const char *root, const char *path)
 {
-    if (dynamic->sh_size == 0 || dynamic->sh_entsize == 0) {
-        return 0;
-    }
+    char *result = root ? resolve_in_root(root, path) : strdup(path);
 
-    ElfW(Dyn) *dyn = get_offset(dynamic->sh_offset);
-
-    for (size_t i = 0; i < (dynamic->sh_size / dynamic->sh_entsize); i++, dyn++) {
-        if (dyn->d_tag == tag) {
-            return dyn->d_un.d_val;
-        }
+    if (result && !is_compatible_elf(result)) {
+        free(result);
+        result = NULL;
     }
 
-    return 0;
+    return result;
 }
 
 
-static bool is_prefixed_and_higher_version(const char *new, const char *old, const char *prefix, size_t pfxlen)
+/* look for library in a colon or semicolon separated list of directories,
+ * inside "root" unless it's NULL */
+static char *search_dirs(const char *root, const char *list, const char *filename)
 {
-    return (strncmp(new, prefix, pfxlen) == 0 &&  /* symbol name starts with prefix */
-            isdigit(*(new + pfxlen)) &&           /* first byte after prefix is a digit */
-            strchr(new + pfxlen, '.') &&          /* symbol name contains a dot */
-            (!old || strverscmp(old, new) < 0));  /* get higher version string */
+    char *copy = strdup(list);
+    char *save = NULL;
+    char *result = NULL;
+
+    for (char *p = strtok_r(copy, ":;", &save); p && !result; p = strtok_r(NULL, ":;", &save)) {
+        char *path = malloc(strlen(p) + strlen(filename) + 2);
+        sprintf(path, "%s/%s", p, filename);
+
+        if (root) {
+            result = compatible_path(root, path);
+        } else if (is_compatible_elf(path)) {
+            result = realpath(path, NULL);
+        }
+
+        free(path);
+    }
+
+    free(copy);
+
+    return result;
 }
 
 
 /**
- * Find symbol in SHT_GNU_verdef section
- * https://refspecs.linuxfoundation.org/LSB_3.0.0/LSB-PDA/LSB-PDA.junk/symversion.html
+ * ld.so.cache formats, see glibc's sysdeps/generic/dl-cache.h
  *
- * Parse the .dynamic section and look for the entry with the DT_VERDEFNUM flag.
- * Its value holds the number of entries in the SHT_GNU_verdef section.
- *
- * Get the sh_link entry from the SHT_GNU_verdef section header. Its value is
- * the index number of the section header pointing to the section that holds the
- * version definition strings.
- *
- * Parse the Elfxx_Verdef arrays in the SHT_GNU_verdef section. The value
- * vd_next holds a relative offset to the next Elfxx_Verdef array.
- *
- * The Elfxx_Verdef arrays will have one or more Elfxx_Verdaux arrays associated
- * to them. The entry vd_aux is a relative offset to that array.
+ * The old format starts with "ld.so-1.7.0", followed by the number of entries
+ * and the entries. String offsets are relative to the end of the entries.
+ * Caches in the old format may be followed by a cache in the new format.
  *
- * The first Elfxx_Verdaux array holds information to the latest version string.
- * It's a relative offset into the section previously obtained from the sh_link
- * entry and points to a NUL-termintated string.
+ * The new format starts with "glibc-ld.so.cache1.1". String offsets are
+ * relative to the start of the new format header.
  */
-static char *find_symbol(const char *prefix)
+#define LDCACHE_MAGIC_OLD  "ld.so-1.7.0"
+#define LDCACHE_MAGIC_NEW  "glibc-ld.so.cache1.1"
+
+#define LDCACHE_FLAG_TYPE_MASK  0x00ff
+#define LDCACHE_FLAG_ELF_LIBC6  0x0003
+
+struct ldcache_old {
+    char magic[sizeof(LDCACHE_MAGIC_OLD) - 1];
+    uint32_t nlibs;
+};
+
+struct ldcache_entry_old {
+    int32_t flags;
+    uint32_t key, value;
+};
+
+struct ldcache_new {
+    char magic[sizeof(LDCACHE_MAGIC_NEW) - 1];
+    uint32_t nlibs;
+    uint32_t len_strings;
+    uint8_t flags;
+    uint8_t padding[3];
+    uint32_t extension_offset;
+    uint32_t unused[3];
+};
+
+struct ldcache_entry_new {
+    int32_t flags;
+    uint32_t key, value;
+    uint32_t osversion;
+    uint64_t hwcap;
+};
+
+
+/* get NUL-terminated string from the cache, or NULL if out of bounds */
+static const char *ldcache_string(const char *data, size_t len, uint32_t offset)
 {
-    size_t verdefnum;
-
-    /* get numbers of .gnu.version_d entries from .dynamic's DT_VERDEFNUM entry */
-    ElfW(Shdr) *dynamic = get_shdr(SHT_DYNAMIC, ".dynamic");
-
-    if (!dynamic || (verdefnum = get_dyn_val(dynamic, DT_VERDEFNUM)) == 0) {
+    if (offset >= len || !memchr(data + offset, 0, len - offset)) {
         return NULL;
     }
 
-    /* get link to section that holds the strings referenced
-     * by .gnu.version_d section */
-    ElfW(Shdr) *verdef = get_shdr(SHT_GNU_verdef, ".gnu.version_d");
+    return data + offset;
+}
 
-    if (!verdef || verdef->sh_link >= get_shnum()) {
-        return NULL;
-    }
 
-    ElfW(Shdr) *strings = &shdr[verdef->sh_link];
+/* look up library in a mapped ld.so.cache file */
+static char *ldcache_lookup(const char *cache, size_t len, const char *root, const char *filename, bool *known_format)
+{
+    const struct ldcache_new *hdr = NULL;
+    char *path;
+    size_t off = 0;
 
-    /* parse .gnu.version_d section */
-    ElfW(Off) vd_off = verdef->sh_offset;
-    const char *symbol = NULL;
-    const size_t pfxlen = strlen(prefix);
+    if (len >= sizeof(struct ldcache_old) &&
+        memcmp(cache, LDCACHE_MAGIC_OLD, sizeof(LDCACHE_MAGIC_OLD) - 1) == 0)
+    {
+        const struct ldcache_old *old = (const void *)cache;
+        off = sizeof(struct ldcache_old) + (size_t)old->nlibs * sizeof(struct ldcache_entry_old);
 
-    for (size_t i = 0; i < verdefnum; i++) {
-        ElfW(Verdef) *vd = get_offset(vd_off);
+        if (off > len) {
+            return NULL;
+        }
 
-        if (vd->vd_version == 1 &&               /* must be 1 */
-            vd->vd_flags != VER_FLG_BASE &&      /* skip library name entry */
-            vd->vd_aux >= sizeof(ElfW(Verdef)))  /* placed after ElfW(Verdef) array */
-        {
-            /* get only the latest version instead of iterating all ElfXX_Verdaux entries */
-            ElfW(Verdaux) *vda = get_offset(vd_off + vd->vd_aux);
-            const char *name = get_offset(strings->sh_offset + vda->vda_name);
+        /* prefer the new format if it's appended */
+        size_t off_new = (off + __alignof__(struct ldcache_new) - 1) & ~(__alignof__(struct ldcache_new) - 1);
 
-            if (is_prefixed_and_higher_version(name, symbol, prefix, pfxlen)) {
-                if (full_debug_mode) {
-                    DEBUG_PRINT(COL_RES, name);
+        if (off_new + sizeof(struct ldcache_new) <= len &&
+            memcmp(cache + off_new, LDCACHE_MAGIC_NEW, sizeof(LDCACHE_MAGIC_NEW) - 1) == 0)
+        {
+            off = off_new;
+            hdr = (const void *)(cache + off);
+        } else {
+            *known_format = true;
+            const struct ldcache_entry_old *e = (const void *)(cache + sizeof(struct ldcache_old));
+
+            for (uint32_t i = 0; i < old->nlibs; i++, e++) {
+                const char *key = ldcache_string(cache + off, len - off, e->key);
+                const char *value = ldcache_string(cache + off, len - off, e->value);
+
+                if ((e->flags & LDCACHE_FLAG_TYPE_MASK) == LDCACHE_FLAG_ELF_LIBC6 &&
+                    key && value && strcmp(key, filename) == 0 && (path = compatible_path(root, value)) != NULL)
+                {
+                    return path;
                 }
-
-                symbol = name;
             }
+
+            return NULL;
         }
+    } else if (len >= sizeof(struct ldcache_new) &&
+               memcmp(cache, LDCACHE_MAGIC_NEW, sizeof(LDCACHE_MAGIC_NEW) - 1) == 0)
+    {
+        hdr = (const void *)cache;
+    } else {
+        return NULL;
+    }
 
-        vd_off += vd->vd_next;
+    *known_format = true;
+
+    if (off + sizeof(struct ldcache_new) + (size_t)hdr->nlibs * sizeof(struct ldcache_entry_new) > len) {
+        return NULL;
     }
 
-    return symbol ? strdup(symbol) : NULL;
+    const struct ldcache_entry_new *e = (const void *)(cache + off + sizeof(struct ldcache_new));
+
+    for (uint32_t i = 0; i < hdr->nlibs; i++, e++) {
+        const char *key = ldcache_string(cache + off, len - off, e->key);
+        const char *value = ldcache_string(cache + off, len - off, e->value);
+
+        /* entries with hwcap bits set point into glibc-hwcaps subdirectories
+         * which would require the same ISA checks as the loader; skip them */
+        if ((e->flags & LDCACHE_FLAG_TYPE_MASK) == LDCACHE_FLAG_ELF_LIBC6 && e->hwcap == 0 &&
+            key && value && strcmp(key, filename) == 0 && (path = compatible_path(root, value)) != NULL)
+        {
+            return path;
+        }
+    }
+
+    return NULL;
 }
 
 
-/* mmap() library and look for symbol by prefix */
-static char *symbol_version(const char *path, const char *prefix, const char *msg)
+/* look for library in the trusted default directories of ld.so */
+static char *search_default_dirs(const char *root, const char *filename)
 {
-    struct stat st;
-    int fd;
+#if defined(__LP64__) || defined(_LP64)
+    return search_dirs(root, "/lib64:/usr/lib64:/lib:/usr/lib", filename);
+#else
+    return search_dirs(root, "/lib:/usr/lib", filename);
+#endif
+}
 
-    /* let dlmopen() do compatibility checks for us */
-    void *handle = load_lib_new_namespace(path);
-    dlclose(handle);
 
-    /* mmap() library */
-    if ((fd = open(path, O_RDONLY)) == -1) {
-        err(1, "open(): %s", path);
-    }
+/**
+ * Resolve library path without loading it, in the same order as ld.so:
+ * LD_LIBRARY_PATH, /etc/ld.so.cache, trusted default directories.
+ * If "root" is not NULL the library is resolved inside that system root,
+ * LD_LIBRARY_PATH is ignored and a missing or unknown ld.so.cache falls
+ * back to the default directories since there is no dlmopen() fallback.
+ * Returns NULL if the path could not be resolved reliably.
+ */
+static char *resolve_library_path(const char *root, const char *filename)
+{
+    struct stat st;
+    char *path = NULL;
+    bool known_format = false;
 
-    if (fstat(fd, &st) == -1) {
-        err(1, "fstat(): %s", path);
-    }
+    const char *env = root ? NULL : getenv("LD_LIBRARY_PATH");
 
-    if ((addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
-        err(1, "mmap(): %s", path);
+    if (env && *env && (path = search_dirs(NULL, env, filename)) != NULL) {
+        return path;
     }
 
-    /* file descriptor can now be closed */
-    close(fd);
+    char *ldso_cache = malloc((root ? strlen(root) : 0) + sizeof(LDSO_CACHE));
+    sprintf(ldso_cache, "%s" LDSO_CACHE, root ? root : "");
 
-    /* set global variables */
-    size = st.st_size;
-    ehdr = addr;
-    shdr = get_offset(ehdr->e_shoff);
+    int fd = open(ldso_cache, O_RDONLY | O_CLOEXEC);
 
-    /* look for symbol */
-    DEBUG_PRINT("searching " COL_XLIB " library: " COL_PATH, msg, path);
+    if (fd == -1) {
+        DEBUG_PRINT("cannot open: " COL_PATH, ldso_cache);
+        free(ldso_cache);
+        return root ? search_default_dirs(root, filename) : NULL;
+    }
 
-    char *symbol = find_symbol(prefix);
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *cache = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
 
-    if (symbol) {
-        DEBUG_PRINT("symbol " COL_RES " found", symbol);
+        if (cache != MAP_FAILED) {
+            path = ldcache_lookup(cache, st.st_size, root, filename, &known_format);
+            munmap(cache, st.st_size);
+        }
     }
 
-    /* unmap */
-    if (munmap(addr, size) == -1) {
-        warn("%s", "munmap() returned with an error");
+    close(fd);
+
+    if (!known_format) {
+        DEBUG_PRINT("unknown file format: " COL_PATH, ldso_cache);
+        free(ldso_cache);
+        return root ? search_default_dirs(root, filename) : NULL;
     }
 
-    return symbol;
+    free(ldso_cache);
+
+    return path ? path : search_default_dirs(root, filename);
 }
 
 
-/* compare symbol versions and return true
- * if we should use the bundled library */
-static bool use_bundled_library(const char *dir, const char *subdir, const char *libname, const char *prefix)
+#ifndef CHECKRT_STATIC
+/* retrieve full path of library by loading it with dlmopen() */
+static char *dlmopen_library_path(const char *filename, bool optional)
 {
-    bool rv = false;
+    struct link_map *map = NULL;
+    void *handle;
+    char *path;
 
-    char *lib_bundle = malloc(strlen(dir) + strlen(subdir) + strlen(libname) + 3);
-    sprintf(lib_bundle, "%s/%s/%s", dir, subdir, libname);
+    uint64_t start = trace_begin();
 
-    /* check if bundled file exists */
-    if (access(lib_bundle, F_OK) == 0) {
-        /* get symbols */
-        char *sym_bundle = symbol_version(lib_bundle, prefix, "bundled");
-        char *lib_sys = get_system_library_path(libname);
-        char *sym_sys = symbol_version(lib_sys, prefix, "system");
+    if (optional) {
+        if ((handle = dlmopen(LM_ID_NEWLM, filename, RTLD_LAZY)) == NULL) {
+            trace_event(start, "resolve", "lib", filename, "path", NULL, "method", "dlmopen", NULL);
+            return NULL;
+        }
+    } else {
+        handle = load_lib_new_namespace(filename);
+    }
 
-        /* compare symbols */
-        if (sym_bundle && sym_sys && strverscmp(sym_bundle, sym_sys) > 0) {
-            rv = true;
+    if (dlinfo(handle, RTLD_DI_LINKMAP, &map) == -1 || !map->l_name || map->l_name[0] == 0) {
+        if (!optional) {
+            errx(1, "%s: %s", filename, "dlinfo() failed to get absolute pathname");
         }
 
-        free(lib_sys);
-        free(sym_sys);
-        free(sym_bundle);
-    } else {
-        DEBUG_PRINT("no access or file does not exist: " COL_PATH, lib_bundle);
+        DEBUG_PRINT("dlinfo() failed to get absolute pathname of " COL_LIB, filename);
+        dlclose(handle);
+        trace_event(start, "resolve", "lib", filename, "path", NULL, "method", "dlmopen", NULL);
+        return NULL;
     }
 
-    DEBUG_PRINT("use " COL_SYS " " COL_LIB " library", rv ? "BUNDLED" : "SYSTEM", libname);
-    free(lib_bundle);
+    path = strdup(map->l_name);
+    DEBUG_PRINT(COL_LIB " resolved by dlmopen() to: " COL_PATH, filename, path);
 
-    return rv;
+    dlclose(handle);
+    trace_event(start, "resolve", "lib", filename, "path", path, "method", "dlmopen", NULL);
+
+    return path;
 }
+#endif
 
 
-/* get full dirname of executable */
-static char *get_exe_dir()
+/* retrieve full path of system library; if "optional" is true
+ * NULL is returned instead of exiting if it can't be found */
+static char *get_system_library_path(const char *filename, bool optional)
 {
-    char *self = realpath("/proc/self/exe", NULL);
+    uint64_t start = trace_begin();
+    char *path = resolve_library_path(NULL, filename);
+
+    if (path) {
+        DEBUG_PRINT(COL_LIB " resolved to: " COL_PATH, filename, path);
+        trace_event(start, "resolve", "lib", filename, "path", path, "method", "search", NULL);
+        return path;
+    }
+
+#ifdef CHECKRT_STATIC
+    trace_event(start, "resolve", "lib", filename, "path", NULL, "method", "search", NULL);
+
+    if (!optional) {
+        errx(1, "%s: %s", filename, "cannot resolve library path");
+    }
+
+    return NULL;
+#else
+    return dlmopen_library_path(filename, optional);
+#endif
+}
+
+
+#ifndef CHECKRT_LIBRARY
+/* copy file content, preferably without passing the data through userspace;
+ * each method continues at the file offsets where the previous one stopped */
+static void copy_file_data(int fd_in, int fd_out, off_t size, const char *src, const char *target)
+{
+    ssize_t n;
+    off_t copied = 0;
+
+    /* reflink, shares the data blocks on filesystems like btrfs or XFS */
+    if (ioctl(fd_out, FICLONE, fd_in) == 0) {
+        return;
+    }
+
+    /* in-kernel copy; called through syscall() because the wrapper is missing
+     * in glibc before 2.27 and in musl before 1.1.24 */
+#ifdef SYS_copy_file_range
+    while (copied < size && (n = syscall(SYS_copy_file_range, fd_in, NULL, fd_out, NULL, (size_t)(size - copied), 0)) > 0) {
+        copied += n;
+    }
+#endif
+
+    while (copied < size && (n = sendfile(fd_out, fd_in, NULL, size - copied)) > 0) {
+        copied += n;
+    }
+
+    if (copied == size) {
+        return;
+    }
+
+    /* copy through a buffer as last resort */
+    const size_t bufsize = 512*1024;
+    uint8_t *buf = malloc(bufsize);
+
+    while ((n = read(fd_in, buf, bufsize)) != 0) {
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            err(1, "error reading from file: %s", src);
+        }
+
+        /* handle partial writes */
+        for (ssize_t off = 0; off < n; ) {
+            ssize_t rv = write(fd_out, buf + off, n - off);
+
+            if (rv == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                err(1, "error writing to file: %s", target);
+            }
+
+            off += rv;
+        }
+    }
+
+    free(buf);
+}
+
+
+/* copy library from system into directory next to binary and return the
+ * path of the copy, or NULL if the library wasn't found; if "strip" is true
+ * the sections not needed at runtime are removed */
+static char *copy_lib(const char *dir, const struct runtime_lib *lib, bool strip)
+{
+    struct stat st;
+    int fd_in, fd_out;
+
+    /* find library */
+    char *src = get_system_library_path(lib->soname, lib->optional);
+
+    if (!src) {
+        printf("Library not found, skipping: %s\n", lib->soname);
+        return NULL;
+    }
+
+    printf("Copy library: %s\n", src);
+
+    /* create target directory */
+    char *target = malloc(strlen(dir) + strlen(lib->subdir) + strlen(lib->soname) + 3);
+    sprintf(target, "%s/%s/", dir, lib->subdir);
+    mkdir(target, 0775);
+
+    /* open source file for reading */
+    if ((fd_in = open(src, O_RDONLY | O_CLOEXEC)) < 0) {
+        err(1, "cannot open file for reading: %s", src);
+    }
+
+    if (fstat(fd_in, &st) == -1) {
+        err(1, "fstat(): %s", src);
+    }
+
+    /* open target file for writing */
+    strcat(target, lib->soname);
+
+    if ((fd_out = open(target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0664)) < 0) {
+        err(1, "cannot open file for writing: %s", target);
+    }
+
+    copy_file_data(fd_in, fd_out, st.st_size, src, target);
+
+    if (strip && strip_library(src, fd_out, target) < 0) {
+        printf("Cannot strip library, keeping full copy: %s\n", target);
+    }
+
+    /* preserve file mode */
+    if (fchmod(fd_out, st.st_mode & 07777) == -1) {
+        warn("fchmod(): %s", target);
+    }
+
+    /* free resources */
+    if (close(fd_out) == -1) {
+        err(1, "error writing to file: %s", target);
+    }
+
+    close(fd_in);
+    free(src);
+
+    return target;
+}
+
+
+/* remove a copy of a library left from a previous run */
+static void remove_lib(const char *dir, const struct runtime_lib *lib)
+{
+    char *path = malloc(strlen(dir) + strlen(lib->subdir) + strlen(lib->soname) + 3);
+    sprintf(path, "%s/%s/%s", dir, lib->subdir, lib->soname);
+
+    if (unlink(path) == 0) {
+        printf("Removed library: %s\n", path);
+    }
+
+    /* the directory is removed only if it's empty */
+    *strrchr(path, '/') = 0;
+    rmdir(path);
+
+    free(path);
+}
+#endif /* !CHECKRT_LIBRARY */
+
+
+/* remember the first error of an ELF file and return NULL; the callers
+ * pass NULL on and the error is returned once parsing has stopped */
+static void *elf_fail(struct elf_file *elf, int error, const char *msg)
+{
+    DEBUG_PRINT("%s: %s", elf->path, msg);
+
+    if (elf->error == CHECKRT_OK) {
+        elf->error = error;
+    }
+
+    return NULL;
+}
+
+
+#ifdef ENABLE_PREAD
+
+/* read exactly "len" bytes at "offset" */
+static bool read_at(struct elf_file *elf, void *buf, ElfW(Off) offset, size_t len)
+{
+    for (size_t n = 0; n < len; ) {
+        ssize_t rv = pread(elf->fd, (uint8_t *)buf + n, len - n, offset + n);
+
+        if (rv < 1) {
+            return false;
+        }
+
+        n += rv;
+    }
+
+    return true;
+}
+
+
+/* get "len" bytes at "offset"; only the requested range is read from the file
+ * unless it's already covered by a previous read */
+static void *get_offset(struct elf_file *elf, ElfW(Off) offset, size_t len)
+{
+    if (offset > elf->size || len > elf->size - offset) {
+        return elf_fail(elf, CHECKRT_EFORMAT, "*** offset exceeds filesize ***");
+    }
+
+    struct elf_region *lru = &elf->regions[0];
+
+    for (size_t i = 0; i < ELF_REGIONS; i++) {
+        struct elf_region *r = &elf->regions[i];
+
+        if (r->used > 0 && offset >= r->offset && offset + len <= r->offset + r->len) {
+            r->used = ++elf->clock;
+            return r->data + (offset - r->offset);
+        }
+
+        if (r->used < lru->used) {
+            lru = r;
+        }
+    }
+
+    /* reuse the least recently used region, and its buffer if it's large enough */
+    if (lru->size < len + 1) {
+        free(lru->data);
+        lru->size = len + 1;
+        lru->data = malloc(lru->size);
+    }
+
+    lru->used = 0;
+
+    if (!read_at(elf, lru->data, offset, len)) {
+        return elf_fail(elf, CHECKRT_EIO, "pread() failed");
+    }
+
+    lru->offset = offset;
+    lru->len = len;
+    lru->used = ++elf->clock;
+
+    return lru->data;
+}
+
+
+/* get the ELF or section header table, replacing "table" if it's not NULL;
+ * they are read into memory of their own instead of a region, so they stay
+ * valid until elf_close() */
+static void *get_table(struct elf_file *elf, void *table, ElfW(Off) offset, size_t len)
+{
+    if (offset > elf->size || len > elf->size - offset) {
+        free(table);
+        return elf_fail(elf, CHECKRT_EFORMAT, "*** offset exceeds filesize ***");
+    }
+
+    uint8_t *buf = realloc(table, len + 1);
+
+    if (!read_at(elf, buf, offset, len)) {
+        free(buf);
+        return elf_fail(elf, CHECKRT_EIO, "pread() failed");
+    }
+
+    return buf;
+}
+
+#else
+
+/* perform filesize check and get offset */
+static void *get_offset(struct elf_file *elf, ElfW(Off) offset, size_t len)
+{
+    if (offset > elf->size || len > elf->size - offset) {
+        return elf_fail(elf, CHECKRT_EFORMAT, "*** offset exceeds filesize ***");
+    }
+
+    return (elf->addr + offset);
+}
+
+
+/* get the ELF or section header table */
+static void *get_table(struct elf_file *elf, void *table, ElfW(Off) offset, size_t len)
+{
+    (void)table;
+    return get_offset(elf, offset, len);
+}
+
+#endif /* !ENABLE_PREAD */
+
+
+/* get NUL-terminated string from a string table; NULL on error */
+static const char *get_string(struct elf_file *elf, const ElfW(Shdr) *strtab, size_t index)
+{
+    if (index >= strtab->sh_size) {
+        return elf_fail(elf, CHECKRT_EFORMAT, "*** string offset exceeds section size ***");
+    }
+
+    size_t max = strtab->sh_size - index;
+
+    /* version and section names are short */
+    for (size_t len = (max < 64) ? max : 64; ; len = (max < len * 8) ? max : len * 8) {
+        const char *str = get_offset(elf, strtab->sh_offset + index, len);
+
+        if (!str || memchr(str, 0, len)) {
+            return str;
+        }
+
+        if (len == max) {
+            return elf_fail(elf, CHECKRT_EFORMAT, "*** unterminated string ***");
+        }
+    }
+}
+
+
+/* read the part of a string table that holds the strings at the offsets
+ * "min" to "max" at once; strings of the same kind (version names, library
+ * names) are usually placed next to each other */
+static void get_string_range(struct elf_file *elf, const ElfW(Shdr) *strtab, size_t min, size_t max)
+{
+    if (min < strtab->sh_size) {
+        size_t end = (max < strtab->sh_size && strtab->sh_size - max > 64) ? max + 64 : strtab->sh_size;
+        get_offset(elf, strtab->sh_offset + min, end - min);
+    }
+}
+
+
+/* value is stored in shdr[0].sh_size if it's too large */
+static size_t get_shnum(const struct elf_file *elf) {
+    if (!elf->shdr) {
+        return 0;
+    }
+
+    return (elf->ehdr->e_shnum == 0) ? elf->shdr[0].sh_size : elf->ehdr->e_shnum;
+}
+
+
+/* value is stored in shdr[0].sh_link if it's too large */
+static size_t get_shstrndx(const struct elf_file *elf) {
+    return (elf->ehdr->e_shstrndx == SHN_XINDEX) ? elf->shdr[0].sh_link : elf->ehdr->e_shstrndx;
+}
+
+
+/* get section header by name */
+static ElfW(Shdr) *get_shdr(struct elf_file *elf, ElfW(Word) type, const char *name)
+{
+    ElfW(Shdr) *shdr = elf->shdr;
+    size_t shnum = get_shnum(elf);
+
+    if (shnum == 0) {
+        return NULL;
+    }
+
+    size_t shstrndx = get_shstrndx(elf);
+
+    if (shstrndx == 0 || shstrndx >= shnum) {
+        return NULL;
+    }
+
+    ElfW(Shdr) *strtab = &shdr[shstrndx];
+
+    /* section names are read one after another */
+    if (!get_offset(elf, strtab->sh_offset, strtab->sh_size)) {
+        return NULL;
+    }
+
+    for (size_t i = 1; i < shnum; i++) {
+        if (shdr[i].sh_type != type) {
+            continue;
+        }
+
+        const char *ptr = get_string(elf, strtab, shdr[i].sh_name);
+
+        if (!ptr) {
+            return NULL;
+        }
+
+        if (strcmp(ptr, name) == 0) {
+            return &shdr[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/* check the PT_DYNAMIC segment in the program headers;
+ * returns an error message or NULL if it's fine */
+static const char *check_dynamic_segment(struct elf_file *elf)
+{
+    const ElfW(Ehdr) *ehdr = elf->ehdr;
+    size_t phsize = (size_t)ehdr->e_phnum * sizeof(ElfW(Phdr));
+
+    if (ehdr->e_phoff == 0 || ehdr->e_phoff > elf->size || phsize > elf->size - ehdr->e_phoff) {
+        return "cannot read program headers";
+    }
+
+    ElfW(Phdr) *phdr = get_offset(elf, ehdr->e_phoff, phsize);
+
+    if (!phdr) {
+        return "cannot read program headers";
+    }
+
+    for (size_t i = 0; i < ehdr->e_phnum; i++) {
+        if (phdr[i].p_type != PT_DYNAMIC) {
+            continue;
+        }
+
+        if (phdr[i].p_offset > elf->size || phdr[i].p_filesz > elf->size - phdr[i].p_offset) {
+            return "cannot read dynamic section";
+        }
+
+        ElfW(Dyn) *dyn = get_offset(elf, phdr[i].p_offset, phdr[i].p_filesz);
+
+        if (!dyn) {
+            return "cannot read dynamic section";
+        }
+
+        for (size_t j = 0; j < phdr[i].p_filesz / sizeof(ElfW(Dyn)) && dyn[j].d_tag != DT_NULL; j++) {
+            if (dyn[j].d_tag == DT_FLAGS_1 && (dyn[j].d_un.d_val & DF_1_PIE)) {
+                return "cannot dynamically load position-independent executable";
+            }
+        }
+
+        return NULL;
+    }
+
+    return "object has no dynamic section";
+}
+
+
+/* get dynamic entry value by tag */
+static size_t get_dyn_val(struct elf_file *elf, ElfW(Shdr) *dynamic, ElfW(Sword) tag)
+{
+    if (dynamic->sh_size == 0 || dynamic->sh_entsize == 0) {
+        return 0;
+    }
+
+    ElfW(Dyn) *dyn = get_offset(elf, dynamic->sh_offset, dynamic->sh_size);
+
+    for (size_t i = 0; dyn && i < (dynamic->sh_size / dynamic->sh_entsize); i++, dyn++) {
+        if (dyn->d_tag == tag) {
+            return dyn->d_un.d_val;
+        }
+    }
+
+    return 0;
+}
+
+
+static bool is_prefixed_and_higher_version(const char *new, const char *old, const char *prefix, size_t pfxlen)
+{
+    return (strncmp(new, prefix, pfxlen) == 0 &&  /* symbol name starts with prefix */
+            isdigit(*(new + pfxlen)) &&           /* first byte after prefix is a digit */
+            (!old || strverscmp(old, new) < 0));  /* get higher version string */
+}
+
+
+/* length of the family part of the first "len" bytes of a version name,
+ * e.g. "CXXABI_" of "CXXABI_1.3.13" or "CXXABI_TM_" of "CXXABI_TM_1";
+ * that is up to the number after the last underscore, or the whole name
+ * for names without a number like "CXXABI_FLOAT128" */
+static size_t version_family_len(const char *name, size_t len)
+{
+    for (size_t i = len; i > 0; i--) {
+        if (name[i - 1] == '_') {
+            return (i < len && isdigit(name[i])) ? i : len;
+        }
+    }
+
+    return len;
+}
+
+
+/* add a version to a comma separated list that holds the highest version of
+ * every family; it replaces a lower version of its family */
+static void add_version(char **list, const char *name)
+{
+    size_t len = strlen(name);
+    size_t flen = version_family_len(name, len);
+    char *buf;
+
+    for (char *p = *list; p && *p; ) {
+        size_t n = strcspn(p, ",");
+
+        if (version_family_len(p, n) == flen && strncmp(p, name, flen) == 0) {
+            char *item = strndup(p, n);
+            bool higher = (strverscmp(item, name) < 0);
+            free(item);
+
+            if (!higher) {
+                return;
+            }
+
+            buf = malloc(strlen(*list) - n + len + 1);
+            sprintf(buf, "%.*s%s%s", (int)(p - *list), *list, name, p + n);
+            free(*list);
+            *list = buf;
+            return;
+        }
+
+        p += n;
+
+        if (*p) {
+            p++;
+        }
+    }
+
+    buf = malloc((*list ? strlen(*list) + 1 : 0) + len + 1);
+    sprintf(buf, "%s%s%s", *list ? *list : "", *list ? "," : "", name);
+    free(*list);
+    *list = buf;
+}
+
+
+/* check whether the comma separated list "defined" has a version of the same
+ * family at least as high as every version of the list "required" */
+static bool provides_versions(const char *defined, const char *required)
+{
+    for (const char *r = required; r && *r; ) {
+        size_t n = strcspn(r, ",");
+        size_t flen = version_family_len(r, n);
+        char *item = strndup(r, n);
+        bool found = false;
+
+        for (const char *d = defined; d && *d && !found; ) {
+            size_t dn = strcspn(d, ",");
+
+            if (version_family_len(d, dn) == flen && strncmp(d, item, flen) == 0) {
+                char *def = strndup(d, dn);
+                found = (strverscmp(def, item) >= 0);
+                free(def);
+            }
+
+            d += dn;
+
+            if (*d) {
+                d++;
+            }
+        }
+
+        if (!found) {
+            DEBUG_PRINT("system library lacks required version " COL_RES, item);
+            free(item);
+            return false;
+        }
+
+        free(item);
+        r += n;
+
+        if (*r) {
+            r++;
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * Find symbol in SHT_GNU_verdef section
+ * https://refspecs.linuxfoundation.org/LSB_3.0.0/LSB-PDA/LSB-PDA.junk/symversion.html
+ *
+ * Parse the .dynamic section and look for the entry with the DT_VERDEFNUM flag.
+ * Its value holds the number of entries in the SHT_GNU_verdef section.
+ *
+ * Get the sh_link entry from the SHT_GNU_verdef section header. Its value is
+ * the index number of the section header pointing to the section that holds the
+ * version definition strings.
+ *
+ * Parse the Elfxx_Verdef arrays in the SHT_GNU_verdef section. The value
+ * vd_next holds a relative offset to the next Elfxx_Verdef array.
+ *
+ * The Elfxx_Verdef arrays will have one or more Elfxx_Verdaux arrays associated
+ * to them. The entry vd_aux is a relative offset to that array.
+ *
+ * The first Elfxx_Verdaux array holds information to the latest version string.
+ * It's a relative offset into the section previously obtained from the sh_link
+ * entry and points to a NUL-termintated string.
+ *
+ * If "defined" is not NULL, the highest version of every version family
+ * (see add_version()) is added to it.
+ *
+ * Returns NULL if there is no version with the prefix or on errors,
+ * which are set in "elf".
+ */
+static char *find_symbol(struct elf_file *elf, const char *prefix, char **defined)
+{
+    size_t verdefnum;
+
+    /* get numbers of .gnu.version_d entries from .dynamic's DT_VERDEFNUM entry */
+    ElfW(Shdr) *dynamic = get_shdr(elf, SHT_DYNAMIC, ".dynamic");
+
+    if (!dynamic || (verdefnum = get_dyn_val(elf, dynamic, DT_VERDEFNUM)) == 0) {
+        return NULL;
+    }
+
+    /* get link to section that holds the strings referenced
+     * by .gnu.version_d section */
+    ElfW(Shdr) *verdef = get_shdr(elf, SHT_GNU_verdef, ".gnu.version_d");
+
+    if (!verdef || verdef->sh_link >= get_shnum(elf)) {
+        return NULL;
+    }
+
+    ElfW(Shdr) *strings = &elf->shdr[verdef->sh_link];
+
+    /* read the whole section at once */
+    get_offset(elf, verdef->sh_offset, verdef->sh_size);
+
+    /* version strings are usually placed next to each other;
+     * read the range that covers all of them at once too */
+    ElfW(Off) vd_off = verdef->sh_offset;
+    size_t str_min = SIZE_MAX, str_max = 0;
+
+    for (size_t i = 0; i < verdefnum; i++) {
+        ElfW(Verdef) *vd = get_offset(elf, vd_off, sizeof(ElfW(Verdef)));
+
+        if (!vd) {
+            return NULL;
+        }
+
+        if (vd->vd_aux >= sizeof(ElfW(Verdef))) {
+            ElfW(Verdaux) *vda = get_offset(elf, vd_off + vd->vd_aux, sizeof(ElfW(Verdaux)));
+
+            if (!vda) {
+                return NULL;
+            }
+
+            str_min = (vda->vda_name < str_min) ? vda->vda_name : str_min;
+            str_max = (vda->vda_name > str_max) ? vda->vda_name : str_max;
+        }
+
+        vd_off += vd->vd_next;
+    }
+
+    get_string_range(elf, strings, str_min, str_max);
+
+    /* parse .gnu.version_d section */
+    const char *symbol = NULL;
+    const size_t pfxlen = strlen(prefix);
+    vd_off = verdef->sh_offset;
+
+    for (size_t i = 0; i < verdefnum; i++) {
+        ElfW(Verdef) *vd = get_offset(elf, vd_off, sizeof(ElfW(Verdef)));
+
+        if (!vd) {
+            return NULL;
+        }
+
+        if (vd->vd_version == 1 &&               /* must be 1 */
+            vd->vd_flags != VER_FLG_BASE &&      /* skip library name entry */
+            vd->vd_aux >= sizeof(ElfW(Verdef)))  /* placed after ElfW(Verdef) array */
+        {
+            /* get only the latest version instead of iterating all ElfXX_Verdaux entries */
+            ElfW(Verdaux) *vda = get_offset(elf, vd_off + vd->vd_aux, sizeof(ElfW(Verdaux)));
+            const char *name = vda ? get_string(elf, strings, vda->vda_name) : NULL;
+
+            if (!name) {
+                return NULL;
+            }
+
+            if (defined) {
+                add_version(defined, name);
+            }
+
+            if (is_prefixed_and_higher_version(name, symbol, prefix, pfxlen)) {
+                if (full_debug_mode) {
+                    DEBUG_PRINT(COL_RES, name);
+                }
+
+                symbol = name;
+            }
+        }
+
+        vd_off += vd->vd_next;
+    }
+
+    return symbol ? strdup(symbol) : NULL;
+}
+
+
+/* open ELF file and read its headers; if "library" is true the same
+ * compatibility checks as ld.so are done, otherwise files that aren't
+ * native ELF files are rejected without a message; returns CHECKRT_OK
+ * or an error code, in which case nothing needs to be closed */
+static int elf_open(struct elf_file *elf, const char *path, bool library)
+{
+    struct stat st;
+    int fd;
+
+    memset(elf, 0, sizeof(struct elf_file));
+    elf->path = path;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+        if (library) {
+            DEBUG_PRINT("cannot open: " COL_PATH, path);
+        }
+
+        return (errno == ENOENT) ? CHECKRT_ENOTFOUND : CHECKRT_EIO;
+    }
+
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return CHECKRT_EIO;
+    }
+
+    elf->size = st.st_size;
+
+    if (elf->size < sizeof(ElfW(Ehdr))) {
+        if (library) {
+            DEBUG_PRINT("file too short: " COL_PATH, path);
+        }
+
+        close(fd);
+        return CHECKRT_EFORMAT;
+    }
+
+#ifdef ENABLE_PREAD
+    elf->fd = fd;
+#else
+    elf->addr = mmap(NULL, elf->size, PROT_READ, MAP_SHARED, fd, 0);
+
+    /* file descriptor can now be closed */
+    close(fd);
+
+    if (elf->addr == MAP_FAILED) {
+        return CHECKRT_EIO;
+    }
+#endif
+
+    if ((elf->ehdr = get_table(elf, NULL, 0, sizeof(ElfW(Ehdr)))) == NULL) {
+        elf_close(elf);
+        return elf->error;
+    }
+
+    if (library) {
+        const char *errmsg = check_elf_header(elf->ehdr);
+
+        if (!errmsg) {
+            errmsg = check_dynamic_segment(elf);
+        }
+
+        if (errmsg) {
+            elf_fail(elf, CHECKRT_EFORMAT, errmsg);
+            elf_close(elf);
+            return elf->error;
+        }
+    } else if (memcmp(elf->ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+               elf->ehdr->e_ident[EI_CLASS] != __ehdr_start.e_ident[EI_CLASS] ||
+               elf->ehdr->e_ident[EI_DATA] != __ehdr_start.e_ident[EI_DATA] ||
+               elf->ehdr->e_machine != __ehdr_start.e_machine)
+    {
+        elf_close(elf);
+        return CHECKRT_EFORMAT;
+    }
+
+    /* read section header table */
+    if (elf->ehdr->e_shoff == 0 || elf->ehdr->e_shentsize != sizeof(ElfW(Shdr))) {
+        return CHECKRT_OK;
+    }
+
+    /* the number of sections is stored in the first section header if it's too large */
+    size_t shnum = (elf->ehdr->e_shnum > 0) ? elf->ehdr->e_shnum : 1;
+    elf->shdr = get_table(elf, NULL, elf->ehdr->e_shoff, shnum * sizeof(ElfW(Shdr)));
+    shnum = get_shnum(elf);
+
+    if (elf->shdr && shnum > (elf->size - elf->ehdr->e_shoff) / sizeof(ElfW(Shdr))) {
+        elf_fail(elf, CHECKRT_EFORMAT, "*** section header table exceeds filesize ***");
+    } else if (elf->shdr && elf->ehdr->e_shnum == 0 && shnum > 1) {
+        elf->shdr = get_table(elf, elf->shdr, elf->ehdr->e_shoff, shnum * sizeof(ElfW(Shdr)));
+    }
+
+    if (elf->error != CHECKRT_OK) {
+        elf_close(elf);
+        return elf->error;
+    }
+
+    return CHECKRT_OK;
+}
+
+
+static void elf_close(struct elf_file *elf)
+{
+#ifdef ENABLE_PREAD
+    for (size_t i = 0; i < ELF_REGIONS; i++) {
+        free(elf->regions[i].data);
+    }
+
+    free(elf->ehdr);
+    free(elf->shdr);
+    close(elf->fd);
+#else
+    if (munmap(elf->addr, elf->size) == -1) {
+        DEBUG_PRINT("%s", "munmap() returned with an error");
+    }
+#endif
+}
+
+
+/* open library and look for symbol by prefix; "version" is set to
+ * NULL if there is none; if "defined" is not NULL it's set to the list
+ * of versions from find_symbol(); returns CHECKRT_OK or an error code */
+static int symbol_version(const char *path, const char *prefix, const char *msg, char **version, char **defined)
+{
+    struct elf_file elf;
+
+    *version = NULL;
+
+    if (defined) {
+        *defined = NULL;
+    }
+
+    uint64_t start = trace_begin();
+    int rv = elf_open(&elf, path, true);
+    trace_event(start, "elf_open", "path", path, "kind", msg, NULL);
+
+    if (rv != CHECKRT_OK) {
+        return rv;
+    }
+
+    /* look for symbol */
+    DEBUG_PRINT("searching " COL_XLIB " library: " COL_PATH, msg, path);
+
+    start = trace_begin();
+    char *symbol = find_symbol(&elf, prefix, defined);
+    trace_event(start, "find_symbol", "path", path, "kind", msg, "version", symbol, NULL);
+
+    if (symbol) {
+        DEBUG_PRINT("symbol " COL_RES " found in " COL_PATH, symbol, path);
+    }
+
+    start = trace_begin();
+    elf_close(&elf);
+    trace_event(start, "elf_close", "path", path, "kind", msg, NULL);
+
+    if (elf.error != CHECKRT_OK) {
+        free(symbol);
+
+        if (defined) {
+            free(*defined);
+            *defined = NULL;
+        }
+
+        return elf.error;
+    }
+
+    *version = symbol;
+
+    return CHECKRT_OK;
+}
+
+
+#ifndef CHECKRT_LIBRARY
+/* write "len" bytes at "offset"; errors are fatal */
+static void write_at(int fd, const void *buf, size_t len, off_t offset, const char *target)
+{
+    for (size_t n = 0; n < len; ) {
+        ssize_t rv = pwrite(fd, (const uint8_t *)buf + n, len - n, offset + n);
+
+        if (rv == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            err(1, "error writing to file: %s", target);
+        }
+
+        n += rv;
+    }
+}
+
+
+/**
+ * Strip a copied library in place: everything the dynamic loader and
+ * find_symbol() need (the ELF and program headers, the loadable segments
+ * and the SHF_ALLOC sections like .dynamic, .dynsym, .dynstr, .gnu.hash
+ * and .gnu.version*) is placed at the beginning of the file by the linker.
+ * The copy is truncated after that and a new .shstrtab and a section header
+ * table with only the SHF_ALLOC sections are appended. This removes .symtab,
+ * .strtab, .comment, .gnu_debuglink, DWARF sections and the like.
+ *
+ * "src" is the original file, "fd_out" the copy. Returns 1 if the copy
+ * was stripped, 0 if there was nothing to remove (e.g. the library is
+ * already stripped) and -1 if the file layout isn't understood; the copy
+ * isn't changed in the last two cases.
+ */
+static int strip_library(const char *src, int fd_out, const char *target)
+{
+    struct elf_file elf;
+
+    if (elf_open(&elf, src, true) != CHECKRT_OK) {
+        return -1;
+    }
+
+    ElfW(Ehdr) ehdr = *elf.ehdr;
+    size_t shnum = get_shnum(&elf);
+    size_t shstrndx = elf.shdr ? get_shstrndx(&elf) : 0;
+
+    /* no section headers at all, nothing to remove */
+    if (ehdr.e_shoff == 0 && ehdr.e_shnum == 0) {
+        elf_close(&elf);
+        return 0;
+    }
+
+    /* extended section numbering is not handled */
+    if (!elf.shdr || ehdr.e_shnum == 0 || shstrndx == 0 || shstrndx >= shnum) {
+        elf_close(&elf);
+        return -1;
+    }
+
+    ElfW(Phdr) *phdr = get_offset(&elf, ehdr.e_phoff, (size_t)ehdr.e_phnum * sizeof(ElfW(Phdr)));
+    size_t end = ehdr.e_phoff + (size_t)ehdr.e_phnum * sizeof(ElfW(Phdr));
+
+    for (size_t i = 0; phdr && i < ehdr.e_phnum; i++) {
+        if (phdr[i].p_filesz > 0 && phdr[i].p_offset + phdr[i].p_filesz > end) {
+            end = phdr[i].p_offset + phdr[i].p_filesz;
+        }
+    }
+
+    /* new section indices, section names and headers */
+    size_t *map = calloc(shnum, sizeof(size_t));
+    ElfW(Shdr) *shdr = calloc(shnum + 1, sizeof(ElfW(Shdr)));
+    char *names = calloc(1, 1);
+    size_t count = 1, names_len = 1;
+
+    for (size_t i = 1; i < shnum && elf.error == CHECKRT_OK; i++) {
+        const ElfW(Shdr) *sh = &elf.shdr[i];
+
+        if (!(sh->sh_flags & SHF_ALLOC)) {
+            continue;
+        }
+
+        const char *name = get_string(&elf, &elf.shdr[shstrndx], sh->sh_name);
+
+        if (!name) {
+            break;
+        }
+
+        if (sh->sh_type != SHT_NOBITS && sh->sh_offset + sh->sh_size > end) {
+            end = sh->sh_offset + sh->sh_size;
+        }
+
+        names = realloc(names, names_len + strlen(name) + 1);
+        strcpy(names + names_len, name);
+
+        map[i] = count;
+        shdr[count] = *sh;
+        shdr[count].sh_name = names_len;
+        names_len += strlen(name) + 1;
+        count++;
+    }
+
+    if (elf.error != CHECKRT_OK || end >= elf.size) {
+        /* error or nothing to remove */
+        int rv = (elf.error != CHECKRT_OK) ? -1 : 0;
+        free(map);
+        free(shdr);
+        free(names);
+        elf_close(&elf);
+        return rv;
+    }
+
+    /* section indices in sh_link and sh_info */
+    for (size_t i = 1; i < count; i++) {
+        shdr[i].sh_link = (shdr[i].sh_link < shnum) ? map[shdr[i].sh_link] : 0;
+
+        if ((shdr[i].sh_flags & SHF_INFO_LINK) && shdr[i].sh_info < shnum) {
+            shdr[i].sh_info = map[shdr[i].sh_info];
+        }
+    }
+
+    /* the new .shstrtab follows the loadable data, the section headers follow it */
+    names = realloc(names, names_len + sizeof(".shstrtab"));
+    strcpy(names + names_len, ".shstrtab");
+
+    shdr[count] = (ElfW(Shdr)) {
+        .sh_name = names_len,
+        .sh_type = SHT_STRTAB,
+        .sh_offset = end,
+        .sh_size = names_len + sizeof(".shstrtab"),
+        .sh_addralign = 1
+    };
+
+    names_len += sizeof(".shstrtab");
+    count++;
+
+    size_t shoff = (end + names_len + sizeof(ElfW(Addr)) - 1) & ~(sizeof(ElfW(Addr)) - 1);
+    size_t size = shoff + count * sizeof(ElfW(Shdr));
+
+    /* only the section headers and their names would be rewritten */
+    if (size >= elf.size) {
+        free(map);
+        free(shdr);
+        free(names);
+        elf_close(&elf);
+        return 0;
+    }
+
+    ehdr.e_shoff = shoff;
+    ehdr.e_shnum = count;
+    ehdr.e_shstrndx = count - 1;
+
+    if (ftruncate(fd_out, end) == -1) {
+        err(1, "ftruncate(): %s", target);
+    }
+
+    write_at(fd_out, names, names_len, end, target);
+    write_at(fd_out, shdr, count * sizeof(ElfW(Shdr)), shoff, target);
+    write_at(fd_out, &ehdr, sizeof(ehdr), 0, target);
+
+    printf("Stripped library: %s (%zu -> %zu bytes)\n", target, elf.size, size);
+
+    free(map);
+    free(shdr);
+    free(names);
+    elf_close(&elf);
+
+    return 1;
+}
+#endif /* !CHECKRT_LIBRARY */
+
+
+/* list of "VERSION name" strings */
+struct symbol_list {
+    char **items;
+    size_t count;
+};
+
+
+static void symbol_list_add(struct symbol_list *list, char *item)
+{
+    if ((list->count & (list->count - 1)) == 0) {
+        list->items = realloc(list->items, (list->count ? list->count * 2 : 1) * sizeof(char *));
+    }
+
+    list->items[list->count++] = item;
+}
+
+
+static void symbol_list_free(struct symbol_list *list)
+{
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->items[i]);
+    }
+
+    free(list->items);
+    list->items = NULL;
+    list->count = 0;
+}
+
+
+/* version index of a managed library's version, see find_requirements() */
+struct version_ref {
+    ElfW(Half) index;
+    size_t lib;
+    char *name;
+};
+
+
+#ifndef CHECKRT_LIBRARY
+/* Add the undefined dynamic symbols of an ELF file that are bound to one
+ * of the versions in "refs" to the list of the library they come from.
+ * The SHT_GNU_versym section holds the version index of every symbol of
+ * the SHT_DYNSYM section; the hidden bit 0x8000 is masked out. */
+static void find_imports(struct elf_file *elf, const struct version_ref *refs, size_t nrefs,
+                         struct symbol_list *imports)
+{
+    ElfW(Shdr) *dynsym = get_shdr(elf, SHT_DYNSYM, ".dynsym");
+    ElfW(Shdr) *versym = get_shdr(elf, SHT_GNU_versym, ".gnu.version");
+
+    if (!dynsym || !versym || dynsym->sh_link >= get_shnum(elf) || dynsym->sh_entsize != sizeof(ElfW(Sym))) {
+        return;
+    }
+
+    ElfW(Shdr) *strings = &elf->shdr[dynsym->sh_link];
+    size_t nsyms = dynsym->sh_size / sizeof(ElfW(Sym));
+
+    if (versym->sh_size / sizeof(ElfW(Versym)) < nsyms) {
+        return;
+    }
+
+    ElfW(Sym) *syms = get_offset(elf, dynsym->sh_offset, dynsym->sh_size);
+    ElfW(Versym) *vers = get_offset(elf, versym->sh_offset, versym->sh_size);
+
+    /* most of the symbol names are read, so read the whole table at once */
+    if (!syms || !vers || !get_offset(elf, strings->sh_offset, strings->sh_size)) {
+        return;
+    }
+
+    for (size_t i = 1; i < nsyms; i++) {
+        if (syms[i].st_shndx != SHN_UNDEF || syms[i].st_name == 0) {
+            continue;
+        }
+
+        for (size_t k = 0; k < nrefs; k++) {
+            if (refs[k].index != (vers[i] & 0x7fff)) {
+                continue;
+            }
+
+            const char *name = get_string(elf, strings, syms[i].st_name);
+
+            if (!name) {
+                return;
+            }
+
+            char *item = malloc(strlen(refs[k].name) + strlen(name) + 2);
+            sprintf(item, "%s %s", refs[k].name, name);
+            symbol_list_add(&imports[refs[k].lib], item);
+            break;
+        }
+    }
+}
+
+
+/**
+ * Find the highest versions of the managed libraries required by an ELF file
+ * and, if "imports" is not NULL, the symbols it imports from them.
+ * "required" receives the highest version with the library's prefix,
+ * "others" the highest version of every other version family (like CXXABI_
+ * of libstdc++), see add_version().
+ *
+ * The SHT_GNU_verneed section holds an Elfxx_Verneed array for every needed
+ * library. vn_file is the offset of the library name in the section pointed
+ * to by sh_link, vn_aux is a relative offset to its Elfxx_Vernaux arrays and
+ * vn_next a relative offset to the next Elfxx_Verneed array.
+ *
+ * Each Elfxx_Vernaux array holds the offset of a required version string in
+ * vna_name and a relative offset to the next Elfxx_Vernaux array in vna_next.
+ */
+static void find_requirements(struct elf_file *elf, char **required, char **others, struct symbol_list *imports)
+{
+    struct version_ref *refs = NULL;
+    size_t nrefs = 0;
+
+    ElfW(Shdr) *verneed = get_shdr(elf, SHT_GNU_verneed, ".gnu.version_r");
+
+    if (!verneed || verneed->sh_link >= get_shnum(elf)) {
+        return;
+    }
+
+    ElfW(Shdr) *strings = &elf->shdr[verneed->sh_link];
+
+    /* read the whole section at once */
+    get_offset(elf, verneed->sh_offset, verneed->sh_size);
+
+    ElfW(Off) vn_off = verneed->sh_offset;
+
+    /* sh_info holds the number of entries */
+    for (size_t i = 0; i < verneed->sh_info && elf->error == CHECKRT_OK; i++) {
+        ElfW(Verneed) *vn = get_offset(elf, vn_off, sizeof(ElfW(Verneed)));
+        const char *file = vn ? get_string(elf, strings, vn->vn_file) : NULL;
+
+        if (!file) {
+            break;
+        }
+
+        for (size_t k = 0; k < RUNTIME_LIBS_NUM; k++) {
+            const struct runtime_lib *lib = &runtime_libs[k];
+
+            if (strcmp(file, lib->soname) != 0) {
+                continue;
+            }
+
+            ElfW(Off) vna_off = vn_off + vn->vn_aux;
+            size_t pfxlen = strlen(lib->prefix);
+
+            for (size_t j = 0; j < vn->vn_cnt; j++) {
+                ElfW(Vernaux) *vna = get_offset(elf, vna_off, sizeof(ElfW(Vernaux)));
+                const char *name = vna ? get_string(elf, strings, vna->vna_name) : NULL;
+
+                if (!name) {
+                    break;
+                }
+
+                if (is_prefixed_and_higher_version(name, required[k], lib->prefix, pfxlen)) {
+                    if (full_debug_mode) {
+                        DEBUG_PRINT(COL_RES " required by " COL_PATH, name, elf->path);
+                    }
+
+                    free(required[k]);
+                    required[k] = strdup(name);
+                } else if (version_family_len(name, strlen(name)) != pfxlen || strncmp(name, lib->prefix, pfxlen) != 0) {
+                    if (full_debug_mode) {
+                        DEBUG_PRINT(COL_RES " required by " COL_PATH, name, elf->path);
+                    }
+
+                    add_version(&others[k], name);
+                }
+
+                /* copied, the string may be gone once more strings were read */
+                if (imports) {
+                    refs = realloc(refs, (nrefs + 1) * sizeof(struct version_ref));
+                    refs[nrefs++] = (struct version_ref) { vna->vna_other, k, strdup(name) };
+                }
+
+                if (vna->vna_next == 0) {
+                    break;
+                }
+
+                vna_off += vna->vna_next;
+            }
+
+            /* sonames are unique, and "file" may be gone by now */
+            break;
+        }
+
+        if (vn->vn_next == 0) {
+            break;
+        }
+
+        vn_off += vn->vn_next;
+    }
+
+    if (nrefs > 0 && elf->error == CHECKRT_OK) {
+        find_imports(elf, refs, nrefs, imports);
+    }
+
+    for (size_t i = 0; i < nrefs; i++) {
+        free(refs[i].name);
+    }
+
+    free(refs);
+}
+
+
+/* get a bit mask of the managed libraries in the DT_NEEDED entries */
+static int find_needed(struct elf_file *elf)
+{
+    int needed = 0;
+    ElfW(Shdr) *dynamic = get_shdr(elf, SHT_DYNAMIC, ".dynamic");
+
+    if (!dynamic || dynamic->sh_entsize != sizeof(ElfW(Dyn)) || dynamic->sh_link >= get_shnum(elf)) {
+        return 0;
+    }
+
+    ElfW(Shdr) *strings = &elf->shdr[dynamic->sh_link];
+    ElfW(Dyn) *dyn = get_offset(elf, dynamic->sh_offset, dynamic->sh_size);
+    size_t ndyn = dyn ? dynamic->sh_size / sizeof(ElfW(Dyn)) : 0;
+    size_t str_min = SIZE_MAX, str_max = 0;
+
+    /* read the range that covers all library names at once */
+    for (size_t i = 0; i < ndyn && dyn[i].d_tag != DT_NULL; i++) {
+        if (dyn[i].d_tag == DT_NEEDED) {
+            str_min = (dyn[i].d_un.d_val < str_min) ? dyn[i].d_un.d_val : str_min;
+            str_max = (dyn[i].d_un.d_val > str_max) ? dyn[i].d_un.d_val : str_max;
+        }
+    }
+
+    get_string_range(elf, strings, str_min, str_max);
+
+    for (size_t i = 0; i < ndyn && dyn[i].d_tag != DT_NULL; i++) {
+        const char *name = (dyn[i].d_tag == DT_NEEDED) ? get_string(elf, strings, dyn[i].d_un.d_val) : NULL;
+
+        for (size_t k = 0; name && k < RUNTIME_LIBS_NUM; k++) {
+            if (strcmp(name, runtime_libs[k].soname) == 0) {
+                needed |= 1 << k;
+            }
+        }
+    }
+
+    return needed;
+}
+
+
+/* files of the AppDir that are scanned for version requirements */
+struct scan_job {
+    char **files;
+    size_t count;
+    size_t next;  /* index of the next file, shared by all threads */
+    pthread_mutex_t lock;
+    char *required[RUNTIME_LIBS_NUM];
+    char *others[RUNTIME_LIBS_NUM];  /* other required versions, see find_requirements() */
+    bool precise;  /* collect imported symbols too */
+    struct symbol_list imports[RUNTIME_LIBS_NUM];
+    int needed;    /* managed libraries linked against, as bit mask */
+};
+
+
+/* recursively collect all regular files */
+static void collect_files(const char *path, struct scan_job *job)
+{
+    struct dirent *e;
+    struct stat st;
+    DIR *dp = opendir(path);
+
+    if (!dp) {
+        return;
+    }
+
+    while ((e = readdir(dp)) != NULL) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) {
+            continue;
+        }
+
+        char *file = malloc(strlen(path) + strlen(e->d_name) + 2);
+        sprintf(file, "%s/%s", path, e->d_name);
+
+        unsigned char type = e->d_type;
+
+        if (type == DT_UNKNOWN && lstat(file, &st) == 0) {
+            type = S_ISDIR(st.st_mode) ? DT_DIR : (S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN);
+        }
+
+        if (type == DT_DIR) {
+            collect_files(file, job);
+        } else if (type == DT_REG) {
+            job->files = realloc(job->files, (job->count + 1) * sizeof(char *));
+            job->files[job->count++] = file;
+            continue;
+        }
+
+        free(file);
+    }
+
+    closedir(dp);
+}
+
+
+/* add every version of the comma separated list "names" to "list" */
+static void merge_versions(char **list, const char *names)
+{
+    for (const char *p = names; p && *p; ) {
+        size_t n = strcspn(p, ",");
+        char *item = strndup(p, n);
+        add_version(list, item);
+        free(item);
+        p += n;
+
+        if (*p) {
+            p++;
+        }
+    }
+}
+
+
+static void *scan_thread(void *arg)
+{
+    struct scan_job *job = arg;
+    char *required[RUNTIME_LIBS_NUM] = {0};
+    char *others[RUNTIME_LIBS_NUM] = {0};
+    struct symbol_list imports[RUNTIME_LIBS_NUM] = {0};
+    struct elf_file elf;
+    int needed = 0;
+    size_t i;
+
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count) {
+        if (elf_open(&elf, job->files[i], false) == CHECKRT_OK) {
+            find_requirements(&elf, required, others, job->precise ? imports : NULL);
+            needed |= find_needed(&elf);
+            elf_close(&elf);
+        }
+    }
+
+    /* merge results */
+    pthread_mutex_lock(&job->lock);
+
+    job->needed |= needed;
+
+    for (size_t k = 0; k < RUNTIME_LIBS_NUM; k++) {
+        for (size_t n = 0; n < imports[k].count; n++) {
+            symbol_list_add(&job->imports[k], imports[k].items[n]);
+        }
+
+        free(imports[k].items);
+    }
+
+    for (size_t k = 0; k < RUNTIME_LIBS_NUM; k++) {
+        if (required[k] && (!job->required[k] || strverscmp(job->required[k], required[k]) < 0)) {
+            free(job->required[k]);
+            job->required[k] = required[k];
+        } else {
+            free(required[k]);
+        }
+
+        merge_versions(&job->others[k], others[k]);
+        free(others[k]);
+    }
+
+    pthread_mutex_unlock(&job->lock);
+
+    return NULL;
+}
+
+
+/* run "func" on one thread per processor (at most 16 and not more than
+ * "count") and on the calling thread; the threads take work items from
+ * a shared index until all are done */
+static void run_threads(void *(*func)(void *), void *arg, size_t count)
+{
+    pthread_t threads[16];
+    size_t nthreads = 0;
+
+    long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max = (nproc < 1) ? 1 : (size_t)nproc;
+    max = (max > 16) ? 16 : max;
+    max = (max > count) ? count : max;
+
+    for ( ; nthreads < max; nthreads++) {
+        if (pthread_create(&threads[nthreads], NULL, func, arg) != 0) {
+            break;
+        }
+    }
+
+    func(arg);
+
+    for (size_t i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+
+static int compare_strings(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+/* write the sorted and deduplicated symbols imported from
+ * each managed library, or remove the file if "imports" is NULL */
+static void write_symbols(const char *dir, struct symbol_list *imports)
+{
+    char *path = malloc(strlen(dir) + sizeof(SYMBOLS_FILE) + 1);
+    sprintf(path, "%s/" SYMBOLS_FILE, dir);
+
+    if (!imports) {
+        unlink(path);
+        free(path);
+        return;
+    }
+
+    FILE *f = fopen(path, "w");
+
+    if (!f) {
+        err(1, "cannot open file for writing: %s", path);
+    }
+
+    fprintf(f, "%s\n", SYMBOLS_MAGIC);
+
+    for (size_t k = 0; k < RUNTIME_LIBS_NUM; k++) {
+        struct symbol_list *list = &imports[k];
+        size_t count = 0;
+
+        if (list->count == 0) {
+            continue;
+        }
+
+        qsort(list->items, list->count, sizeof(char *), compare_strings);
+        fprintf(f, "@%s/%s\n", runtime_libs[k].subdir, runtime_libs[k].soname);
+
+        for (size_t n = 0; n < list->count; n++) {
+            if (n == 0 || strcmp(list->items[n], list->items[n - 1]) != 0) {
+                fprintf(f, "%s\n", list->items[n]);
+                count++;
+            }
+        }
+
+        printf("Symbols imported from %s: %zu\n", runtime_libs[k].soname, count);
+    }
+
+    if (fclose(f) != 0) {
+        err(1, "error writing to file: %s", path);
+    }
+
+    free(path);
+}
+
+
+/* scan all ELF files of the AppDir in parallel and save the highest
+ * required version of each managed library to "required" and the other
+ * required versions to "others" (see find_requirements()); if "precise"
+ * is true the imported symbols are written to the symbols file.
+ * Optional libraries are only copied (see copy_lib()) once a scanned file
+ * links against them, and are then scanned too. */
+static void scan_requirements(const char *dir, char **required, char **others, bool precise, bool strip)
+{
+    struct scan_job job = { .lock = PTHREAD_MUTEX_INITIALIZER, .precise = precise };
+    int copied = 0;
+
+    /* the AppDir is the parent directory; the bundled libraries are
+     * scanned too because they may depend on each other */
+    char *appdir = strdup(dir);
+    collect_files(dirname(appdir), &job);
+
+    for (size_t start = 0; start < job.count; ) {
+        job.next = start;
+        run_threads(scan_thread, &job, job.count - start);
+        start = job.count;
+
+        for (size_t k = 0; k < RUNTIME_LIBS_NUM; k++) {
+            if (!runtime_libs[k].optional || !(job.needed & (1 << k)) || (copied & (1 << k))) {
+                continue;
+            }
+
+            uint64_t t = trace_begin();
+            char *path = copy_lib(dir, &runtime_libs[k], strip);
+            trace_event(t, "copy", "lib", runtime_libs[k].soname, NULL);
+            copied |= 1 << k;
+
+            if (path) {
+                job.files = realloc(job.files, (job.count + 1) * sizeof(char *));
+                job.files[job.count++] = path;
+            }
+        }
+    }
+
+    for (size_t k = 0; k < RUNTIME_LIBS_NUM; k++) {
+        required[k] = job.required[k];
+        others[k] = job.others[k];
+
+        if (required[k]) {
+            printf("Required version of %s: %s\n", runtime_libs[k].soname, required[k]);
+        }
+
+        if (others[k]) {
+            printf("Other required versions of %s: %s\n", runtime_libs[k].soname, others[k]);
+        }
+    }
+
+    write_symbols(dir, precise ? job.imports : NULL);
+
+    for (size_t k = 0; k < RUNTIME_LIBS_NUM; k++) {
+        symbol_list_free(&job.imports[k]);
+    }
+
+    for (size_t i = 0; i < job.count; i++) {
+        free(job.files[i]);
+    }
+
+    free(job.files);
+    free(appdir);
+}
+#endif /* !CHECKRT_LIBRARY */
+
+
+/* state of a single library comparison */
+struct lib_check {
+    const struct runtime_lib *lib;
+    char *lib_bundle;
+    char *lib_sys;
+    char *sym_bundle;    /* taken from the manifest if has_manifest is true */
+    char *required;      /* highest version required by the AppDir, from the manifest */
+    char *others;        /* other versions required by the AppDir, see find_requirements() */
+    struct symbol_list imports;  /* symbols imported by the AppDir, from the symbols file */
+    bool has_manifest;
+    int use_bundled;     /* result of use_bundled_library() */
+    const char *error_path;  /* library that caused an error */
+};
+
+
+/* GNU hash function of the .gnu.hash section */
+static uint32_t gnu_hash(const char *name)
+{
+    uint32_t h = 5381;
+
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        h = (h << 5) + h + *p;
+    }
+
+    return h;
+}
+
+
+/**
+ * Look up every "VERSION name" entry of "list" in the dynamic symbol table
+ * of a library. Returns 1 if all symbols are defined with these versions,
+ * 0 if one is missing and -1 if the library has no usable hash table.
+ *
+ * The SHT_GNU_HASH section starts with the number of buckets, the index of
+ * the first hashed symbol, the number of bloom filter words and the bloom
+ * filter shift, followed by the bloom filter words, the buckets and the
+ * hash chain. Each bucket holds the index of the first symbol with that
+ * hash modulo the number of buckets; a chain entry holds the hash of its
+ * symbol with the lowest bit marking the end of the chain.
+ */
+static int provides_symbols(const char *path, const struct symbol_list *list)
+{
+    struct elf_file elf;
+    const size_t bits = sizeof(ElfW(Addr)) * 8;
+    int rv = -1;
+
+    uint64_t start = trace_begin();
+
+    if (elf_open(&elf, path, true) != CHECKRT_OK) {
+        return -1;
+    }
+
+    ElfW(Shdr) *hash = get_shdr(&elf, SHT_GNU_HASH, ".gnu.hash");
+    ElfW(Shdr) *dynsym = get_shdr(&elf, SHT_DYNSYM, ".dynsym");
+    ElfW(Shdr) *versym = get_shdr(&elf, SHT_GNU_versym, ".gnu.version");
+    ElfW(Shdr) *verdef = get_shdr(&elf, SHT_GNU_verdef, ".gnu.version_d");
+    ElfW(Shdr) *dynamic = get_shdr(&elf, SHT_DYNAMIC, ".dynamic");
+    size_t verdefnum = dynamic ? get_dyn_val(&elf, dynamic, DT_VERDEFNUM) : 0;
+
+    if (!hash || !dynsym || !versym || !verdef || verdefnum == 0 || hash->sh_size < 16 ||
+        dynsym->sh_link >= get_shnum(&elf) || verdef->sh_link >= get_shnum(&elf) ||
+        dynsym->sh_entsize != sizeof(ElfW(Sym)))
+    {
+        elf_close(&elf);
+        return -1;
+    }
+
+    size_t nsyms = dynsym->sh_size / sizeof(ElfW(Sym));
+    ElfW(Shdr) *strings = &elf.shdr[dynsym->sh_link];
+
+    /* read the tables at once */
+    uint32_t *header = get_offset(&elf, hash->sh_offset, hash->sh_size);
+    ElfW(Sym) *syms = get_offset(&elf, dynsym->sh_offset, dynsym->sh_size);
+    ElfW(Versym) *vers = get_offset(&elf, versym->sh_offset, versym->sh_size);
+
+    if (!header || !syms || !vers || !get_offset(&elf, strings->sh_offset, strings->sh_size)) {
+        elf_close(&elf);
+        return -1;
+    }
+
+    uint32_t nbuckets = header[0], symoffset = header[1], bloom_size = header[2], bloom_shift = header[3];
+    size_t words = (hash->sh_size - 16) / 4;
+
+    if (nbuckets == 0 || bloom_size == 0 || (size_t)bloom_size * (bits / 32) + nbuckets > words ||
+        versym->sh_size / sizeof(ElfW(Versym)) < nsyms)
+    {
+        elf_close(&elf);
+        return -1;
+    }
+
+    ElfW(Addr) *bloom = (ElfW(Addr) *)(header + 4);
+    uint32_t *buckets = (uint32_t *)(bloom + bloom_size);
+    uint32_t *chain = buckets + nbuckets;
+    size_t chain_len = words - (size_t)bloom_size * (bits / 32) - nbuckets;
+
+    /* version names by version index */
+    const char **version_names = calloc(verdefnum + 2, sizeof(char *));
+    ElfW(Off) vd_off = verdef->sh_offset;
+    get_offset(&elf, verdef->sh_offset, verdef->sh_size);
+
+    for (size_t i = 0; i < verdefnum && elf.error == CHECKRT_OK; i++) {
+        ElfW(Verdef) *vd = get_offset(&elf, vd_off, sizeof(ElfW(Verdef)));
+
+        if (!vd) {
+            break;
+        }
+
+        if (vd->vd_ndx < verdefnum + 2 && vd->vd_aux >= sizeof(ElfW(Verdef))) {
+            ElfW(Verdaux) *vda = get_offset(&elf, vd_off + vd->vd_aux, sizeof(ElfW(Verdaux)));
+            version_names[vd->vd_ndx] = vda ? get_string(&elf, &elf.shdr[verdef->sh_link], vda->vda_name) : NULL;
+        }
+
+        vd_off += vd->vd_next;
+    }
+
+    rv = (elf.error == CHECKRT_OK) ? 1 : -1;
+
+    for (size_t n = 0; n < list->count && rv == 1; n++) {
+        const char *version = list->items[n];
+        const char *name = strchr(version, ' ') + 1;
+        size_t verlen = name - version - 1;
+        uint32_t h = gnu_hash(name);
+        bool found = false;
+
+        ElfW(Addr) word = bloom[(h / bits) % bloom_size];
+        ElfW(Addr) mask = ((ElfW(Addr))1 << (h % bits)) | ((ElfW(Addr))1 << ((h >> bloom_shift) % bits));
+
+        if ((word & mask) == mask) {
+            for (size_t i = buckets[h % nbuckets]; i >= symoffset && i < nsyms && i - symoffset < chain_len; i++) {
+                uint32_t h2 = chain[i - symoffset];
+
+                const char *sym_name = ((h | 1) == (h2 | 1) && syms[i].st_shndx != SHN_UNDEF) ?
+                    get_string(&elf, strings, syms[i].st_name) : NULL;
+
+                if (sym_name && strcmp(sym_name, name) == 0) {
+                    const char *defined = ((vers[i] & 0x7fff) < verdefnum + 2) ? version_names[vers[i] & 0x7fff] : NULL;
+
+                    if (defined && strlen(defined) == verlen && strncmp(defined, version, verlen) == 0) {
+                        found = true;
+                        break;
+                    }
+                }
+
+                if (h2 & 1) {
+                    break;
+                }
+            }
+        }
+
+        if (elf.error != CHECKRT_OK) {
+            rv = -1;
+        } else if (!found) {
+            DEBUG_PRINT("symbol " COL_RES " not found in " COL_PATH, list->items[n], path);
+            rv = 0;
+        }
+    }
+
+    free(version_names);
+    elf_close(&elf);
+
+    trace_event(start, "provides_symbols", "path", path, "result", (rv < 0) ? "error" : (rv ? "all" : "missing"), NULL);
+
+    return rv;
+}
+
+
+/* Decide between the bundled and the system library: the system library
+ * is kept if it provides the versions the AppDir's binaries require, the
+ * bundled one is used if it's newer or if there is no system library.
+ * "others" are the required versions of other families and "defined" the
+ * versions of the system library (see find_symbol()); if only the latter
+ * is unknown, the versions alone can't keep the system library. */
+static bool prefer_bundled(const char *sym_bundle, const char *lib_sys, const char *sym_sys, const char *required,
+                           const char *others, const char *defined)
+{
+    if (!lib_sys) {
+        return true;
+    }
+
+    if (others && defined && !provides_versions(defined, others)) {
+        return true;
+    }
+
+    if (required && sym_sys && strverscmp(sym_sys, required) >= 0 && (!others || defined)) {
+        DEBUG_PRINT("system library provides required version " COL_RES, required);
+        return false;
+    }
+
+    return (sym_bundle && sym_sys && strverscmp(sym_bundle, sym_sys) > 0);
+}
+
+
+/* compare symbol versions; returns 1 if we should use the bundled
+ * library, 0 for the system library or an error code */
+static int use_bundled_library(struct lib_check *check)
+{
+    const struct runtime_lib *lib = check->lib;
+    uint64_t start = trace_begin();
+    int rv = CHECKRT_OK;
+
+    /* get symbols */
+    char *sym_bundle = check->sym_bundle;
+    char *lib_sys = get_system_library_path(lib->soname, true);
+    char *sym_sys = NULL;
+    char *def_sys = NULL;
+
+    if (!check->has_manifest) {
+        rv = symbol_version(check->lib_bundle, lib->prefix, "bundled", &sym_bundle, NULL);
+    }
+
+    /* with the list of imported symbols the system library
+     * is kept exactly if it provides all of them */
+    int provided = (rv == CHECKRT_OK && lib_sys && check->imports.count > 0) ?
+        provides_symbols(lib_sys, &check->imports) : -1;
+
+    if (rv != CHECKRT_OK) {
+        DEBUG_PRINT("cannot read bundled library: " COL_PATH, check->lib_bundle);
+        check->error_path = check->lib_bundle;
+    } else if (provided >= 0) {
+        DEBUG_PRINT("system library provides %s imported symbols", provided ? "all" : "not all");
+        rv = !provided;
+    } else if (lib_sys && (rv = symbol_version(lib_sys, lib->prefix, "system", &sym_sys, &def_sys)) != CHECKRT_OK) {
+        DEBUG_PRINT("cannot read system library: " COL_PATH, lib_sys);
+        check->error_path = lib_sys;
+    } else {
+        rv = prefer_bundled(sym_bundle, lib_sys, sym_sys, check->required, check->others, def_sys);
+    }
+
+    if (rv >= 0) {
+        DEBUG_PRINT("use " COL_SYS " " COL_LIB " library", rv ? "BUNDLED" : "SYSTEM", lib->soname);
+    }
+
+    trace_event(start, "decision", "lib", lib->soname, "bundled", sym_bundle, "system", sym_sys,
+                "required", check->required, "others", check->others, "system_path", lib_sys, "method", (provided >= 0) ? "symbols" : "versions",
+                "use", (rv < 0) ? checkrt_strerror(rv) : (rv ? "bundled" : "system"), NULL);
+
+    check->lib_sys = lib_sys;
+    check->sym_bundle = sym_bundle;
+    free(sym_sys);
+    free(def_sys);
+
+    return rv;
+}
+
+
+#ifndef CHECKRT_LIBRARY
+/* get full dirname of executable */
+static char *get_exe_dir()
+{
+    uint64_t start = trace_begin();
+    char *self = realpath("/proc/self/exe", NULL);
 
     if (!self) {
         err(1, "%s", "realpath() failed to resolve /proc/self/exe");
     }
 
-    /* dirname() modifies and returns "self" */
-    char *pdirname = dirname(self);
+    /* dirname() modifies and returns "self" */
+    char *pdirname = dirname(self);
+
+    if (pdirname != self || pdirname[0] != '/') {
+        errx(1, "dirname() returned an unexpected result: %s", pdirname);
+    }
+
+    DEBUG_PRINT("exe directory found at: " COL_PATH, self);
+    trace_event(start, "exe_dir", "path", self, NULL);
+
+    return self;
+}
+#endif /* !CHECKRT_LIBRARY */
+
+
+/* FNV-1a hash */
+static uint64_t hash_str(uint64_t h, const char *str)
+{
+    for ( ; *str; str++) {
+        h = (h ^ (uint8_t)*str) * 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+
+/* get path of the cache file for this AppImage or AppDir;
+ * returns NULL if caching is disabled or no cache directory was found */
+static char *get_cache_path(const char *dir)
+{
+    const char *env = getenv("CHECKRT_NOCACHE");
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char *path = NULL;
+
+    if (env && *env) {
+        return NULL;
+    }
+
+    /* the mountpoint of an AppImage changes with every launch,
+     * so use the path to the AppImage file if we have it */
+    const char *id = getenv("APPIMAGE");
+
+    if (!id || *id != '/') {
+        id = dir;
+    }
+
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", (unsigned long long)hash_str(0xcbf29ce484222325ULL, id));
+
+    if (base && *base == '/') {
+        path = malloc(strlen(base) + sizeof(CACHE_SUBDIR) + sizeof(key) + 2);
+        mkdir(base, 0700);
+        sprintf(path, "%s/" CACHE_SUBDIR, base);
+    } else if (home && *home == '/') {
+        path = malloc(strlen(home) + sizeof("/.cache/" CACHE_SUBDIR) + sizeof(key) + 1);
+        sprintf(path, "%s/.cache", home);
+        mkdir(path, 0700);
+        strcat(path, "/" CACHE_SUBDIR);
+    } else {
+        return NULL;
+    }
+
+    if (mkdir(path, 0700) == -1 && errno != EEXIST) {
+        DEBUG_PRINT("cannot create cache directory: " COL_PATH, path);
+        free(path);
+        return NULL;
+    }
+
+    strcat(path, "/");
+    strcat(path, key);
+
+    return path;
+}
+
+
+/* create a fingerprint string from the file's metadata; device and inode
+ * are skipped for bundled files because they change with every mount */
+static void fingerprint(char *buf, size_t bufsize, char type, const char *path)
+{
+    struct stat st;
+
+    if (stat(path, &st) == -1) {
+        snprintf(buf, bufsize, "%c -", type);
+    } else if (type == 'S') {
+        snprintf(buf, bufsize, "%c %ju %ju %jd %jd %ld", type,
+            (uintmax_t)st.st_dev, (uintmax_t)st.st_ino, (intmax_t)st.st_size,
+            (intmax_t)st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+    } else {
+        snprintf(buf, bufsize, "%c %jd %jd %ld", type, (intmax_t)st.st_size,
+            (intmax_t)st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+    }
+}
+
+
+/* key over everything else that can change how libraries are resolved */
+static uint64_t get_cache_key(const char *env)
+{
+    char buf[128];
+
+    fingerprint(buf, sizeof(buf), 'S', LDSO_CACHE);
+
+    uint64_t h = hash_str(0xcbf29ce484222325ULL, CACHE_MAGIC);
+    h = hash_str(h, buf);
+    h = hash_str(h, env ? env : "");
+
+    return h;
+}
+
+
+/* read result from cache and the paths of the system libraries it was made
+ * with into "system"; returns -1 if the cache is missing or stale */
+static int read_cache(const char *cache, const char *dir, char **system, size_t n)
+{
+    char line[4096], fp[128];
+    unsigned long long key = 0;
+    size_t count = 0;
+    int res = -1;
+
+    FILE *f = fopen(cache, "r");
+
+    if (!f) {
+        return -1;
+    }
+
+    if (!fgets(line, sizeof(line), f) || strcmp(line, CACHE_MAGIC "\n") != 0 ||
+        !fgets(line, sizeof(line), f) || sscanf(line, "K %llx", &key) != 1 ||
+        key != get_cache_key(getenv("LD_LIBRARY_PATH")))
+    {
+        DEBUG_PRINT("cache is outdated: " COL_PATH, cache);
+        fclose(f);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        char *tab = strchr(line, '\t');
+        char *nl = strchr(line, '\n');
+
+        if (sscanf(line, "R %d", &res) == 1) {
+            break;
+        } else if (!tab || !nl || (line[0] != 'S' && line[0] != 'B')) {
+            break;
+        }
+
+        *tab++ = 0;
+        *nl = 0;
+
+        /* bundled files are stored relative to the exe directory;
+         * the system library follows the bundled one */
+        if (line[0] == 'B') {
+            char *path = malloc(strlen(dir) + strlen(tab) + 2);
+            sprintf(path, "%s/%s", dir, tab);
+            fingerprint(fp, sizeof(fp), line[0], path);
+            free(path);
+            count++;
+        } else {
+            fingerprint(fp, sizeof(fp), line[0], tab);
+
+            if (count > 0 && count <= n) {
+                free(system[count - 1]);
+                system[count - 1] = strdup(tab);
+            }
+        }
+
+        if (strcmp(fp, line) != 0) {
+            DEBUG_PRINT("file has changed: " COL_PATH, tab);
+            break;
+        }
+    }
+
+    fclose(f);
+
+    if (res < 0) {
+        for (size_t i = 0; i < n; i++) {
+            free(system[i]);
+            system[i] = NULL;
+        }
+
+        return -1;
+    }
+
+    DEBUG_PRINT("using cached result from: " COL_PATH, cache);
+
+    return res;
+}
+
+
+/* save result to cache; failures are not fatal */
+static void write_cache(const char *cache, const char *dir, int res, const char **bundled, char **system, size_t n)
+{
+    char fp[128];
+
+    /* unique temporary file, other threads may write the same cache */
+    char *tmp = malloc(strlen(cache) + sizeof(".XXXXXX"));
+    sprintf(tmp, "%s.XXXXXX", cache);
+
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    FILE *f = (fd == -1) ? NULL : fdopen(fd, "w");
+
+    if (!f) {
+        DEBUG_PRINT("cannot write cache file: " COL_PATH, tmp);
+
+        if (fd != -1) {
+            close(fd);
+            unlink(tmp);
+        }
+
+        free(tmp);
+        return;
+    }
+
+    fprintf(f, CACHE_MAGIC "\nK %016llx\n", (unsigned long long)get_cache_key(getenv("LD_LIBRARY_PATH")));
+
+    for (size_t i = 0; i < n; i++) {
+        char *path = malloc(strlen(dir) + strlen(bundled[i]) + 2);
+        sprintf(path, "%s/%s", dir, bundled[i]);
+        fingerprint(fp, sizeof(fp), 'B', path);
+        fprintf(f, "%s\t%s\n", fp, bundled[i]);
+        free(path);
+
+        if (system[i]) {
+            fingerprint(fp, sizeof(fp), 'S', system[i]);
+            fprintf(f, "%s\t%s\n", fp, system[i]);
+        }
+    }
+
+    fprintf(f, "R %d\n", res);
+
+    /* replace the old file atomically */
+    if (fclose(f) != 0 || rename(tmp, cache) == -1) {
+        DEBUG_PRINT("cannot write cache file: " COL_PATH, cache);
+        unlink(tmp);
+    }
+
+    free(tmp);
+}
+
+
+/* get colon separated list of library directories in load order,
+ * or NULL if no bundled library should be used */
+static char *get_library_dirs(const char *dir, int res)
+{
+    char *list = NULL;
+    size_t len = 0;
+
+    for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+        if (res & (1 << i)) {
+            list = realloc(list, len + strlen(dir) + strlen(runtime_libs[i].subdir) + 3);
+            len += sprintf(list + len, "%s%s/%s", len ? ":" : "", dir, runtime_libs[i].subdir);
+        }
+    }
+
+    return list;
+}
+
+
+/* get colon separated list of the bundled libraries to preload,
+ * or NULL if no bundled library should be used */
+static char *get_library_paths(const char *dir, int res)
+{
+    char *list = NULL;
+    size_t len = 0;
+
+    for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+        if (res & (1 << i)) {
+            const struct runtime_lib *lib = &runtime_libs[i];
+            list = realloc(list, len + strlen(dir) + strlen(lib->subdir) + strlen(lib->soname) + 4);
+            len += sprintf(list + len, "%s%s/%s/%s", len ? ":" : "", dir, lib->subdir, lib->soname);
+        }
+    }
+
+    return list;
+}
+
+
+/* hash over the result and everything it depends on, like the cache file;
+ * LD_LIBRARY_PATH is taken without the directories added for the result */
+static uint64_t token_hash(const char *dir, int res, const char **bundled, char **system, size_t n)
+{
+    char buf[128];
+    char *dirs = get_library_dirs(dir, res);
+    const char *env = getenv("LD_LIBRARY_PATH");
+    size_t len = dirs ? strlen(dirs) : 0;
+
+    if (env && len > 0 && strncmp(env, dirs, len) == 0 && (env[len] == ':' || env[len] == 0)) {
+        env += (env[len] == ':') ? len + 1 : len;
+    }
+
+    snprintf(buf, sizeof(buf), "%d %016llx\t", res, (unsigned long long)get_cache_key(env));
+
+    uint64_t h = hash_str(0xcbf29ce484222325ULL, TOKEN_MAGIC);
+    h = hash_str(h, buf);
+    h = hash_str(hash_str(h, dir), "\t");
+
+    for (size_t i = 0; i < n; i++) {
+        char *path = malloc(strlen(dir) + strlen(bundled[i]) + 2);
+        sprintf(path, "%s/%s", dir, bundled[i]);
+        fingerprint(buf, sizeof(buf), 'B', path);
+        h = hash_str(hash_str(h, buf), "\t");
+        free(path);
+
+        if (system[i]) {
+            fingerprint(buf, sizeof(buf), 'S', system[i]);
+            h = hash_str(hash_str(h, buf), "\t");
+            h = hash_str(hash_str(h, system[i]), "\t");
+        }
+    }
+
+    free(dirs);
+
+    return h;
+}
+
+
+/* create a token with the result, its hash and the system library paths;
+ * the format is "<result>:<hash>:<path>:<path>..." with one path or an
+ * empty string per fingerprinted file */
+static char *make_token(const char *dir, int res, const char **bundled, char **system, size_t n)
+{
+    size_t len = 32;
+
+    for (size_t i = 0; i < n; i++) {
+        len += (system[i] ? strlen(system[i]) : 0) + 1;
+    }
+
+    char *token = malloc(len);
+    char *p = token + sprintf(token, "%d:%016llx", res,
+        (unsigned long long)token_hash(dir, res, bundled, system, n));
+
+    for (size_t i = 0; i < n; i++) {
+        p += sprintf(p, ":%s", system[i] ? system[i] : "");
+    }
+
+    return token;
+}
+
+
+/**
+ * Take the result from a token in the environment, which was set by checkrt
+ * for a parent process started from the same AppDir. It's only accepted if
+ * the hash over the result, the bundled files, the system libraries and the
+ * library search path still matches, so an outdated or modified token is
+ * ignored. Only stat() is needed for this, no library is opened.
+ * Returns the result or -1.
+ */
+static int read_token(const char *dir, const char **bundled, char **system, size_t n)
+{
+    const char *token = getenv(TOKEN_ENV);
+    unsigned long long hash;
+    int res, pos = 0;
+
+    if (!token || !*token) {
+        return -1;
+    }
+
+    if (sscanf(token, "%d:%16llx%n", &res, &hash, &pos) != 2 || res < 0 || pos == 0) {
+        DEBUG_PRINT("invalid token: %s", token);
+        return -1;
+    }
+
+    const char *p = token + pos;
+
+    for (size_t i = 0; i < n && *p == ':'; i++) {
+        size_t len = strcspn(++p, ":");
+        system[i] = (len > 0) ? strndup(p, len) : NULL;
+        p += len;
+    }
+
+    if (*p != 0 || token_hash(dir, res, bundled, system, n) != hash) {
+        DEBUG_PRINT("token is outdated: %s", token);
+
+        for (size_t i = 0; i < n; i++) {
+            free(system[i]);
+            system[i] = NULL;
+        }
+
+        return -1;
+    }
+
+    DEBUG_PRINT("using result from %s", TOKEN_ENV);
+
+    return res;
+}
+
+
+#ifndef CHECKRT_LIBRARY
+/* write a manifest with the versions of the bundled libraries and the highest
+ * versions required by the AppDir; lines have the format
+ * "<version> <required version> <other required versions> <size>\t<path>" */
+static void write_manifest(const char *dir, char **required, char **others)
+{
+    struct stat st;
+
+    char *manifest = malloc(strlen(dir) + sizeof(MANIFEST_FILE) + 1);
+    sprintf(manifest, "%s/" MANIFEST_FILE, dir);
+
+    FILE *f = fopen(manifest, "w");
+
+    if (!f) {
+        err(1, "cannot open file for writing: %s", manifest);
+    }
+
+    fprintf(f, "%s\n", MANIFEST_MAGIC);
+
+    for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+        const struct runtime_lib *lib = &runtime_libs[i];
+        char *path = malloc(strlen(dir) + strlen(lib->subdir) + strlen(lib->soname) + 3);
+        sprintf(path, "%s/%s/%s", dir, lib->subdir, lib->soname);
+
+        if (stat(path, &st) == 0) {
+            char *symbol;
+            int rv = symbol_version(path, lib->prefix, "bundled", &symbol, NULL);
+
+            if (rv != CHECKRT_OK) {
+                errx(1, "%s: %s", path, checkrt_strerror(rv));
+            }
+
+            fprintf(f, "%s %s %s %jd\t%s/%s\n", symbol ? symbol : "-", required[i] ? required[i] : "-",
+                others[i] ? others[i] : "-", (intmax_t)st.st_size, lib->subdir, lib->soname);
+            free(symbol);
+        }
+
+        free(path);
+    }
+
+    if (fclose(f) != 0) {
+        err(1, "error writing to file: %s", manifest);
+    }
+
+    free(manifest);
+}
+
+
+/* create or remove the file that selects the preload mode */
+static void write_preload_file(const char *dir, bool preload)
+{
+    char *path = malloc(strlen(dir) + sizeof(PRELOAD_FILE) + 1);
+    sprintf(path, "%s/" PRELOAD_FILE, dir);
+
+    if (!preload) {
+        unlink(path);
+        free(path);
+        return;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd == -1 || close(fd) == -1) {
+        err(1, "cannot create file: %s", path);
+    }
+
+    puts("Bundled libraries will be preloaded");
+    free(path);
+}
+
+
+/* whether the bundled libraries should be preloaded */
+static bool use_preload(const char *dir)
+{
+    char *path = malloc(strlen(dir) + sizeof(PRELOAD_FILE) + 1);
+    sprintf(path, "%s/" PRELOAD_FILE, dir);
+
+    bool rv = (access(path, F_OK) == 0);
+    free(path);
+
+    return rv;
+}
+#endif /* !CHECKRT_LIBRARY */
+
+
+/* take the versions of the bundled libraries from the manifest if their size
+ * hasn't changed; the modification time and inode number aren't used because
+ * they change when the AppDir is packed into squashfs, and a checksum would
+ * read the whole library, which takes longer than parsing it */
+static void read_manifest(const char *dir, struct lib_check *checks)
+{
+    struct stat st;
+    char line[4096], version[256], required[256], others[2048];
+    intmax_t size;
+
+    char *manifest = malloc(strlen(dir) + sizeof(MANIFEST_FILE) + 1);
+    sprintf(manifest, "%s/" MANIFEST_FILE, dir);
+
+    FILE *f = fopen(manifest, "r");
+
+    if (!f || !fgets(line, sizeof(line), f) || strcmp(line, MANIFEST_MAGIC "\n") != 0) {
+        DEBUG_PRINT("no manifest found: " COL_PATH, manifest);
+
+        if (f) {
+            fclose(f);
+        }
+
+        free(manifest);
+        return;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        char *tab = strchr(line, '\t');
+        char *nl = strchr(line, '\n');
+
+        if (!tab || !nl || sscanf(line, "%255s %255s %2047s %jd", version, required, others, &size) != 4) {
+            break;
+        }
+
+        *tab++ = 0;
+        *nl = 0;
+
+        for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+            struct lib_check *check = &checks[i];
+
+            if (strcmp(check->lib_bundle + strlen(dir) + 1, tab) != 0) {
+                continue;
+            }
+
+            if (stat(check->lib_bundle, &st) == -1 || st.st_size != size) {
+                DEBUG_PRINT("manifest entry is outdated: " COL_PATH, tab);
+            } else {
+                DEBUG_PRINT("version of " COL_LIB " from manifest: " COL_RES, tab, version);
+                check->sym_bundle = (strcmp(version, "-") == 0) ? NULL : strdup(version);
+                check->required = (strcmp(required, "-") == 0) ? NULL : strdup(required);
+                check->others = (strcmp(others, "-") == 0) ? NULL : strdup(others);
+                check->has_manifest = true;
+            }
+
+            break;
+        }
+    }
+
+    fclose(f);
+    free(manifest);
+}
+
+
+/* read the symbols imported from each managed library, see write_symbols() */
+static void read_symbols(const char *dir, struct lib_check *checks)
+{
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    struct lib_check *check = NULL;
+
+    char *path = malloc(strlen(dir) + sizeof(SYMBOLS_FILE) + 1);
+    sprintf(path, "%s/" SYMBOLS_FILE, dir);
+
+    FILE *f = fopen(path, "r");
+
+    if (!f || getline(&line, &size, f) == -1 || strcmp(line, SYMBOLS_MAGIC "\n") != 0) {
+        if (f) {
+            DEBUG_PRINT("invalid symbols file: " COL_PATH, path);
+            fclose(f);
+        }
+
+        free(line);
+        free(path);
+        return;
+    }
+
+    /* lines can be of any length, symbol names aren't limited */
+    while ((len = getline(&line, &size, f)) != -1) {
+        if (line[len - 1] == '\n') {
+            line[len - 1] = 0;
+        }
+
+        if (line[0] == '@') {
+            check = NULL;
+
+            for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+                if (strcmp(checks[i].lib_bundle + strlen(dir) + 1, line + 1) == 0) {
+                    check = &checks[i];
+                    break;
+                }
+            }
+        } else if (check && strchr(line, ' ')) {
+            symbol_list_add(&check->imports, strdup(line));
+        }
+    }
+
+    for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+        if (checks[i].imports.count > 0) {
+            DEBUG_PRINT("%zu symbols imported from " COL_LIB, checks[i].imports.count, checks[i].lib->soname);
+        }
+    }
 
-    if (pdirname != self || pdirname[0] != '/') {
-        errx(1, "dirname() returned an unexpected result: %s", pdirname);
+    fclose(f);
+    free(line);
+    free(path);
+}
+
+
+static void *check_library_thread(void *arg)
+{
+    struct lib_check *check = arg;
+    check->use_bundled = use_bundled_library(check);
+    return NULL;
+}
+
+
+/* compare symbol versions of bundled and system libraries; returns a bitmask
+ * of the runtime_libs[] entries to use from the bundle or an error code;
+ * if "token" is not NULL it's set to a token for child processes, and if
+ * "error_path" is not NULL it's set to the library that caused an error */
+static int compare_library_symbols(const char *dir, char **token, char **error_path)
+{
+    char *cache = NULL;
+
+    struct lib_check checks[RUNTIME_LIBS_NUM] = {0};
+    pthread_t threads[RUNTIME_LIBS_NUM];
+    bool started[RUNTIME_LIBS_NUM] = {0};
+
+    /* the checkrt binary, the manifest and the symbols file are part of the fingerprint */
+    const char *bundled[RUNTIME_LIBS_NUM + 3] = { "checkrt", MANIFEST_FILE, SYMBOLS_FILE };
+    char *system[RUNTIME_LIBS_NUM + 3] = { NULL };
+
+    for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+        const struct runtime_lib *lib = &runtime_libs[i];
+
+        checks[i].lib = lib;
+        checks[i].lib_bundle = malloc(strlen(dir) + strlen(lib->subdir) + strlen(lib->soname) + 3);
+        sprintf(checks[i].lib_bundle, "%s/%s/%s", dir, lib->subdir, lib->soname);
+        bundled[i + 3] = checks[i].lib_bundle + strlen(dir) + 1;
     }
 
-    DEBUG_PRINT("exe directory found at: " COL_PATH, self);
+    const size_t n = RUNTIME_LIBS_NUM + 3;
+    uint64_t start = trace_begin();
+    int res = read_token(dir, bundled, system, n);
+    bool from_token = (res >= 0);
 
-    return self;
+    trace_event(start, "token", "result", from_token ? "hit" : "miss", NULL);
+
+    if (!from_token && (cache = get_cache_path(dir)) != NULL) {
+        start = trace_begin();
+        res = read_cache(cache, dir, system, n);
+        trace_event(start, "cache_read", "path", cache, "result", res < 0 ? "miss" : "hit", NULL);
+    }
+
+    if (res < 0) {
+        struct lib_check *first = NULL;
+        res = 0;
+
+        start = trace_begin();
+        read_manifest(dir, checks);
+        read_symbols(dir, checks);
+        trace_event(start, "manifest_read", "path", dir, NULL);
+
+        /* check the libraries concurrently; the first one is checked
+         * on the main thread while the others are running */
+        for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+            if (access(checks[i].lib_bundle, F_OK) != 0) {
+                if (!runtime_libs[i].optional) {
+                    DEBUG_PRINT("no access or file does not exist: " COL_PATH, checks[i].lib_bundle);
+                }
+            } else if (!first) {
+                first = &checks[i];
+            } else if (pthread_create(&threads[i], NULL, check_library_thread, &checks[i]) == 0) {
+                started[i] = true;
+            } else {
+                check_library_thread(&checks[i]);
+            }
+        }
+
+        if (first) {
+            check_library_thread(first);
+        }
+
+        for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+            if (started[i]) {
+                pthread_join(threads[i], NULL);
+            }
+
+            if (checks[i].use_bundled < 0 && res >= 0) {
+                res = checks[i].use_bundled;
+
+                if (error_path) {
+                    *error_path = strdup(checks[i].error_path ? checks[i].error_path : dir);
+                }
+            } else if (checks[i].use_bundled > 0 && res >= 0) {
+                res |= 1 << i;
+            }
+
+            system[i + 3] = checks[i].lib_sys;
+            checks[i].lib_sys = NULL;
+        }
+
+        if (cache && res >= 0) {
+            start = trace_begin();
+            write_cache(cache, dir, res, bundled, system, n);
+            trace_event(start, "cache_write", "path", cache, NULL);
+        }
+    }
+
+    if (token && res >= 0) {
+        *token = from_token ? strdup(getenv(TOKEN_ENV)) : make_token(dir, res, bundled, system, n);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        free(system[i]);
+    }
+
+    for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+        free(checks[i].lib_bundle);
+        free(checks[i].sym_bundle);
+        free(checks[i].required);
+        free(checks[i].others);
+        symbol_list_free(&checks[i].imports);
+    }
+
+    free(cache);
+
+    return res;
+}
+
+
+const char *checkrt_strerror(int error)
+{
+    static const char *const messages[] = {
+        "success",
+        "library or version not found",
+        "cannot read file",
+        "malformed or incompatible ELF file",
+        "buffer too small"
+    };
+
+    if (error > 0 || (size_t)-error >= sizeof(messages) / sizeof(messages[0])) {
+        return "unknown error";
+    }
+
+    return messages[-error];
 }
 
 
-/* compare symbol versions of bundled and system libraries */
-static void compare_library_symbols()
+/* copy a string into a buffer provided by the caller */
+static int copy_string(const char *str, char *buf, size_t size)
 {
-    int res = 0;
-    char *dir = get_exe_dir();
+    size_t len = strlen(str);
 
-    if (use_bundled_library(dir, "gcc", LIBGCC_SO, "GCC_")) {
-        res = 1;
+    if (len >= size) {
+        return CHECKRT_ERANGE;
     }
 
-    if (use_bundled_library(dir, "cxx", STDCXX_SO, "GLIBCXX_")) {
-        res += 2;
+    memcpy(buf, str, len + 1);
+
+    return CHECKRT_OK;
+}
+
+
+int checkrt_system_library_path(const char *soname, char *buf, size_t size)
+{
+    char *path = get_system_library_path(soname, true);
+
+    if (!path) {
+        return CHECKRT_ENOTFOUND;
     }
 
-    switch(res)
-    {
-    case 1:
-        printf("%s/gcc\n", dir);
-        break;
-    case 2:
-        printf("%s/cxx\n", dir);
-        break;
-    case 3:
-        /* load libgcc before libstdc++ */
-        printf("%s/gcc:%s/cxx\n", dir, dir);
-        break;
-    default:
-        break;
+    int rv = copy_string(path, buf, size);
+    free(path);
+
+    return rv;
+}
+
+
+int checkrt_symbol_version(const char *path, const char *prefix, char *buf, size_t size)
+{
+    char *version;
+    int rv = symbol_version(path, prefix, "requested", &version, NULL);
+
+    if (rv == CHECKRT_OK) {
+        rv = version ? copy_string(version, buf, size) : CHECKRT_ENOTFOUND;
+    }
+
+    free(version);
+
+    return rv;
+}
+
+
+int checkrt_use_bundled(const char *bundled, const char *required)
+{
+    struct lib_check check = {0};
+    const char *name = strrchr(bundled, '/');
+
+    name = name ? name + 1 : bundled;
+
+    for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+        if (strcmp(name, runtime_libs[i].soname) == 0) {
+            check.lib = &runtime_libs[i];
+            break;
+        }
+    }
+
+    if (!check.lib) {
+        return CHECKRT_ENOTFOUND;
+    }
+
+    check.lib_bundle = strdup(bundled);
+    check.required = required ? strdup(required) : NULL;
+
+    int rv = use_bundled_library(&check);
+
+    free(check.lib_bundle);
+    free(check.lib_sys);
+    free(check.sym_bundle);
+    free(check.required);
+
+    return rv;
+}
+
+
+int checkrt_library_dirs(const char *dir, char *buf, size_t size)
+{
+    int res = compare_library_symbols(dir, NULL, NULL);
+
+    if (res < 0) {
+        return res;
+    }
+
+    char *libs = get_library_dirs(dir, res);
+    int rv = copy_string(libs ? libs : "", buf, size);
+    free(libs);
+
+    return rv;
+}
+
+
+int checkrt_library_paths(const char *dir, char *buf, size_t size)
+{
+    int res = compare_library_symbols(dir, NULL, NULL);
+
+    if (res < 0) {
+        return res;
+    }
+
+    char *libs = get_library_paths(dir, res);
+    int rv = copy_string(libs ? libs : "", buf, size);
+    free(libs);
+
+    return rv;
+}
+
+
+#ifndef CHECKRT_LIBRARY
+/* compare the libraries for the command line and print errors */
+static int compare_library_symbols_or_warn(const char *dir, char **token)
+{
+    char *error_path = NULL;
+    int res = compare_library_symbols(dir, token, &error_path);
+
+    if (res < 0) {
+        warnx("%s: %s", error_path, checkrt_strerror(res));
+        free(error_path);
+    }
+
+    return res;
+}
+
+
+/* compare the libraries for the command line; errors are fatal */
+static int compare_library_symbols_or_exit(const char *dir, char **token)
+{
+    int res = compare_library_symbols_or_warn(dir, token);
+
+    if (res < 0) {
+        exit(1);
+    }
+
+    return res;
+}
+
+
+/* Remember the original value of a variable in APPIMAGE_ORIG_<name> and
+ * list it in APPIMAGE_ORIG_VARS, like the AppRun hook does for exec.so */
+static void save_env(const char *name)
+{
+    const char *vars = getenv("APPIMAGE_ORIG_VARS");
+    size_t len = strlen(name);
+
+    for (const char *p = vars; p && *p; ) {
+        size_t n = strcspn(p, ":");
+        if (n == len && strncmp(p, name, len) == 0) {
+            return;
+        }
+        p += n;
+        if (*p) {
+            p++;
+        }
+    }
+
+    char *buf = malloc((vars ? strlen(vars) : 0) + len + sizeof("APPIMAGE_ORIG_") + 1);
+    sprintf(buf, "%s%s%s", vars && *vars ? vars : "", vars && *vars ? ":" : "", name);
+    setenv("APPIMAGE_ORIG_VARS", buf, 1);
+
+    const char *value = getenv(name);
+    if (value) {
+        sprintf(buf, "APPIMAGE_ORIG_%s", name);
+        setenv(buf, value, 1);
+    }
+    free(buf);
+}
+
+
+/* prepend value to a colon separated environment variable unless it was
+ * inherited from a process of the same AppDir; that is if the variable
+ * starts with it or, if "anywhere" is true, contains it */
+static void prepend_env(const char *name, const char *value, bool anywhere)
+{
+    const char *old = getenv(name);
+    size_t len = strlen(value);
+
+    for (const char *p = old; p; p = p ? p + 1 : NULL) {
+        if (strncmp(p, value, len) == 0 && (p[len] == ':' || p[len] == 0)) {
+            return;
+        }
+
+        p = anywhere ? strchr(p, ':') : NULL;
+    }
+
+    save_env(name);
+    old = getenv(name);
+
+    if (old && *old) {
+        char *buf = malloc(strlen(value) + strlen(old) + 2);
+        sprintf(buf, "%s:%s", value, old);
+        setenv(name, buf, 1);
+        free(buf);
+    } else {
+        setenv(name, value, 1);
+    }
+}
+
+
+/* set up the environment for the result like the AppRun hook does */
+static void setup_environment(const char *dir, int res, const char *token)
+{
+    bool preload = use_preload(dir);
+    char *libs = preload ? get_library_paths(dir, res) : get_library_dirs(dir, res);
+
+    if (libs) {
+        prepend_env(preload ? "LD_PRELOAD" : "LD_LIBRARY_PATH", libs, preload);
+        free(libs);
+    }
+
+    /* exec.so restores the original value for external processes */
+    save_env(TOKEN_ENV);
+    setenv(TOKEN_ENV, token, 1);
+
+    char *exec_so = malloc(strlen(dir) + sizeof("/exec.so"));
+    sprintf(exec_so, "%s/exec.so", dir);
+
+    if (access(exec_so, F_OK) == 0) {
+        prepend_env("LD_PRELOAD", exec_so, true);
+    }
+
+    free(exec_so);
+}
+
+
+/* set up the environment and execute the program; if the check fails
+ * it's executed with the environment unchanged, like the AppRun hook does */
+static void exec_program(const char *dir, char **argv)
+{
+    char *token = NULL;
+    int res = compare_library_symbols_or_warn(dir, &token);
+
+    if (res >= 0) {
+        setup_environment(dir, res, token);
+    }
+
+    free(token);
+
+    if (debug_mode) {
+        const char *p;
+        fprintf(stderr, "[DEBUG] LD_LIBRARY_PATH=%s\n", (p = getenv("LD_LIBRARY_PATH")) ? p : "");
+        fprintf(stderr, "[DEBUG] LD_PRELOAD=%s\n", (p = getenv("LD_PRELOAD")) ? p : "");
+    }
+
+    if (trace_file) {
+        trace_event(trace_begin(), "exec", "program", argv[0], "LD_LIBRARY_PATH", getenv("LD_LIBRARY_PATH"), NULL);
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+
+    execvp(argv[0], argv);
+    err(127, "cannot execute: %s", argv[0]);
+}
+
+
+/* library file examined by --scan; every file is parsed only once */
+struct batch_task {
+    const char *root;               /* system root to resolve the library in, NULL if bundled */
+    const struct runtime_lib *lib;
+    char **path;                    /* bundled library, or receives the resolved system library */
+    char **version;                 /* receives the highest version */
+    char **defined;                 /* receives the versions of a system library, see find_symbol() */
+};
+
+
+struct batch_job {
+    struct batch_task *tasks;
+    size_t count;
+    size_t next;  /* index of the next task, shared by all threads */
+};
+
+
+static void *batch_thread(void *arg)
+{
+    struct batch_job *job = arg;
+    struct elf_file elf;
+    size_t i;
+
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count) {
+        struct batch_task *task = &job->tasks[i];
+
+        if (task->root) {
+            *task->path = resolve_library_path(task->root, task->lib->soname);
+        }
+
+        if (*task->path && elf_open(&elf, *task->path, false) == CHECKRT_OK) {
+            *task->version = find_symbol(&elf, task->lib->prefix, task->defined);
+            elf_close(&elf);
+        }
+    }
+
+    return NULL;
+}
+
+
+/* Compare the bundled libraries of every AppDir with the system libraries
+ * of every system root and print the decisions as a tab separated table.
+ * The libraries are parsed in parallel, each file only once; bundled
+ * versions are taken from the manifest where possible. */
+static void batch_scan(char **appdirs, size_t nappdirs, char **roots, size_t nroots)
+{
+    struct batch_job job = {0};
+    struct lib_check (*checks)[RUNTIME_LIBS_NUM] = calloc(nappdirs, sizeof(*checks));
+    char *(*sys_path)[RUNTIME_LIBS_NUM] = calloc(nroots, sizeof(*sys_path));
+    char *(*sys_version)[RUNTIME_LIBS_NUM] = calloc(nroots, sizeof(*sys_version));
+    char *(*sys_defined)[RUNTIME_LIBS_NUM] = calloc(nroots, sizeof(*sys_defined));
+    bool (*present)[RUNTIME_LIBS_NUM] = calloc(nappdirs, sizeof(*present));
+
+    /* a mistyped path would otherwise show up as missing libraries */
+    for (size_t r = 0; r < nroots; r++) {
+        int fd = open(roots[r], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+        if (fd == -1) {
+            err(1, "cannot open system root: %s", roots[r]);
+        }
+
+        close(fd);
+    }
+
+    job.tasks = calloc((nappdirs + nroots) * RUNTIME_LIBS_NUM, sizeof(struct batch_task));
+
+    for (size_t a = 0; a < nappdirs; a++) {
+        char *dir = malloc(strlen(appdirs[a]) + sizeof("/checkrt"));
+        sprintf(dir, "%s/checkrt", appdirs[a]);
+
+        for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+            const struct runtime_lib *lib = &runtime_libs[i];
+            struct lib_check *check = &checks[a][i];
+
+            check->lib = lib;
+            check->lib_bundle = malloc(strlen(dir) + strlen(lib->subdir) + strlen(lib->soname) + 3);
+            sprintf(check->lib_bundle, "%s/%s/%s", dir, lib->subdir, lib->soname);
+        }
+
+        read_manifest(dir, checks[a]);
+
+        for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+            struct lib_check *check = &checks[a][i];
+
+            present[a][i] = (access(check->lib_bundle, F_OK) == 0);
+
+            if (present[a][i] && !check->has_manifest) {
+                job.tasks[job.count++] = (struct batch_task) {
+                    NULL, check->lib, &check->lib_bundle, &check->sym_bundle, NULL
+                };
+            }
+        }
+
+        free(dir);
+    }
+
+    for (size_t r = 0; r < nroots; r++) {
+        for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+            job.tasks[job.count++] = (struct batch_task) {
+                roots[r], &runtime_libs[i], &sys_path[r][i], &sys_version[r][i], &sys_defined[r][i]
+            };
+        }
+    }
+
+    run_threads(batch_thread, &job, job.count);
+
+    printf("appdir\tsysroot\tlibrary\tbundled\tsystem\trequired\tuse\n");
+
+    for (size_t a = 0; a < nappdirs; a++) {
+        for (size_t r = 0; r < nroots; r++) {
+            for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+                struct lib_check *check = &checks[a][i];
+
+                if (!present[a][i]) {
+                    continue;
+                }
+
+                bool bundled = prefer_bundled(check->sym_bundle, sys_path[r][i], sys_version[r][i], check->required,
+                                              check->others, sys_defined[r][i]);
+
+                printf("%s\t%s\t%s\t%s\t%s\t%s%s%s\t%s\n", appdirs[a], roots[r], runtime_libs[i].soname,
+                    check->sym_bundle ? check->sym_bundle : "-",
+                    sys_version[r][i] ? sys_version[r][i] : (sys_path[r][i] ? "-" : "missing"),
+                    check->required ? check->required : "-",
+                    check->others ? "," : "", check->others ? check->others : "",
+                    bundled ? "bundled" : "system");
+            }
+        }
+    }
+
+    for (size_t a = 0; a < nappdirs; a++) {
+        for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+            free(checks[a][i].lib_bundle);
+            free(checks[a][i].sym_bundle);
+            free(checks[a][i].required);
+            free(checks[a][i].others);
+        }
+    }
+
+    for (size_t r = 0; r < nroots; r++) {
+        for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+            free(sys_path[r][i]);
+            free(sys_version[r][i]);
+            free(sys_defined[r][i]);
+        }
     }
 
-    free(dir);
+    free(job.tasks);
+    free(checks);
+    free(present);
+    free(sys_path);
+    free(sys_version);
+    free(sys_defined);
 }
 
 
 int main(int argc, char **argv)
 {
     const char *usage =
-        "usage: %s [--copy|--help]\n"
+        "usage: %s [--token] [--preload]\n"
+        "       %s --copy|--help\n"
+        "       %s --exec <program> [<args>...]\n"
+        "       %s --scan <appdir>... [--sysroot <dir>...]\n"
+        "\n"
+        "  --copy     copy the system libraries next to the executable\n"
+        "  --token    print a token for " TOKEN_ENV " after the library directories;\n"
+        "             a valid token in the environment is used instead of checking\n"
+        "  --preload  print the paths of the bundled libraries to preload instead\n"
+        "             of their directories\n"
+        "  --exec     set up the library search path and execute program\n"
+        "  --scan     compare the libraries bundled in each AppDir with those of\n"
+        "             each system root (default: /) and print a table\n"
+        "  --help     print this message\n"
         "\n"
         "Set environment variable CHECKRT_DEBUG to enable extra verbose output.\n"
-        "Set CHECKRT_DEBUG=FULL to enable full verbosity.\n";
+        "Set CHECKRT_DEBUG=FULL to enable full verbosity.\n"
+        "Set CHECKRT_NOCACHE to ignore and not write the result cache.\n"
+        "Set CHECKRT_PRECISE with --copy to record the imported symbols and\n"
+        "compare the system libraries by symbol instead of by version.\n"
+        "Set CHECKRT_STRIP with --copy to remove sections not needed at runtime.\n"
+        "Set CHECKRT_PRELOAD with --copy to let the AppRun hook and --exec preload\n"
+        "the bundled libraries instead of setting LD_LIBRARY_PATH.\n"
+        "Set CHECKRT_TRACE to a file path to append per-phase timings as JSON lines.\n";
 
     char *env = getenv("CHECKRT_DEBUG");
 
@@ -504,27 +3745,127 @@ int main(int argc, char **argv)
         debug_mode = true;
     }
 
-    if (argc < 2) {
-        compare_library_symbols();
+    env = getenv("CHECKRT_TRACE");
+
+    if (env && *env && (trace_file = fopen(env, "ae")) == NULL) {
+        warn("cannot open trace file: %s", env);
+    }
+
+    uint64_t main_start = trace_begin();
+
+    /* check and print the result, optionally with a token and as paths */
+    bool want_token = false, preload = false, print_result = true;
+
+    for (int i = 1; i < argc && print_result; i++) {
+        if (strcmp(argv[i], "--token") == 0 && !want_token) {
+            want_token = true;
+        } else if (strcmp(argv[i], "--preload") == 0 && !preload) {
+            preload = true;
+        } else {
+            print_result = false;
+        }
+    }
+
+    if (print_result) {
+        char *dir = get_exe_dir();
+        char *token = NULL;
+        int res = compare_library_symbols_or_exit(dir, want_token ? &token : NULL);
+        char *libs = preload ? get_library_paths(dir, res) : get_library_dirs(dir, res);
+
+        uint64_t start = trace_begin();
+
+        if (token) {
+            printf("%s\n%s\n", libs ? libs : "", token);
+            fflush(stdout);
+        } else if (libs) {
+            printf("%s\n", libs);
+            fflush(stdout);
+        }
+
+        trace_event(start, "output", preload ? "paths" : "dirs", libs, NULL);
+        trace_event(main_start, "total", "dir", dir, NULL);
+
+        free(token);
+        free(libs);
+        free(dir);
         return 0;
     }
 
+    if (argc > 2 && strcmp(argv[1], "--exec") == 0) {
+        char *dir = get_exe_dir();
+        exec_program(dir, argv + 2);
+    }
+
     if (argc == 2 && strcmp(argv[1], "--copy") == 0) {
         /* copy system libraries next to executable */
         char *dir = get_exe_dir();
-        copy_lib(dir, "gcc", LIBGCC_SO);
-        copy_lib(dir, "cxx", STDCXX_SO);
+        const char *strip = getenv("CHECKRT_STRIP");
+
+        /* the optional libraries are copied by scan_requirements() if needed */
+        for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+            if (runtime_libs[i].optional) {
+                remove_lib(dir, &runtime_libs[i]);
+                continue;
+            }
+
+            uint64_t start = trace_begin();
+            free(copy_lib(dir, &runtime_libs[i], strip && *strip));
+            trace_event(start, "copy", "lib", runtime_libs[i].soname, NULL);
+        }
+
+        char *required[RUNTIME_LIBS_NUM] = {0};
+        char *others[RUNTIME_LIBS_NUM] = {0};
+        const char *precise = getenv("CHECKRT_PRECISE");
+        uint64_t start = trace_begin();
+        scan_requirements(dir, required, others, precise && *precise, strip && *strip);
+        trace_event(start, "scan_requirements", "dir", dir, NULL);
+
+        start = trace_begin();
+        write_manifest(dir, required, others);
+        trace_event(start, "manifest_write", "dir", dir, NULL);
+
+        const char *preload_env = getenv("CHECKRT_PRELOAD");
+        write_preload_file(dir, preload_env && *preload_env);
+        trace_event(main_start, "total", "dir", dir, NULL);
+
+        for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+            free(required[i]);
+            free(others[i]);
+        }
+
         free(dir);
         return 0;
     }
 
+    if (argc > 2 && strcmp(argv[1], "--scan") == 0) {
+        char *default_root[] = { "/" };
+        char **roots = default_root;
+        size_t nappdirs = 0, nroots = 1;
+
+        while (2 + nappdirs < (size_t)argc && strcmp(argv[2 + nappdirs], "--sysroot") != 0) {
+            nappdirs++;
+        }
+
+        if (2 + nappdirs < (size_t)argc) {
+            roots = argv + 2 + nappdirs + 1;
+            nroots = argc - (2 + nappdirs + 1);
+        }
+
+        if (nappdirs > 0 && nroots > 0) {
+            batch_scan(argv + 2, nappdirs, roots, nroots);
+            trace_event(main_start, "total", "dir", NULL, NULL);
+            return 0;
+        }
+    }
+
     if (argc == 2 && strcmp(argv[1], "--help") == 0) {
-        fprintf(stderr, usage, argv[0]);
+        fprintf(stderr, usage, argv[0], argv[0], argv[0], argv[0]);
         return 0;
     }
 
     fprintf(stderr, "%s\n", "error: unknown argument(s) given");
-    fprintf(stderr, usage, argv[0]);
+    fprintf(stderr, usage, argv[0], argv[0], argv[0], argv[0]);
 
     return 1;
 }
+#endif /* !CHECKRT_LIBRARY */
@@ -0,0 +1,87 @@
+/* Copyright (c) 2022-2025 Carsten Janssen <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/*
+ * libcheckrt makes the decision of checkrt available to a native AppRun,
+ * so that it doesn't need to run checkrt and parse its output.
+ *
+ * Compile checkrt.c with CHECKRT_LIBRARY defined and link the object file
+ * into the program:
+ *
+ *   cc -O2 -DCHECKRT_LIBRARY -c checkrt.c -o libcheckrt.o
+ *   cc myapprun.c libcheckrt.o -o AppRun -pthread -ldl
+ *
+ * Add CHECKRT_STATIC to leave out the dlmopen() fallback and libdl.
+ *
+ * All functions can be called concurrently from multiple threads. They never
+ * print anything or exit the process; errors are returned as negative codes
+ * and strings are written to buffers provided by the caller.
+ */
+#ifndef CHECKRT_H
+#define CHECKRT_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* return codes of the checkrt_*() functions */
+enum checkrt_error {
+    CHECKRT_OK        =  0,
+    CHECKRT_ENOTFOUND = -1,  /* library or version not found */
+    CHECKRT_EIO       = -2,  /* file cannot be opened or read */
+    CHECKRT_EFORMAT   = -3,  /* malformed or incompatible ELF file */
+    CHECKRT_ERANGE    = -4   /* buffer too small */
+};
+
+/* get a description of an error code */
+const char *checkrt_strerror(int error);
+
+/* Resolve the path of a system library in the same order as ld.so.
+ * Libraries that can't be found in LD_LIBRARY_PATH, ld.so.cache or the
+ * default directories are loaded with dlmopen() into a new namespace. */
+int checkrt_system_library_path(const char *soname, char *buf, size_t size);
+
+/* Get the highest version with the given prefix (e.g. "GLIBCXX_")
+ * defined by a library. */
+int checkrt_symbol_version(const char *path, const char *prefix, char *buf, size_t size);
+
+/* Decide whether a bundled GCC runtime library should be used instead
+ * of the system one. "required" is the highest version required by the
+ * application or NULL. Returns 1 for the bundled library, 0 for the
+ * system library or an error code. */
+int checkrt_use_bundled(const char *bundled, const char *required);
+
+/* Make the decision of checkrt for the checkrt directory of an AppDir,
+ * including its manifest and the result cache, and write the library
+ * directories to prepend to LD_LIBRARY_PATH to "buf" (colon separated,
+ * empty if no bundled library is used). */
+int checkrt_library_dirs(const char *dir, char *buf, size_t size);
+
+/* Like checkrt_library_dirs(), but write the absolute paths of the bundled
+ * libraries to add to LD_PRELOAD instead of their directories. */
+int checkrt_library_paths(const char *dir, char *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CHECKRT_H */
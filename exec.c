@@ -30,24 +30,42 @@
  *
  * 2. This library will intercept calls to new processes and will detect whether
  *    those calls are for binaries within the AppImage bundle or external ones.
+ *    The exec family (`execve`, `execv`, `execvp`, `execvpe`, `execl`,
+ *    `execlp`, `execle`, `fexecve`) and `posix_spawn`/`posix_spawnp` are
+ *    interposed, since glibc implements them on internal entry points.
  *
  * 3. In case it's an internal process, it will not change anything.
- *    In case it's an external process, it will restore the environment of
- *    the AppImage parent by reading `/proc/[pid]/environ`.
- *    This is the conservative approach taken.
+ *    In case it's an external process, it will restore the variables listed
+ *    in `APPIMAGE_ORIG_VARS` to the values saved by the AppRun hook in
+ *    `APPIMAGE_ORIG_<name>`, leaving the rest of the caller's environment
+ *    untouched. Variables without a saved value were unset before and are
+ *    removed. Without that list it falls back to the conservative approach
+ *    of restoring the whole environment of the AppImage parent by reading
+ *    `/proc/[pid]/environ`.
  */
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
 #endif
 #include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/param.h> /* MIN() */
+#include <sys/param.h> /* MAXSYMLINKS */
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 
 typedef int (*execve_func_t)(const char *filename, char *const argv[], char *const envp[]);
+typedef int (*fexecve_func_t)(int fd, char *const argv[], char *const envp[]);
+typedef int (*posix_spawn_func_t)(pid_t *pid, const char *path, const posix_spawn_file_actions_t *file_actions,
+                                  const posix_spawnattr_t *attrp, char *const argv[], char *const envp[]);
 
 #define VISIBLE __attribute__ ((visibility ("default")))
 
@@ -56,158 +74,780 @@ typedef int (*execve_func_t)(const char *filename, char *const argv[], char *con
 #endif
 
 #ifdef DEBUG
-#include <errno.h>
 #define DEBUG_PRINT(...) \
     if (getenv("APPIMAGE_EXEC_DEBUG")) { \
-        printf("APPIMAGE_EXEC>> " __VA_ARGS__); \
+        fprintf(stderr, "APPIMAGE_EXEC>> " __VA_ARGS__); \
     }
 #else
 #define DEBUG_PRINT(...)  /**/
 #endif
 
 
-static void env_free(char* const *env)
+#define ORIG_PREFIX "APPIMAGE_ORIG_"
+#define ORIG_PREFIX_LEN (sizeof(ORIG_PREFIX) - 1)
+#define ORIG_VARS ORIG_PREFIX "VARS"
+
+/* variable changed by the AppRun hook and its original value */
+struct orig_var {
+    const char *name;
+    size_t name_len;
+    const char *entry;  /* "name=value", or NULL if it was unset */
+};
+
+/* variables listed in APPIMAGE_ORIG_VARS, read once when the library is loaded */
+static struct orig_var *orig_vars = NULL;
+static size_t orig_vars_num = 0;
+
+/* environment of the parent process, only read if APPIMAGE_ORIG_VARS is not set */
+static char* const *parent_env = NULL;
+
+/* Read /proc/[pid]/environ into a single memory block
+ * holding the pointer array followed by the strings. */
+static char* const* read_env_from_process(pid_t pid)
 {
-    size_t len = 0;
-    while (env[len] != 0) {
-        free(env[len]);
-        len++;
+    char path[64];
+    size_t len = 0, size = 4096;
+    ssize_t n;
+
+    snprintf(path, sizeof(path), "/proc/%d/environ", pid);
+    DEBUG_PRINT("Reading env from parent process: %s\n", path);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        DEBUG_PRINT("Error reading file: %s (%s)\n", path, strerror(errno));
+        return NULL;
+    }
+
+    char *buffer = malloc(size);
+    while ((n = read(fd, buffer + len, size - len - 1)) != 0) {
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            DEBUG_PRINT("Error reading file: %s (%s)\n", path, strerror(errno));
+            close(fd);
+            free(buffer);
+            return NULL;
+        }
+        len += n;
+        if (len == size - 1) {
+            size *= 2;
+            buffer = realloc(buffer, size);
+        }
+    }
+    close(fd);
+    buffer[len] = 0;
+
+    /* count variables */
+    size_t num_vars = 0;
+    for (char *ptr = buffer; ptr < buffer + len && *ptr; ptr += strlen(ptr) + 1)
+        num_vars++;
+
+    char **env = malloc((num_vars + 1) * sizeof(char*) + len + 1);
+    char *strings = (char *)(env + num_vars + 1);
+    memcpy(strings, buffer, len + 1);
+    free(buffer);
+
+    for (size_t i = 0; i < num_vars; i++) {
+        env[i] = strings;
+        DEBUG_PRINT("\tenv var copied: %s\n", env[i]);
+        strings += strlen(strings) + 1;
+    }
+    env[num_vars] = NULL;
+
+    return env;
+}
+
+/* Parse the colon separated APPIMAGE_ORIG_VARS list. The saved values are
+ * used in place: "APPIMAGE_ORIG_NAME=value" minus the prefix is "NAME=value". */
+static void read_orig_vars(const char *list)
+{
+    char *names = strdup(list);
+    size_t num = 1;
+    for (const char *p = names; *p; p++)
+        num += *p == ':';
+    orig_vars = calloc(num, sizeof(struct orig_var));
+
+    for (char *name = strtok(names, ":"); name; name = strtok(NULL, ":")) {
+        struct orig_var *var = &orig_vars[orig_vars_num++];
+        var->name = name;
+        var->name_len = strlen(name);
+
+        for (char **env = environ; *env; env++) {
+            if (strncmp(*env, ORIG_PREFIX, ORIG_PREFIX_LEN) == 0 &&
+                strncmp(*env + ORIG_PREFIX_LEN, name, var->name_len) == 0 &&
+                (*env)[ORIG_PREFIX_LEN + var->name_len] == '=') {
+                var->entry = *env + ORIG_PREFIX_LEN;
+                break;
+            }
+        }
+        DEBUG_PRINT("Original value of %s: %s\n", name, var->entry ? var->entry : "(unset)");
     }
-    free((char**)env);
 }
 
-static size_t get_number_of_variables(FILE *file, char **buffer, size_t *len)
+/* real entry points and canonical APPDIR, resolved once at load time */
+static execve_func_t real_execve = NULL;
+static execve_func_t real_execvpe = NULL;
+static fexecve_func_t real_fexecve = NULL;
+static posix_spawn_func_t real_posix_spawn = NULL;
+static posix_spawn_func_t real_posix_spawnp = NULL;
+static char *appdir = NULL;
+static size_t appdir_len = 0;
+/* $APPDIR as given, if it differs from the canonical path */
+static char *appdir_alias = NULL;
+static size_t appdir_alias_len = 0;
+
+/* Statistics, enabled with APPIMAGE_EXEC_STATS=<path or file descriptor>.
+ * Every process appends one JSON line with its own counts when it exits or
+ * replaces itself through exec, so the counters are never reset otherwise. */
+enum exec_entry {
+    ENTRY_EXECVE, ENTRY_EXECV, ENTRY_EXECVPE, ENTRY_EXECVP, ENTRY_EXECL,
+    ENTRY_EXECLP, ENTRY_EXECLE, ENTRY_FEXECVE, ENTRY_POSIX_SPAWN, ENTRY_POSIX_SPAWNP,
+    ENTRY_NUM
+};
+
+static const char *const entry_names[ENTRY_NUM] = {
+    "execve", "execv", "execvpe", "execvp", "execl",
+    "execlp", "execle", "fexecve", "posix_spawn", "posix_spawnp"
+};
+
+struct exec_stats {
+    uint64_t calls[ENTRY_NUM];
+    uint64_t internal;
+    uint64_t external;
+    uint64_t unresolved;
+    uint64_t restore_failures;
+    uint64_t ns;
+};
+
+static struct exec_stats stats;
+static int stats_enabled = 0;
+static int stats_fd = -1;
+static char *stats_path = NULL;
+/* process the counters belong to; a vfork() child shares them with it */
+static pid_t stats_pid = 0;
+
+#define STAT_ADD(field, n) \
+    do { \
+        if (stats_enabled) \
+            __atomic_add_fetch(&stats.field, (n), __ATOMIC_RELAXED); \
+    } while (0)
+
+static uint64_t now_ns(void)
 {
-    size_t number = 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-    if (getline(buffer, len, file) < 0)
-        return -1;
+/* Formatting helpers for write_stats(), which must not use stdio */
+static char *put_str(char *p, const char *str)
+{
+    size_t len = strlen(str);
+    memcpy(p, str, len);
+    return p + len;
+}
+
+static char *put_u64(char *p, uint64_t value)
+{
+    char digits[20];
+    size_t len = 0;
+    do {
+        digits[len++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (len)
+        *p++ = digits[--len];
+    return p;
+}
+
+static char *put_field(char *p, const char *sep, const char *name, uint64_t *counter)
+{
+    p = put_str(p, sep);
+    p = put_str(p, "\"");
+    p = put_str(p, name);
+    p = put_str(p, "\":");
+    return put_u64(p, __atomic_load_n(counter, __ATOMIC_RELAXED));
+}
 
-    char *ptr = *buffer;
-    while (ptr < *buffer + *len) {
-        size_t var_len = strlen(ptr);
-        ptr += var_len + 1;
-        if (var_len == 0)
+/* Append the counters of this process as one JSON line */
+static void write_stats(void)
+{
+    char buf[1024 + 6 * PATH_MAX];
+    char exe[PATH_MAX];
+    char *p = buf;
+
+    ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    exe[len < 0 ? 0 : len] = 0;
+
+    p = put_str(p, "{\"pid\":");
+    p = put_u64(p, getpid());
+    p = put_str(p, ",\"exe\":\"");
+    for (const char *c = exe; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            *p++ = '\\';
+            *p++ = *c;
+        } else if ((unsigned char)*c < 0x20) {
+            p = put_str(p, "\\u00");
+            *p++ = "0123456789abcdef"[*c >> 4];
+            *p++ = "0123456789abcdef"[*c & 0xf];
+        } else {
+            *p++ = *c;
+        }
+    }
+    p = put_str(p, "\",\"calls\":{");
+    for (size_t i = 0; i < ENTRY_NUM; i++)
+        p = put_field(p, i ? "," : "", entry_names[i], &stats.calls[i]);
+    p = put_str(p, "}");
+    p = put_field(p, ",", "internal", &stats.internal);
+    p = put_field(p, ",", "external", &stats.external);
+    p = put_field(p, ",", "unresolved", &stats.unresolved);
+    p = put_field(p, ",", "restore_failures", &stats.restore_failures);
+    p = put_field(p, ",", "ns", &stats.ns);
+    p = put_str(p, "}\n");
+
+    int fd = stats_fd;
+    if (fd == -1)
+        fd = open(stats_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return;
+    for (char *q = buf; q < p; ) {
+        ssize_t n = write(fd, q, p - q);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
             break;
-        number++;
+        q += n;
     }
+    if (fd != stats_fd)
+        close(fd);
+}
 
-    return number != 0 ? (ssize_t)number : -1;
+/* a forked child starts counting from zero */
+static void stats_atfork_child(void)
+{
+    memset(&stats, 0, sizeof(stats));
+    stats_pid = getpid();
 }
 
-static char* const* env_from_buffer(FILE *file)
+static void init_stats(const char *target)
 {
-    char *buffer = NULL;
-    size_t len = 0;
-    size_t num_vars = get_number_of_variables(file, &buffer, &len);
-    char** env = calloc(num_vars + 1, sizeof(char*));
+    if (!*target)
+        return;
+    if (strspn(target, "0123456789") == strlen(target))
+        stats_fd = atoi(target);
+    else
+        stats_path = strdup(target);
+    stats_pid = getpid();
+    pthread_atfork(NULL, NULL, stats_atfork_child);
+    stats_enabled = 1;
+}
 
-    size_t n = 0;
-    char *ptr = buffer;
-    while (ptr < buffer + len && n < num_vars) {
-        size_t var_len = strlen(ptr);
-        if (var_len == 0)
+/* Write the statistics before the process image is replaced. If the exec
+ * fails the process keeps running, so start counting from zero again. */
+static void stats_before_exec(void)
+{
+    if (stats_enabled && getpid() == stats_pid)
+        write_stats();
+}
+
+static void stats_after_exec(void)
+{
+    if (stats_enabled && getpid() == stats_pid)
+        memset(&stats, 0, sizeof(stats));
+}
+
+__attribute__((destructor)) static void exec_fini(void)
+{
+    if (stats_enabled && getpid() == stats_pid)
+        write_stats();
+}
+
+static void *load_symbol(const char *name)
+{
+    void *sym = dlsym(RTLD_NEXT, name);
+    if (!sym) {
+        DEBUG_PRINT("Error getting %s original symbol: %s\n", name, dlerror());
+    }
+    return sym;
+}
+
+/* Snapshot the parent environment while the parent is still the AppRun
+ * launcher; later getppid() may return a subreaper or init. */
+__attribute__((constructor)) static void exec_init(void)
+{
+    const char *stats_target = getenv("APPIMAGE_EXEC_STATS");
+    if (stats_target)
+        init_stats(stats_target);
+
+    const char *list = getenv(ORIG_VARS);
+    if (list)
+        read_orig_vars(list);
+    else
+        parent_env = read_env_from_process(getppid());
+
+    real_execve = (execve_func_t)load_symbol("execve");
+    real_execvpe = (execve_func_t)load_symbol("execvpe");
+    real_fexecve = (fexecve_func_t)load_symbol("fexecve");
+    real_posix_spawn = (posix_spawn_func_t)load_symbol("posix_spawn");
+    real_posix_spawnp = (posix_spawn_func_t)load_symbol("posix_spawnp");
+
+    const char *env_appdir = getenv("APPDIR");
+    if (env_appdir) {
+        appdir = realpath(env_appdir, NULL);
+        if (!appdir)
+            appdir = strdup(env_appdir);
+        appdir_len = strlen(appdir);
+        while (appdir_len > 1 && appdir[appdir_len - 1] == '/')
+            appdir[--appdir_len] = 0;
+        DEBUG_PRINT("APPDIR = %s\n", appdir);
+
+        size_t len = strlen(env_appdir);
+        while (len > 1 && env_appdir[len - 1] == '/')
+            len--;
+        if (env_appdir[0] == '/' && (len != appdir_len || strncmp(env_appdir, appdir, len) != 0)) {
+            appdir_alias = strndup(env_appdir, len);
+            appdir_alias_len = len;
+        }
+    }
+}
+
+/* The functions below run between vfork()/posix_spawn() and the real exec,
+ * where the child shares the parent's memory: they must neither allocate nor
+ * take locks. Scratch space lives on the stack, the parent environment was
+ * read at load time and only syscall wrappers are used to resolve paths. */
+
+/* Drop the last component of an absolute path, never going above "/" */
+static void pop_component(char *path)
+{
+    char *slash = strrchr(path, '/');
+    if (slash == path)
+        path[1] = 0;
+    else
+        *slash = 0;
+}
+
+/* Canonicalize a path like realpath(3) without allocating memory.
+ * "out" must hold PATH_MAX bytes. Returns 0 on success and -1 on error. */
+static int resolve_path(const char *path, char *out)
+{
+    char rest[PATH_MAX], link[PATH_MAX];
+    struct stat st;
+    int links = 0;
+
+    if (strlen(path) >= sizeof(rest))
+        return -1;
+    if (path[0] == '/') {
+        strcpy(out, "/");
+    } else if (!getcwd(out, PATH_MAX)) {
+        return -1;
+    }
+    strcpy(rest, path);
+
+    char *p = rest;
+    while (*p) {
+        while (*p == '/')
+            p++;
+        if (!*p)
             break;
+        char *end = strchrnul(p, '/');
+        size_t clen = end - p;
+        if (clen == 1 && p[0] == '.') {
+            p = end;
+            continue;
+        }
+        if (clen == 2 && p[0] == '.' && p[1] == '.') {
+            pop_component(out);
+            p = end;
+            continue;
+        }
 
-        env[n] = calloc(sizeof(char*), var_len + 1);
-        strncpy(env[n], ptr, var_len + 1);
-        DEBUG_PRINT("\tenv var copied: %s\n", env[n]);
-        ptr += var_len + 1;
-        n++;
+        size_t len = strlen(out);
+        if (len + clen + 2 > PATH_MAX)
+            return -1;
+        if (len > 1)
+            out[len++] = '/';
+        memcpy(out + len, p, clen);
+        out[len + clen] = 0;
+        p = end;
+
+        if (lstat(out, &st) == -1)
+            return -1;
+        if (S_ISLNK(st.st_mode)) {
+            if (++links > MAXSYMLINKS)
+                return -1;
+            ssize_t n = readlink(out, link, sizeof(link) - 1);
+            if (n == -1)
+                return -1;
+            size_t restlen = strlen(p);
+            if (n + restlen + 1 > sizeof(rest))
+                return -1;
+            /* continue with the link target followed by the unresolved rest */
+            memmove(rest + n, p, restlen + 1);
+            memcpy(rest, link, n);
+            p = rest;
+            if (link[0] == '/')
+                strcpy(out, "/");
+            else
+                pop_component(out);
+        } else if (*p && !S_ISDIR(st.st_mode)) {
+            return -1;
+        }
     }
-    free(buffer);
+    return 0;
+}
 
-    return env;
+/* Find an executable in $PATH the way execvp() does, resolving the
+ * result into "out" (PATH_MAX bytes). Returns 0 on success. */
+static int find_in_path(const char *file, char *out)
+{
+    char candidate[PATH_MAX];
+    const char *path = getenv("PATH");
+    if (!path)
+        path = "/bin:/usr/bin";
+
+    size_t flen = strlen(file);
+    while (*path) {
+        const char *end = strchrnul(path, ':');
+        size_t dlen = end - path;
+        if (dlen == 0) {
+            /* empty entry means the current directory */
+            candidate[0] = '.';
+            dlen = 1;
+        } else if (dlen + flen + 2 <= sizeof(candidate)) {
+            memcpy(candidate, path, dlen);
+        } else {
+            dlen = 0;
+        }
+        if (dlen) {
+            candidate[dlen] = '/';
+            memcpy(candidate + dlen + 1, file, flen + 1);
+            if (access(candidate, X_OK) == 0 && resolve_path(candidate, out) == 0)
+                return 0;
+        }
+        path = *end ? end + 1 : end;
+    }
+    return -1;
 }
 
-static char* const* read_env_from_process(pid_t pid)
+/* Copy envp to "out" (room for all entries of envp plus the terminator),
+ * putting back the original values of the variables changed by the hook
+ * and dropping the APPIMAGE_ORIG_* bookkeeping. */
+static void restore_orig_vars(char *const envp[], char *out[])
 {
-    char buffer[256] = {0};
+    size_t n = 0;
+    for (; *envp; envp++) {
+        const char *entry = *envp;
+        if (strncmp(entry, ORIG_PREFIX, ORIG_PREFIX_LEN) == 0)
+            continue;
+
+        for (size_t i = 0; i < orig_vars_num; i++) {
+            const struct orig_var *var = &orig_vars[i];
+            if (strncmp(entry, var->name, var->name_len) == 0 && entry[var->name_len] == '=') {
+                entry = var->entry;
+                break;
+            }
+        }
+        if (entry)
+            out[n++] = (char *)entry;
+    }
+    out[n] = NULL;
+}
 
-    snprintf(buffer, sizeof(buffer), "/proc/%d/environ", pid);
-    DEBUG_PRINT("Reading env from parent process: %s\n", buffer);
-    FILE *env_file = fopen(buffer, "r");
-    if (!env_file) {
-        DEBUG_PRINT("Error reading file: %s (%s)\n", buffer, strerror(errno));
-        return NULL;
+/* Whether an absolute path has no ".", ".." or empty components */
+static int is_normalized(const char *path)
+{
+    for (const char *p = path; *p; p++) {
+        if (p[0] != '/')
+            continue;
+        if (p[1] == '/')
+            return 0;
+        if (p[1] == '.' && (p[2] == '/' || p[2] == 0 || (p[2] == '.' && (p[3] == '/' || p[3] == 0))))
+            return 0;
     }
+    return 1;
+}
 
-    char* const* env = env_from_buffer(env_file);
-    fclose(env_file);
+/* Whether a path is "dir" itself or below it */
+static int is_below(const char *path, const char *dir, size_t dir_len)
+{
+    if (strncmp(path, dir, dir_len) != 0)
+        return 0;
+    /* "/tmp/.mount_abc2" is not inside "/tmp/.mount_abc" */
+    return dir_len == 1 || path[dir_len] == '/' || path[dir_len] == 0;
+}
 
-    return env;
+/* Whether no component of an absolute, normalized path is a symlink. The
+ * components up to APPDIR are known not to be, since it's canonicalized. */
+static int has_no_symlinks(const char *path)
+{
+    char prefix[PATH_MAX];
+    struct stat st;
+    size_t len = strlen(path);
+    if (len >= sizeof(prefix))
+        return 0;
+    memcpy(prefix, path, len + 1);
+
+    char *p = prefix + 1;
+    if (appdir && is_below(path, appdir, appdir_len))
+        p = prefix + appdir_len;
+
+    for (;; p++) {
+        if (*p != '/' && *p != 0)
+            continue;
+        char c = *p;
+        *p = 0;
+        if (lstat(prefix, &st) == -1 || S_ISLNK(st.st_mode))
+            return 0;
+        if (!c)
+            return 1;
+        *p = c;
+    }
 }
 
 static int is_external_process(const char *filename)
 {
-    const char *appdir = getenv("APPDIR");
     if (!appdir)
         return 0;
-    DEBUG_PRINT("APPDIR = %s\n", appdir);
 
-    return strncmp(filename, appdir, MIN(strlen(filename), strlen(appdir)));
+    return !is_below(filename, appdir, appdir_len) &&
+           !(appdir_alias && is_below(filename, appdir_alias, appdir_alias_len));
+}
+
+/* Whether the program about to be executed lies outside the AppDir */
+static int is_external_exec(const char *filename, int search_path)
+{
+    /* Absolute, normalized paths without symlinked components (e.g.
+     * usr/bin/python -> python3, or a link to a directory of the AppDir)
+     * are classified as they are; only relative or symlinked paths go
+     * through the full resolution. */
+    char fullpath[PATH_MAX];
+    const char *path = filename;
+    int resolved;
+    if (search_path && !strchr(filename, '/')) {
+        resolved = find_in_path(filename, fullpath) == 0;
+        path = fullpath;
+    } else if (filename[0] == '/' && is_normalized(filename) && has_no_symlinks(filename)) {
+        resolved = 1;
+    } else {
+        resolved = resolve_path(filename, fullpath) == 0;
+        path = fullpath;
+    }
+    DEBUG_PRINT("filename %s, fullpath %s\n", filename, resolved ? path : "(unresolved)");
+    if (!resolved)
+        STAT_ADD(unresolved, 1);
+
+    return resolved && is_external_process(path);
 }
 
-static int exec_common(execve_func_t function, const char *filename, char* const argv[], char* const envp[])
+/* Number of entries exec_env() needs in its "out" array */
+static size_t exec_env_size(char *const envp[])
 {
-    // Try to get the canonical path in case it's a relative path or symbolic link.
-    char *fullpath = canonicalize_file_name(filename);
-    DEBUG_PRINT("filename %s, fullpath %s\n", filename, fullpath);
+    size_t n = 0;
+    if (appdir && orig_vars && envp) {
+        while (envp[n])
+            n++;
+    }
+    return n + 1;
+}
 
-    char* const *env = envp;
-    if (is_external_process(fullpath)) {
-        DEBUG_PRINT("External process detected. Restoring env vars from parent %d\n", getppid());
-        env = read_env_from_process(getppid());
-        if (!env) {
-            env = envp;
-            DEBUG_PRINT("Error restoring env vars from parent\n");
-        }
+static char *const *select_env(const char *filename, int search_path, char *const envp[], char *out[])
+{
+    if (!appdir || !is_external_exec(filename, search_path)) {
+        STAT_ADD(internal, 1);
+        return envp;
+    }
+    STAT_ADD(external, 1);
+
+    if (orig_vars && envp) {
+        DEBUG_PRINT("External process detected. Restoring original values of changed env vars\n");
+        restore_orig_vars(envp, out);
+        return out;
+    }
+    if (parent_env) {
+        DEBUG_PRINT("External process detected. Restoring env vars from parent\n");
+        return parent_env;
     }
-    int ret = function(filename, argv, env);
+    DEBUG_PRINT("Error restoring env vars from parent\n");
+    STAT_ADD(restore_failures, 1);
+    return envp;
+}
+
+/* Return the environment to execute "filename" with, using "out"
+ * (exec_env_size() entries) for a patched copy of envp */
+static char *const *exec_env(const char *filename, int search_path, char *const envp[], char *out[])
+{
+    if (!stats_enabled)
+        return select_env(filename, search_path, envp, out);
 
-    if (fullpath != filename)
-        free(fullpath);
+    uint64_t start = now_ns();
+    char *const *env = select_env(filename, search_path, envp, out);
+    STAT_ADD(ns, now_ns() - start);
+    return env;
+}
 
-    if (env != envp)
-        env_free(env);
+static int exec_common(execve_func_t function, const char *filename, char* const argv[], char* const envp[],
+                       int search_path)
+{
+    if (!function) {
+        errno = ENOSYS;
+        return -1;
+    }
 
+    char *env[exec_env_size(envp)];
+    char *const *exec_envp = exec_env(filename, search_path, envp, env);
+    stats_before_exec();
+    int ret = function(filename, argv, exec_envp);
+    stats_after_exec();
     return ret;
 }
 
+static int spawn_common(posix_spawn_func_t function, pid_t *pid, const char *path,
+                        const posix_spawn_file_actions_t *file_actions, const posix_spawnattr_t *attrp,
+                        char *const argv[], char *const envp[], int search_path)
+{
+    if (!function)
+        return ENOSYS;
+
+    char *env[exec_env_size(envp)];
+    return function(pid, path, file_actions, attrp, argv, exec_env(path, search_path, envp, env));
+}
+
+/* Number of arguments of an execl() style call, including "arg" */
+static size_t count_args(const char *arg, va_list *ap)
+{
+    va_list aq;
+    size_t argc = 0;
+
+    va_copy(aq, *ap);
+    for (const char *p = arg; p; p = va_arg(aq, const char *))
+        argc++;
+    va_end(aq);
+
+    return argc;
+}
+
+/* Copy the arguments of an execl() style call into a NULL terminated array */
+static void collect_args(char *argv[], const char *arg, va_list *ap)
+{
+    size_t i = 0;
+    for (const char *p = arg; p; p = va_arg(*ap, const char *))
+        argv[i++] = (char *)p;
+    argv[i] = NULL;
+}
+
 VISIBLE int execve(const char *filename, char *const argv[], char *const envp[])
 {
     DEBUG_PRINT("execve call hijacked: %s\n", filename);
-    execve_func_t execve_orig = dlsym(RTLD_NEXT, "execve");
-    if (!execve_orig) {
-        DEBUG_PRINT("Error getting execve original symbol: %s\n", strerror(errno));
-    }
-
-    return exec_common(execve_orig, filename, argv, envp);
+    STAT_ADD(calls[ENTRY_EXECVE], 1);
+    return exec_common(real_execve, filename, argv, envp, 0);
 }
 
 VISIBLE int execv(const char *filename, char *const argv[]) {
     DEBUG_PRINT("execv call hijacked: %s\n", filename);
-    return execve(filename, argv, environ);
+    STAT_ADD(calls[ENTRY_EXECV], 1);
+    return exec_common(real_execve, filename, argv, environ, 0);
 }
 
 VISIBLE int execvpe(const char *filename, char *const argv[], char *const envp[])
 {
     DEBUG_PRINT("execvpe call hijacked: %s\n", filename);
-    execve_func_t execve_orig = dlsym(RTLD_NEXT, "execvpe");
-    if (!execve_orig) {
-        DEBUG_PRINT("Error getting execvpe original symbol: %s\n", strerror(errno));
-    }
-
-    return exec_common(execve_orig, filename, argv, envp);
+    STAT_ADD(calls[ENTRY_EXECVPE], 1);
+    return exec_common(real_execvpe, filename, argv, envp, 1);
 }
 
 VISIBLE int execvp(const char *filename, char *const argv[]) {
     DEBUG_PRINT("execvp call hijacked: %s\n", filename);
-    return execvpe(filename, argv, environ);
+    STAT_ADD(calls[ENTRY_EXECVP], 1);
+    return exec_common(real_execvpe, filename, argv, environ, 1);
+}
+
+VISIBLE int execl(const char *filename, const char *arg, ...)
+{
+    va_list ap;
+    va_start(ap, arg);
+    char *argv[count_args(arg, &ap) + 1];
+    collect_args(argv, arg, &ap);
+    va_end(ap);
+
+    DEBUG_PRINT("execl call hijacked: %s\n", filename);
+    STAT_ADD(calls[ENTRY_EXECL], 1);
+    return exec_common(real_execve, filename, argv, environ, 0);
+}
+
+VISIBLE int execlp(const char *filename, const char *arg, ...)
+{
+    va_list ap;
+    va_start(ap, arg);
+    char *argv[count_args(arg, &ap) + 1];
+    collect_args(argv, arg, &ap);
+    va_end(ap);
+
+    DEBUG_PRINT("execlp call hijacked: %s\n", filename);
+    STAT_ADD(calls[ENTRY_EXECLP], 1);
+    return exec_common(real_execvpe, filename, argv, environ, 1);
+}
+
+VISIBLE int execle(const char *filename, const char *arg, ...)
+{
+    va_list ap;
+    va_start(ap, arg);
+    char *argv[count_args(arg, &ap) + 1];
+    collect_args(argv, arg, &ap);
+    char *const *envp = va_arg(ap, char *const *);
+    va_end(ap);
+
+    DEBUG_PRINT("execle call hijacked: %s\n", filename);
+    STAT_ADD(calls[ENTRY_EXECLE], 1);
+    return exec_common(real_execve, filename, argv, envp, 0);
+}
+
+VISIBLE int fexecve(int fd, char *const argv[], char *const envp[])
+{
+    DEBUG_PRINT("fexecve call hijacked: %d\n", fd);
+    STAT_ADD(calls[ENTRY_FEXECVE], 1);
+    if (!real_fexecve) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    /* classify the file behind the descriptor through its /proc link */
+    char path[sizeof("/proc/self/fd/") + 3 * sizeof(int)];
+    char digits[3 * sizeof(int)];
+    size_t len = 0;
+    for (unsigned int n = fd; len == 0 || n; n /= 10)
+        digits[len++] = '0' + n % 10;
+    strcpy(path, "/proc/self/fd/");
+    char *p = path + strlen(path);
+    while (len)
+        *p++ = digits[--len];
+    *p = 0;
+
+    char *env[exec_env_size(envp)];
+    char *const *exec_envp = exec_env(path, 0, envp, env);
+    stats_before_exec();
+    int ret = real_fexecve(fd, argv, exec_envp);
+    stats_after_exec();
+    return ret;
+}
+
+VISIBLE int posix_spawn(pid_t *pid, const char *path, const posix_spawn_file_actions_t *file_actions,
+                        const posix_spawnattr_t *attrp, char *const argv[], char *const envp[])
+{
+    DEBUG_PRINT("posix_spawn call hijacked: %s\n", path);
+    STAT_ADD(calls[ENTRY_POSIX_SPAWN], 1);
+    return spawn_common(real_posix_spawn, pid, path, file_actions, attrp, argv, envp, 0);
+}
+
+VISIBLE int posix_spawnp(pid_t *pid, const char *file, const posix_spawn_file_actions_t *file_actions,
+                         const posix_spawnattr_t *attrp, char *const argv[], char *const envp[])
+{
+    DEBUG_PRINT("posix_spawnp call hijacked: %s\n", file);
+    STAT_ADD(calls[ENTRY_POSIX_SPAWNP], 1);
+    return spawn_common(real_posix_spawnp, pid, file, file_actions, attrp, argv, envp, 1);
 }
 
 #ifdef EXEC_TEST
 int main(int argc, char *argv[]) {
+    (void)argc;
     putenv("APPIMAGE_EXEC_DEBUG=1");
     puts("EXEC TEST");
     execv("/bin/true", argv);
@@ -1,9 +1,11 @@
 #! /usr/bin/env bash
 set -e
 
-script="linuxdeploy-plugin-checkrt.sh"
+# output path of the plugin script, relative to the source directory
+script="${1:-linuxdeploy-plugin-checkrt.sh}"
 
 files="checkrt.c
+checkrt.h
 COPYING
 COPYING3
 COPYING.libgcc
@@ -11,10 +13,34 @@ COPYING.libstdc++
 COPYING.RUNTIME
 exec.c"
 
-rm -f $script
+# architectures of the prebuilt binaries and their cross compilers;
+# set CC_<arch> to use another compiler, the native one falls back to cc
+targets="x86_64:x86_64-linux-gnu-gcc
+i686:i686-linux-gnu-gcc
+aarch64:aarch64-linux-gnu-gcc
+armhf:arm-linux-gnueabihf-gcc"
+
+LDFLAGS="-Wl,--as-needed -static-libgcc -ldl -s"
+CFLAGS="-O2"
+
+# newest glibc the prebuilt binaries may require; binaries built against a
+# newer one wouldn't run on older deploy hosts and target systems, so they
+# are skipped and the plugin compiles them at deploy time instead
+GLIBC_MAX="${GLIBC_MAX:-2.27}"
+
+case "$(uname -m)" in
+    i?86) native="i686" ;;
+    armv7*|armv8l) native="armhf" ;;
+    *) native="$(uname -m)" ;;
+esac
+
+tmp="$(mktemp -d)"
+trap 'rm -rf "$tmp"' EXIT
+
+rm -f "$script"
 
 # script header
-cat << EOL > $script
+cat << EOL > "$script"
 #! /usr/bin/env bash
 # This script was automatically generated!
 
@@ -23,20 +49,68 @@ set -e
 EOL
 
 # files
-echo "save_files() {" >> $script
+echo "save_files() {" >> "$script"
 
 for f in $files ; do
-    echo "    cat > "$f" << \__EOF__" >> $script
-    cat $f >> $script
-    echo -e "\n__EOF__\n" >> $script
+    echo "    cat > "$f" << \__EOF__" >> "$script"
+    cat $f >> "$script"
+    echo -e "\n__EOF__\n" >> "$script"
 done
 
-cat << EOL >> $script
+cat << EOL >> "$script"
 }
 # save_files() end
 
 EOL
 
+# highest glibc version required by a binary
+glibc_version() {
+    readelf -W --dyn-syms "$1" | grep -o 'GLIBC_[0-9.]*[0-9]' | cut -d_ -f2 | sort -uV | tail -n1
+}
+
+# prebuilt binaries, gzip compressed and base64 encoded with their SHA-256 checksum
+embed() {
+    echo "    unpack_file $2 $(sha256sum < "$1" | cut -d' ' -f1) << \__EOF__ || return 1" >> "$script"
+    gzip -9n < "$1" | base64 >> "$script"
+    echo -e "__EOF__\n" >> "$script"
+}
+
+for t in $targets ; do
+    arch="${t%%:*}"
+    var="CC_$arch"
+    cc="${!var:-${t#*:}}"
+
+    if ! command -v "$cc" > /dev/null; then
+        if [ "$arch" != "$native" ]; then
+            echo "Skipping $arch: $cc not found"
+            continue
+        fi
+        cc="cc"
+    fi
+
+    echo "Building $arch binaries with $cc"
+    mkdir -p "$tmp/$arch"
+
+    if ! $cc $CFLAGS -pthread checkrt.c -o "$tmp/$arch/checkrt" $LDFLAGS ||
+       ! $cc $CFLAGS -shared -fPIC exec.c -o "$tmp/$arch/exec.so" $LDFLAGS
+    then
+        echo "Skipping $arch: build failed"
+        continue
+    fi
+
+    glibc="$( (glibc_version "$tmp/$arch/checkrt"; glibc_version "$tmp/$arch/exec.so") | sort -V | tail -n1)"
+
+    if [ "$(printf '%s\n' "$glibc" "$GLIBC_MAX" | sort -V | tail -n1)" != "$GLIBC_MAX" ]; then
+        echo "Skipping $arch: binaries require glibc $glibc, newer than $GLIBC_MAX"
+        continue
+    fi
+
+    echo "prebuilt_$arch() {" >> "$script"
+    embed "$tmp/$arch/checkrt" checkrt
+    embed "$tmp/$arch/exec.so" exec.so
+    echo -e "}\n# prebuilt_$arch() end\n" >> "$script"
+done
+
 # main part
-cat template.sh >> $script
-chmod a+x $script
+cat template.sh >> "$script"
+chmod a+x "$script"
@@ -0,0 +1,5603 @@
+#! /usr/bin/env bash
+# This script was automatically generated!
+
+set -e
+
+save_files() {
+    cat > checkrt.c << \__EOF__
+/* Copyright (c) 2022-2025 Carsten Janssen <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <ctype.h>
+#include <dirent.h>
+#ifndef CHECKRT_STATIC
+#include <dlfcn.h>
+#endif
+#include <elf.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <link.h>
+#if __has_include(<linux/fs.h>)
+#include <linux/fs.h>
+#endif
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "checkrt.h"
+
+
+/* enable terminal colors to make the debug
+ * output more pleasent to read */
+#define ENABLE_COLORS 1
+
+
+/* read only the needed parts of ELF files with pread() instead of
+ * mapping the whole file; this avoids page faults and decompression
+ * of unused squashfs blocks on FUSE-mounted AppImages */
+#define ENABLE_PREAD 1
+
+
+/* CHECKRT_STATIC can be defined on the command line to build a static binary
+ * without the dlmopen() fallback and libdl, which saves the dynamic loader's
+ * work at every start; system libraries must then be found through
+ * ld.so.cache or the default directories. It still uses the C library
+ * (stdio included), so its size depends on the one it's linked against;
+ * musl gives a much smaller binary than glibc:
+ * musl-gcc -Os -DCHECKRT_STATIC -static -pthread checkrt.c -o checkrt -s */
+
+
+/* CHECKRT_LIBRARY builds the checkrt_*() functions of checkrt.h without
+ * main(); the helpers of the command line interface are left unused */
+#ifdef CHECKRT_LIBRARY
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+
+
+/* missing in older kernel headers, or without them (musl-gcc) */
+#ifndef FICLONE
+#define FICLONE  _IOW(0x94, 9, int)
+#endif
+
+/* missing in older C library headers */
+#ifndef DF_1_PIE
+#define DF_1_PIE  0x08000000
+#endif
+
+
+/* library names */
+#define LIBGCC_SO  "libgcc_s.so.1"
+#define STDCXX_SO  "libstdc++.so.6"
+
+
+/* decision cache */
+#define CACHE_MAGIC   "checkrt-cache 1"
+#define CACHE_SUBDIR  "checkrt"
+#define LDSO_CACHE    "/etc/ld.so.cache"
+
+
+/* result inherited by processes started from the same AppDir,
+ * see read_token() */
+#define TOKEN_MAGIC  "checkrt-token 1"
+#define TOKEN_ENV    "CHECKRT_TOKEN"
+
+
+/* versions of the bundled libraries, written by --copy */
+#define MANIFEST_MAGIC  "checkrt-manifest 2"
+#define MANIFEST_FILE   "manifest"
+
+
+/* versioned symbols imported by the AppDir, written by --copy if
+ * CHECKRT_PRECISE is set */
+#define SYMBOLS_MAGIC  "checkrt-symbols 1"
+#define SYMBOLS_FILE   "symbols"
+
+
+/* empty file written by --copy if CHECKRT_PRELOAD is set; the AppRun hook
+ * and --exec then preload the bundled libraries instead of prepending
+ * their directories to LD_LIBRARY_PATH */
+#define PRELOAD_FILE   "preload"
+
+
+/* terminal-colors.d(5) */
+#define STR(x) #x
+
+#ifdef ENABLE_COLORS
+#define COL(a, b)  "\033[" STR(a) ";" STR(b) "m%s\033[m"
+#else
+#define COL(...)   "%s"
+#endif
+
+#define BLACK   30
+#define RED     31
+#define GREEN   32
+#define YELLOW  33
+#define BLUE    34
+#define PURPLE  35
+#define CYAN    36
+#define GRAY    37
+
+#define COL_FUNC  COL(0, YELLOW)
+#define COL_LIB   COL(0, PURPLE)
+#define COL_PATH  COL(0, GREEN)
+#define COL_RES   COL(0, CYAN)
+#define COL_SYS   COL(1, RED)
+#define COL_XLIB  COL(1, GREEN)
+
+
+/* debug messages */
+#define DEBUG_PRINT(MSG, ...) \
+    if (debug_mode) { \
+        fprintf(stderr, "[DEBUG] " COL_FUNC ": " MSG "\n", __func__, __VA_ARGS__); \
+    }
+
+
+/* global variables */
+static bool debug_mode = false;
+static bool full_debug_mode = false;
+static FILE *trace_file = NULL;
+
+
+/* monotonic timestamp in nanoseconds, or 0 if tracing is disabled */
+static uint64_t trace_begin()
+{
+    struct timespec ts;
+
+    if (!trace_file) {
+        return 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/* write a string as JSON to the locked trace file */
+static void trace_string(const char *str)
+{
+    if (!str) {
+        fputs_unlocked("null", trace_file);
+        return;
+    }
+
+    putc_unlocked('"', trace_file);
+
+    for (const unsigned char *p = (const unsigned char *)str; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            putc_unlocked('\\', trace_file);
+            putc_unlocked(*p, trace_file);
+        } else if (*p < 0x20) {
+            fprintf(trace_file, "\\u%04x", *p);
+        } else {
+            putc_unlocked(*p, trace_file);
+        }
+    }
+
+    putc_unlocked('"', trace_file);
+}
+
+
+/* Write a JSON line for a phase that started at "start" (from trace_begin())
+ * to CHECKRT_TRACE; the phase name is followed by NULL terminated pairs of
+ * keys and string values, a NULL value is written as null */
+static void trace_event(uint64_t start, const char *phase, ...)
+{
+    va_list ap;
+    const char *key;
+
+    if (!trace_file) {
+        return;
+    }
+
+    uint64_t end = trace_begin();
+
+    flockfile(trace_file);
+    fprintf(trace_file, "{\"ts\":%" PRIu64 ",\"dur\":%" PRIu64 ",\"phase\":\"%s\"", start, end - start, phase);
+
+    va_start(ap, phase);
+
+    while ((key = va_arg(ap, const char *)) != NULL) {
+        const char *value = va_arg(ap, const char *);
+        fprintf(trace_file, ",\"%s\":", key);
+        trace_string(value);
+    }
+
+    va_end(ap);
+
+    fputs_unlocked("}\n", trace_file);
+    funlockfile(trace_file);
+}
+
+
+/* managed runtime libraries, listed in load order (dependencies first) */
+struct runtime_lib {
+    const char *soname;
+    const char *subdir;
+    const char *prefix;
+    bool optional;  /* only copied if the AppDir links against it and it's installed */
+};
+
+static const struct runtime_lib runtime_libs[] = {
+    { LIBGCC_SO,           "gcc",       "GCC_",        false },
+    { STDCXX_SO,           "cxx",       "GLIBCXX_",    false },
+    { "libquadmath.so.0",  "quadmath",  "QUADMATH_",   true },
+    { "libgfortran.so.5",  "gfortran",  "GFORTRAN_",   true },
+    { "libgomp.so.1",      "gomp",      "GOMP_",       true },
+    { "libatomic.so.1",    "atomic",    "LIBATOMIC_",  true }
+};
+
+#define RUNTIME_LIBS_NUM  (sizeof(runtime_libs) / sizeof(runtime_libs[0]))
+
+
+/* part of an ELF file that was read into memory */
+struct elf_region {
+    struct elf_region *next;
+    size_t offset;
+    size_t len;
+    uint8_t data[];
+};
+
+/* opened ELF file */
+struct elf_file {
+    const char *path;
+    size_t size;
+#ifdef ENABLE_PREAD
+    int fd;
+    struct elf_region *regions;
+#else
+    uint8_t *addr;
+#endif
+    ElfW(Ehdr) *ehdr;
+    ElfW(Shdr) *shdr;
+    int error;  /* first error, see elf_fail() */
+};
+
+
+#ifndef CHECKRT_STATIC
+static void errx_dlerror(const char *filename, const char *msg) __attribute__((noreturn));
+static void *load_lib_new_namespace(const char *filename) __attribute__((returns_nonnull));
+#endif
+static void exec_program(const char *dir, char **argv) __attribute__((noreturn));
+static void elf_close(struct elf_file *elf);
+static int strip_library(const char *src, int fd_out, const char *target);
+
+
+
+#ifndef CHECKRT_STATIC
+static void errx_dlerror(const char *filename, const char *msg)
+{
+    const char *p = dlerror();
+
+    if (p) {
+        errx(1, "%s\n%s", msg, p);
+    } else {
+        errx(1, "%s: %s", msg, filename);
+    }
+}
+
+
+/* load library into new namespace;
+ * dlmopen() will also perform compatibility checks for us */
+static void *load_lib_new_namespace(const char *filename)
+{
+    void *handle = dlmopen(LM_ID_NEWLM, filename, RTLD_LAZY);
+
+    if (!handle) {
+        errx_dlerror(filename, "dlmopen() failed to load library");
+    }
+
+    return handle;
+}
+#endif
+
+
+/* ELF header of our own executable, provided by the linker */
+extern const ElfW(Ehdr) __ehdr_start;
+
+
+/* highest EI_ABIVERSION for ELFOSABI_GNU accepted by glibc */
+#define ELF_ABIVERSION_MAX  2
+
+
+/* validate ELF header the same way ld.so does before loading a library;
+ * returns an error message or NULL if the header is fine */
+static const char *check_elf_header(const ElfW(Ehdr) *e)
+{
+    const uint8_t *id = e->e_ident;
+
+    if (memcmp(id, ELFMAG, SELFMAG) != 0) {
+        return "invalid ELF header";
+    }
+
+    if (id[EI_CLASS] != __ehdr_start.e_ident[EI_CLASS]) {
+        return "wrong ELF class";
+    }
+
+    if (id[EI_DATA] != __ehdr_start.e_ident[EI_DATA]) {
+        return "ELF file data encoding not native";
+    }
+
+    if (id[EI_VERSION] != EV_CURRENT || e->e_version != EV_CURRENT) {
+        return "ELF file version does not match current one";
+    }
+
+    if (!(id[EI_OSABI] == ELFOSABI_SYSV && id[EI_ABIVERSION] == 0) &&
+        !(id[EI_OSABI] == ELFOSABI_GNU && id[EI_ABIVERSION] <= ELF_ABIVERSION_MAX))
+    {
+        return "ELF file OS ABI invalid";
+    }
+
+    for (size_t i = EI_PAD; i < EI_NIDENT; i++) {
+        if (id[i] != 0) {
+            return "nonzero padding in e_ident";
+        }
+    }
+
+    if (e->e_machine != __ehdr_start.e_machine) {
+        return "ELF file machine does not match";
+    }
+
+    if (e->e_type != ET_DYN) {
+        return "only ET_DYN can be loaded";
+    }
+
+    if (e->e_phentsize != sizeof(ElfW(Phdr))) {
+        return "ELF file's phentsize not the expected size";
+    }
+
+    return NULL;
+}
+
+
+/* check if a file is an ELF object that could be loaded into our process */
+static bool is_compatible_elf(const char *path)
+{
+    ElfW(Ehdr) e;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1) {
+        return false;
+    }
+
+    ssize_t n = pread(fd, &e, sizeof(e), 0);
+    close(fd);
+
+    return (n == sizeof(e) && check_elf_header(&e) == NULL);
+}
+
+
+/**
+ * Resolve "path" as if "root" was the root directory: symbolic links are
+ * followed component by component and absolute link targets are taken
+ * relative to the root. Returns the malloc'd path including the root, or
+ * NULL if it doesn't exist.
+ */
+static char *resolve_in_root(const char *root, const char *path)
+{
+    char resolved[PATH_MAX], rest[PATH_MAX], target[PATH_MAX], full[PATH_MAX * 2];
+    struct stat st;
+    int links = 0;
+
+    size_t rootlen = strlen(root);
+
+    while (rootlen > 0 && root[rootlen - 1] == '/') {
+        rootlen--;
+    }
+
+    if (strlen(path) >= sizeof(rest)) {
+        return NULL;
+    }
+
+    /* path inside the root, "" is the root itself */
+    resolved[0] = 0;
+    strcpy(rest, path);
+
+    char *p = rest;
+
+    while (*p) {
+        while (*p == '/') {
+            p++;
+        }
+
+        size_t len = strcspn(p, "/");
+
+        if (len == 0 || (len == 1 && p[0] == '.')) {
+            p += len;
+            continue;
+        }
+
+        if (len == 2 && p[0] == '.' && p[1] == '.') {
+            char *slash = strrchr(resolved, '/');
+
+            if (slash) {
+                *slash = 0;
+            }
+
+            p += len;
+            continue;
+        }
+
+        size_t rlen = strlen(resolved);
+
+        if (rlen + len + 2 > sizeof(resolved)) {
+            return NULL;
+        }
+
+        resolved[rlen] = '/';
+        memcpy(resolved + rlen + 1, p, len);
+        resolved[rlen + len + 1] = 0;
+        p += len;
+
+        snprintf(full, sizeof(full), "%.*s%s", (int)rootlen, root, resolved);
+
+        if (lstat(full, &st) == -1) {
+            return NULL;
+        }
+
+        if (!S_ISLNK(st.st_mode)) {
+            continue;
+        }
+
+        ssize_t n = readlink(full, target, sizeof(target) - 1);
+
+        if (n == -1 || ++links > 40 || n + strlen(p) + 1 > sizeof(rest)) {
+            return NULL;
+        }
+
+        /* continue with the link target followed by the unresolved rest */
+        memmove(rest + n, p, strlen(p) + 1);
+        memcpy(rest, target, n);
+        p = rest;
+
+        if (target[0] == '/') {
+            resolved[0] = 0;
+        } else {
+            *strrchr(resolved, '/') = 0;
+        }
+    }
+
+    snprintf(full, sizeof(full), "%.*s%s", (int)rootlen, root, resolved[0] ? resolved : "/");
+
+    return strdup(full);
+}
+
+
+/* return a malloc'd copy of "path", resolved inside "root" unless it's
+ * NULL, or NULL if it isn't a compatible ELF file */
+static char *compatible_path(const char *root, const char *path)
+{
+    char *result = root ? resolve_in_root(root, path) : strdup(path);
+
+    if (result && !is_compatible_elf(result)) {
+        free(result);
+        result = NULL;
+    }
+
+    return result;
+}
+
+
+/* look for library in a colon or semicolon separated list of directories,
+ * inside "root" unless it's NULL */
+static char *search_dirs(const char *root, const char *list, const char *filename)
+{
+    char *copy = strdup(list);
+    char *save = NULL;
+    char *result = NULL;
+
+    for (char *p = strtok_r(copy, ":;", &save); p && !result; p = strtok_r(NULL, ":;", &save)) {
+        char *path = malloc(strlen(p) + strlen(filename) + 2);
+        sprintf(path, "%s/%s", p, filename);
+
+        if (root) {
+            result = compatible_path(root, path);
+        } else if (is_compatible_elf(path)) {
+            result = realpath(path, NULL);
+        }
+
+        free(path);
+    }
+
+    free(copy);
+
+    return result;
+}
+
+
+/**
+ * ld.so.cache formats, see glibc's sysdeps/generic/dl-cache.h
+ *
+ * The old format starts with "ld.so-1.7.0", followed by the number of entries
+ * and the entries. String offsets are relative to the end of the entries.
+ * Caches in the old format may be followed by a cache in the new format.
+ *
+ * The new format starts with "glibc-ld.so.cache1.1". String offsets are
+ * relative to the start of the new format header.
+ */
+#define LDCACHE_MAGIC_OLD  "ld.so-1.7.0"
+#define LDCACHE_MAGIC_NEW  "glibc-ld.so.cache1.1"
+
+#define LDCACHE_FLAG_TYPE_MASK  0x00ff
+#define LDCACHE_FLAG_ELF_LIBC6  0x0003
+
+struct ldcache_old {
+    char magic[sizeof(LDCACHE_MAGIC_OLD) - 1];
+    uint32_t nlibs;
+};
+
+struct ldcache_entry_old {
+    int32_t flags;
+    uint32_t key, value;
+};
+
+struct ldcache_new {
+    char magic[sizeof(LDCACHE_MAGIC_NEW) - 1];
+    uint32_t nlibs;
+    uint32_t len_strings;
+    uint8_t flags;
+    uint8_t padding[3];
+    uint32_t extension_offset;
+    uint32_t unused[3];
+};
+
+struct ldcache_entry_new {
+    int32_t flags;
+    uint32_t key, value;
+    uint32_t osversion;
+    uint64_t hwcap;
+};
+
+
+/* get NUL-terminated string from the cache, or NULL if out of bounds */
+static const char *ldcache_string(const char *data, size_t len, uint32_t offset)
+{
+    if (offset >= len || !memchr(data + offset, 0, len - offset)) {
+        return NULL;
+    }
+
+    return data + offset;
+}
+
+
+/* look up library in a mapped ld.so.cache file */
+static char *ldcache_lookup(const char *cache, size_t len, const char *root, const char *filename, bool *known_format)
+{
+    const struct ldcache_new *hdr = NULL;
+    char *path;
+    size_t off = 0;
+
+    if (len >= sizeof(struct ldcache_old) &&
+        memcmp(cache, LDCACHE_MAGIC_OLD, sizeof(LDCACHE_MAGIC_OLD) - 1) == 0)
+    {
+        const struct ldcache_old *old = (const void *)cache;
+        off = sizeof(struct ldcache_old) + (size_t)old->nlibs * sizeof(struct ldcache_entry_old);
+
+        if (off > len) {
+            return NULL;
+        }
+
+        /* prefer the new format if it's appended */
+        size_t off_new = (off + __alignof__(struct ldcache_new) - 1) & ~(__alignof__(struct ldcache_new) - 1);
+
+        if (off_new + sizeof(struct ldcache_new) <= len &&
+            memcmp(cache + off_new, LDCACHE_MAGIC_NEW, sizeof(LDCACHE_MAGIC_NEW) - 1) == 0)
+        {
+            off = off_new;
+            hdr = (const void *)(cache + off);
+        } else {
+            *known_format = true;
+            const struct ldcache_entry_old *e = (const void *)(cache + sizeof(struct ldcache_old));
+
+            for (uint32_t i = 0; i < old->nlibs; i++, e++) {
+                const char *key = ldcache_string(cache + off, len - off, e->key);
+                const char *value = ldcache_string(cache + off, len - off, e->value);
+
+                if ((e->flags & LDCACHE_FLAG_TYPE_MASK) == LDCACHE_FLAG_ELF_LIBC6 &&
+                    key && value && strcmp(key, filename) == 0 && (path = compatible_path(root, value)) != NULL)
+                {
+                    return path;
+                }
+            }
+
+            return NULL;
+        }
+    } else if (len >= sizeof(struct ldcache_new) &&
+               memcmp(cache, LDCACHE_MAGIC_NEW, sizeof(LDCACHE_MAGIC_NEW) - 1) == 0)
+    {
+        hdr = (const void *)cache;
+    } else {
+        return NULL;
+    }
+
+    *known_format = true;
+
+    if (off + sizeof(struct ldcache_new) + (size_t)hdr->nlibs * sizeof(struct ldcache_entry_new) > len) {
+        return NULL;
+    }
+
+    const struct ldcache_entry_new *e = (const void *)(cache + off + sizeof(struct ldcache_new));
+
+    for (uint32_t i = 0; i < hdr->nlibs; i++, e++) {
+        const char *key = ldcache_string(cache + off, len - off, e->key);
+        const char *value = ldcache_string(cache + off, len - off, e->value);
+
+        /* entries with hwcap bits set point into glibc-hwcaps subdirectories
+         * which would require the same ISA checks as the loader; skip them */
+        if ((e->flags & LDCACHE_FLAG_TYPE_MASK) == LDCACHE_FLAG_ELF_LIBC6 && e->hwcap == 0 &&
+            key && value && strcmp(key, filename) == 0 && (path = compatible_path(root, value)) != NULL)
+        {
+            return path;
+        }
+    }
+
+    return NULL;
+}
+
+
+/* look for library in the trusted default directories of ld.so */
+static char *search_default_dirs(const char *root, const char *filename)
+{
+#if defined(__LP64__) || defined(_LP64)
+    return search_dirs(root, "/lib64:/usr/lib64:/lib:/usr/lib", filename);
+#else
+    return search_dirs(root, "/lib:/usr/lib", filename);
+#endif
+}
+
+
+/**
+ * Resolve library path without loading it, in the same order as ld.so:
+ * LD_LIBRARY_PATH, /etc/ld.so.cache, trusted default directories.
+ * If "root" is not NULL the library is resolved inside that system root,
+ * LD_LIBRARY_PATH is ignored and a missing or unknown ld.so.cache falls
+ * back to the default directories since there is no dlmopen() fallback.
+ * Returns NULL if the path could not be resolved reliably.
+ */
+static char *resolve_library_path(const char *root, const char *filename)
+{
+    struct stat st;
+    char *path = NULL;
+    bool known_format = false;
+
+    const char *env = root ? NULL : getenv("LD_LIBRARY_PATH");
+
+    if (env && *env && (path = search_dirs(NULL, env, filename)) != NULL) {
+        return path;
+    }
+
+    char *ldso_cache = malloc((root ? strlen(root) : 0) + sizeof(LDSO_CACHE));
+    sprintf(ldso_cache, "%s" LDSO_CACHE, root ? root : "");
+
+    int fd = open(ldso_cache, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1) {
+        DEBUG_PRINT("cannot open: " COL_PATH, ldso_cache);
+        free(ldso_cache);
+        return root ? search_default_dirs(root, filename) : NULL;
+    }
+
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *cache = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (cache != MAP_FAILED) {
+            path = ldcache_lookup(cache, st.st_size, root, filename, &known_format);
+            munmap(cache, st.st_size);
+        }
+    }
+
+    close(fd);
+
+    if (!known_format) {
+        DEBUG_PRINT("unknown file format: " COL_PATH, ldso_cache);
+        free(ldso_cache);
+        return root ? search_default_dirs(root, filename) : NULL;
+    }
+
+    free(ldso_cache);
+
+    return path ? path : search_default_dirs(root, filename);
+}
+
+
+#ifndef CHECKRT_STATIC
+/* retrieve full path of library by loading it with dlmopen() */
+static char *dlmopen_library_path(const char *filename, bool optional)
+{
+    struct link_map *map = NULL;
+    void *handle;
+    char *path;
+
+    uint64_t start = trace_begin();
+
+    if (optional) {
+        if ((handle = dlmopen(LM_ID_NEWLM, filename, RTLD_LAZY)) == NULL) {
+            trace_event(start, "resolve", "lib", filename, "path", NULL, "method", "dlmopen", NULL);
+            return NULL;
+        }
+    } else {
+        handle = load_lib_new_namespace(filename);
+    }
+
+    if (dlinfo(handle, RTLD_DI_LINKMAP, &map) == -1 || !map->l_name || map->l_name[0] == 0) {
+        if (!optional) {
+            errx(1, "%s: %s", filename, "dlinfo() failed to get absolute pathname");
+        }
+
+        DEBUG_PRINT("dlinfo() failed to get absolute pathname of " COL_LIB, filename);
+        dlclose(handle);
+        trace_event(start, "resolve", "lib", filename, "path", NULL, "method", "dlmopen", NULL);
+        return NULL;
+    }
+
+    path = strdup(map->l_name);
+    DEBUG_PRINT(COL_LIB " resolved by dlmopen() to: " COL_PATH, filename, path);
+
+    dlclose(handle);
+    trace_event(start, "resolve", "lib", filename, "path", path, "method", "dlmopen", NULL);
+
+    return path;
+}
+#endif
+
+
+/* retrieve full path of system library; if "optional" is true
+ * NULL is returned instead of exiting if it can't be found */
+static char *get_system_library_path(const char *filename, bool optional)
+{
+    uint64_t start = trace_begin();
+    char *path = resolve_library_path(NULL, filename);
+
+    if (path) {
+        DEBUG_PRINT(COL_LIB " resolved to: " COL_PATH, filename, path);
+        trace_event(start, "resolve", "lib", filename, "path", path, "method", "search", NULL);
+        return path;
+    }
+
+#ifdef CHECKRT_STATIC
+    trace_event(start, "resolve", "lib", filename, "path", NULL, "method", "search", NULL);
+
+    if (!optional) {
+        errx(1, "%s: %s", filename, "cannot resolve library path");
+    }
+
+    return NULL;
+#else
+    return dlmopen_library_path(filename, optional);
+#endif
+}
+
+
+/* copy file content, preferably without passing the data through userspace;
+ * each method continues at the file offsets where the previous one stopped */
+static void copy_file_data(int fd_in, int fd_out, off_t size, const char *src, const char *target)
+{
+    ssize_t n;
+    off_t copied = 0;
+
+    /* reflink, shares the data blocks on filesystems like btrfs or XFS */
+    if (ioctl(fd_out, FICLONE, fd_in) == 0) {
+        return;
+    }
+
+    /* in-kernel copy */
+    while (copied < size && (n = copy_file_range(fd_in, NULL, fd_out, NULL, size - copied, 0)) > 0) {
+        copied += n;
+    }
+
+    while (copied < size && (n = sendfile(fd_out, fd_in, NULL, size - copied)) > 0) {
+        copied += n;
+    }
+
+    if (copied == size) {
+        return;
+    }
+
+    /* copy through a buffer as last resort */
+    const size_t bufsize = 512*1024;
+    uint8_t *buf = malloc(bufsize);
+
+    while ((n = read(fd_in, buf, bufsize)) != 0) {
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            err(1, "error reading from file: %s", src);
+        }
+
+        /* handle partial writes */
+        for (ssize_t off = 0; off < n; ) {
+            ssize_t rv = write(fd_out, buf + off, n - off);
+
+            if (rv == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                err(1, "error writing to file: %s", target);
+            }
+
+            off += rv;
+        }
+    }
+
+    free(buf);
+}
+
+
+/* copy library from system into directory next to binary and return the
+ * path of the copy, or NULL if the library wasn't found; if "strip" is true
+ * the sections not needed at runtime are removed */
+static char *copy_lib(const char *dir, const struct runtime_lib *lib, bool strip)
+{
+    struct stat st;
+    int fd_in, fd_out;
+
+    /* find library */
+    char *src = get_system_library_path(lib->soname, lib->optional);
+
+    if (!src) {
+        printf("Library not found, skipping: %s\n", lib->soname);
+        return NULL;
+    }
+
+    printf("Copy library: %s\n", src);
+
+    /* create target directory */
+    char *target = malloc(strlen(dir) + strlen(lib->subdir) + strlen(lib->soname) + 3);
+    sprintf(target, "%s/%s/", dir, lib->subdir);
+    mkdir(target, 0775);
+
+    /* open source file for reading */
+    if ((fd_in = open(src, O_RDONLY | O_CLOEXEC)) < 0) {
+        err(1, "cannot open file for reading: %s", src);
+    }
+
+    if (fstat(fd_in, &st) == -1) {
+        err(1, "fstat(): %s", src);
+    }
+
+    /* open target file for writing */
+    strcat(target, lib->soname);
+
+    if ((fd_out = open(target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0664)) < 0) {
+        err(1, "cannot open file for writing: %s", target);
+    }
+
+    copy_file_data(fd_in, fd_out, st.st_size, src, target);
+
+    if (strip && strip_library(src, fd_out, target) < 0) {
+        printf("Cannot strip library, keeping full copy: %s\n", target);
+    }
+
+    /* preserve file mode */
+    if (fchmod(fd_out, st.st_mode & 07777) == -1) {
+        warn("fchmod(): %s", target);
+    }
+
+    /* free resources */
+    if (close(fd_out) == -1) {
+        err(1, "error writing to file: %s", target);
+    }
+
+    close(fd_in);
+    free(src);
+
+    return target;
+}
+
+
+/* remove a copy of a library left from a previous run */
+static void remove_lib(const char *dir, const struct runtime_lib *lib)
+{
+    char *path = malloc(strlen(dir) + strlen(lib->subdir) + strlen(lib->soname) + 3);
+    sprintf(path, "%s/%s/%s", dir, lib->subdir, lib->soname);
+
+    if (unlink(path) == 0) {
+        printf("Removed library: %s\n", path);
+    }
+
+    /* the directory is removed only if it's empty */
+    *strrchr(path, '/') = 0;
+    rmdir(path);
+
+    free(path);
+}
+
+
+/* remember the first error of an ELF file and return NULL; the callers
+ * pass NULL on and the error is returned once parsing has stopped */
+static void *elf_fail(struct elf_file *elf, int error, const char *msg)
+{
+    DEBUG_PRINT("%s: %s", elf->path, msg);
+
+    if (elf->error == CHECKRT_OK) {
+        elf->error = error;
+    }
+
+    return NULL;
+}
+
+
+#ifdef ENABLE_PREAD
+
+/* get "len" bytes at "offset"; only the requested range is read from the file
+ * unless it's already covered by a previous read */
+static void *get_offset(struct elf_file *elf, ElfW(Off) offset, size_t len)
+{
+    if (offset > elf->size || len > elf->size - offset) {
+        return elf_fail(elf, CHECKRT_EFORMAT, "*** offset exceeds filesize ***");
+    }
+
+    for (struct elf_region *r = elf->regions; r != NULL; r = r->next) {
+        if (offset >= r->offset && offset + len <= r->offset + r->len) {
+            return r->data + (offset - r->offset);
+        }
+    }
+
+    struct elf_region *r = malloc(sizeof(struct elf_region) + len + 1);
+    r->offset = offset;
+    r->len = len;
+
+    for (size_t n = 0; n < len; ) {
+        ssize_t rv = pread(elf->fd, r->data + n, len - n, offset + n);
+
+        if (rv < 1) {
+            free(r);
+            return elf_fail(elf, CHECKRT_EIO, "pread() failed");
+        }
+
+        n += rv;
+    }
+
+    r->next = elf->regions;
+    elf->regions = r;
+
+    return r->data;
+}
+
+#else
+
+/* perform filesize check and get offset */
+static void *get_offset(struct elf_file *elf, ElfW(Off) offset, size_t len)
+{
+    if (offset > elf->size || len > elf->size - offset) {
+        return elf_fail(elf, CHECKRT_EFORMAT, "*** offset exceeds filesize ***");
+    }
+
+    return (elf->addr + offset);
+}
+
+#endif /* !ENABLE_PREAD */
+
+
+/* get NUL-terminated string from a string table; NULL on error */
+static const char *get_string(struct elf_file *elf, const ElfW(Shdr) *strtab, size_t index)
+{
+    if (index >= strtab->sh_size) {
+        return elf_fail(elf, CHECKRT_EFORMAT, "*** string offset exceeds section size ***");
+    }
+
+    size_t max = strtab->sh_size - index;
+
+    /* version and section names are short */
+    for (size_t len = (max < 64) ? max : 64; ; len = (max < len * 8) ? max : len * 8) {
+        const char *str = get_offset(elf, strtab->sh_offset + index, len);
+
+        if (!str || memchr(str, 0, len)) {
+            return str;
+        }
+
+        if (len == max) {
+            return elf_fail(elf, CHECKRT_EFORMAT, "*** unterminated string ***");
+        }
+    }
+}
+
+
+/* value is stored in shdr[0].sh_size if it's too large */
+static size_t get_shnum(const struct elf_file *elf) {
+    if (!elf->shdr) {
+        return 0;
+    }
+
+    return (elf->ehdr->e_shnum == 0) ? elf->shdr[0].sh_size : elf->ehdr->e_shnum;
+}
+
+
+/* value is stored in shdr[0].sh_link if it's too large */
+static size_t get_shstrndx(const struct elf_file *elf) {
+    return (elf->ehdr->e_shstrndx == SHN_XINDEX) ? elf->shdr[0].sh_link : elf->ehdr->e_shstrndx;
+}
+
+
+/* get section header by name */
+static ElfW(Shdr) *get_shdr(struct elf_file *elf, ElfW(Word) type, const char *name)
+{
+    ElfW(Shdr) *shdr = elf->shdr;
+    size_t shnum = get_shnum(elf);
+
+    if (shnum == 0) {
+        return NULL;
+    }
+
+    size_t shstrndx = get_shstrndx(elf);
+
+    if (shstrndx == 0 || shstrndx >= shnum) {
+        return NULL;
+    }
+
+    ElfW(Shdr) *strtab = &shdr[shstrndx];
+
+    /* section names are read one after another */
+    if (!get_offset(elf, strtab->sh_offset, strtab->sh_size)) {
+        return NULL;
+    }
+
+    for (size_t i = 1; i < shnum; i++) {
+        if (shdr[i].sh_type != type) {
+            continue;
+        }
+
+        const char *ptr = get_string(elf, strtab, shdr[i].sh_name);
+
+        if (!ptr) {
+            return NULL;
+        }
+
+        if (strcmp(ptr, name) == 0) {
+            return &shdr[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/* check the PT_DYNAMIC segment in the program headers;
+ * returns an error message or NULL if it's fine */
+static const char *check_dynamic_segment(struct elf_file *elf)
+{
+    const ElfW(Ehdr) *ehdr = elf->ehdr;
+    size_t phsize = (size_t)ehdr->e_phnum * sizeof(ElfW(Phdr));
+
+    if (ehdr->e_phoff == 0 || ehdr->e_phoff > elf->size || phsize > elf->size - ehdr->e_phoff) {
+        return "cannot read program headers";
+    }
+
+    ElfW(Phdr) *phdr = get_offset(elf, ehdr->e_phoff, phsize);
+
+    if (!phdr) {
+        return "cannot read program headers";
+    }
+
+    for (size_t i = 0; i < ehdr->e_phnum; i++) {
+        if (phdr[i].p_type != PT_DYNAMIC) {
+            continue;
+        }
+
+        if (phdr[i].p_offset > elf->size || phdr[i].p_filesz > elf->size - phdr[i].p_offset) {
+            return "cannot read dynamic section";
+        }
+
+        ElfW(Dyn) *dyn = get_offset(elf, phdr[i].p_offset, phdr[i].p_filesz);
+
+        if (!dyn) {
+            return "cannot read dynamic section";
+        }
+
+        for (size_t j = 0; j < phdr[i].p_filesz / sizeof(ElfW(Dyn)) && dyn[j].d_tag != DT_NULL; j++) {
+            if (dyn[j].d_tag == DT_FLAGS_1 && (dyn[j].d_un.d_val & DF_1_PIE)) {
+                return "cannot dynamically load position-independent executable";
+            }
+        }
+
+        return NULL;
+    }
+
+    return "object has no dynamic section";
+}
+
+
+/* get dynamic entry value by tag */
+static size_t get_dyn_val(struct elf_file *elf, ElfW(Shdr) *dynamic, ElfW(Sword) tag)
+{
+    if (dynamic->sh_size == 0 || dynamic->sh_entsize == 0) {
+        return 0;
+    }
+
+    ElfW(Dyn) *dyn = get_offset(elf, dynamic->sh_offset, dynamic->sh_size);
+
+    for (size_t i = 0; dyn && i < (dynamic->sh_size / dynamic->sh_entsize); i++, dyn++) {
+        if (dyn->d_tag == tag) {
+            return dyn->d_un.d_val;
+        }
+    }
+
+    return 0;
+}
+
+
+static bool is_prefixed_and_higher_version(const char *new, const char *old, const char *prefix, size_t pfxlen)
+{
+    return (strncmp(new, prefix, pfxlen) == 0 &&  /* symbol name starts with prefix */
+            isdigit(*(new + pfxlen)) &&           /* first byte after prefix is a digit */
+            (!old || strverscmp(old, new) < 0));  /* get higher version string */
+}
+
+
+/**
+ * Find symbol in SHT_GNU_verdef section
+ * https://refspecs.linuxfoundation.org/LSB_3.0.0/LSB-PDA/LSB-PDA.junk/symversion.html
+ *
+ * Parse the .dynamic section and look for the entry with the DT_VERDEFNUM flag.
+ * Its value holds the number of entries in the SHT_GNU_verdef section.
+ *
+ * Get the sh_link entry from the SHT_GNU_verdef section header. Its value is
+ * the index number of the section header pointing to the section that holds the
+ * version definition strings.
+ *
+ * Parse the Elfxx_Verdef arrays in the SHT_GNU_verdef section. The value
+ * vd_next holds a relative offset to the next Elfxx_Verdef array.
+ *
+ * The Elfxx_Verdef arrays will have one or more Elfxx_Verdaux arrays associated
+ * to them. The entry vd_aux is a relative offset to that array.
+ *
+ * The first Elfxx_Verdaux array holds information to the latest version string.
+ * It's a relative offset into the section previously obtained from the sh_link
+ * entry and points to a NUL-termintated string.
+ *
+ * Returns NULL if there is no version with the prefix or on errors,
+ * which are set in "elf".
+ */
+static char *find_symbol(struct elf_file *elf, const char *prefix)
+{
+    size_t verdefnum;
+
+    /* get numbers of .gnu.version_d entries from .dynamic's DT_VERDEFNUM entry */
+    ElfW(Shdr) *dynamic = get_shdr(elf, SHT_DYNAMIC, ".dynamic");
+
+    if (!dynamic || (verdefnum = get_dyn_val(elf, dynamic, DT_VERDEFNUM)) == 0) {
+        return NULL;
+    }
+
+    /* get link to section that holds the strings referenced
+     * by .gnu.version_d section */
+    ElfW(Shdr) *verdef = get_shdr(elf, SHT_GNU_verdef, ".gnu.version_d");
+
+    if (!verdef || verdef->sh_link >= get_shnum(elf)) {
+        return NULL;
+    }
+
+    ElfW(Shdr) *strings = &elf->shdr[verdef->sh_link];
+
+    /* read the whole section at once */
+    get_offset(elf, verdef->sh_offset, verdef->sh_size);
+
+    /* version strings are usually placed next to each other;
+     * read the range that covers all of them at once too */
+    ElfW(Off) vd_off = verdef->sh_offset;
+    size_t str_min = SIZE_MAX, str_max = 0;
+
+    for (size_t i = 0; i < verdefnum; i++) {
+        ElfW(Verdef) *vd = get_offset(elf, vd_off, sizeof(ElfW(Verdef)));
+
+        if (!vd) {
+            return NULL;
+        }
+
+        if (vd->vd_aux >= sizeof(ElfW(Verdef))) {
+            ElfW(Verdaux) *vda = get_offset(elf, vd_off + vd->vd_aux, sizeof(ElfW(Verdaux)));
+
+            if (!vda) {
+                return NULL;
+            }
+
+            str_min = (vda->vda_name < str_min) ? vda->vda_name : str_min;
+            str_max = (vda->vda_name > str_max) ? vda->vda_name : str_max;
+        }
+
+        vd_off += vd->vd_next;
+    }
+
+    if (str_min < strings->sh_size) {
+        size_t end = (str_max + 64 < strings->sh_size) ? str_max + 64 : strings->sh_size;
+        get_offset(elf, strings->sh_offset + str_min, end - str_min);
+    }
+
+    /* parse .gnu.version_d section */
+    const char *symbol = NULL;
+    const size_t pfxlen = strlen(prefix);
+    vd_off = verdef->sh_offset;
+
+    for (size_t i = 0; i < verdefnum; i++) {
+        ElfW(Verdef) *vd = get_offset(elf, vd_off, sizeof(ElfW(Verdef)));
+
+        if (!vd) {
+            return NULL;
+        }
+
+        if (vd->vd_version == 1 &&               /* must be 1 */
+            vd->vd_flags != VER_FLG_BASE &&      /* skip library name entry */
+            vd->vd_aux >= sizeof(ElfW(Verdef)))  /* placed after ElfW(Verdef) array */
+        {
+            /* get only the latest version instead of iterating all ElfXX_Verdaux entries */
+            ElfW(Verdaux) *vda = get_offset(elf, vd_off + vd->vd_aux, sizeof(ElfW(Verdaux)));
+            const char *name = vda ? get_string(elf, strings, vda->vda_name) : NULL;
+
+            if (!name) {
+                return NULL;
+            }
+
+            if (is_prefixed_and_higher_version(name, symbol, prefix, pfxlen)) {
+                if (full_debug_mode) {
+                    DEBUG_PRINT(COL_RES, name);
+                }
+
+                symbol = name;
+            }
+        }
+
+        vd_off += vd->vd_next;
+    }
+
+    return symbol ? strdup(symbol) : NULL;
+}
+
+
+/* open ELF file and read its headers; if "library" is true the same
+ * compatibility checks as ld.so are done, otherwise files that aren't
+ * native ELF files are rejected without a message; returns CHECKRT_OK
+ * or an error code, in which case nothing needs to be closed */
+static int elf_open(struct elf_file *elf, const char *path, bool library)
+{
+    struct stat st;
+    int fd;
+
+    memset(elf, 0, sizeof(struct elf_file));
+    elf->path = path;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+        if (library) {
+            DEBUG_PRINT("cannot open: " COL_PATH, path);
+        }
+
+        return (errno == ENOENT) ? CHECKRT_ENOTFOUND : CHECKRT_EIO;
+    }
+
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return CHECKRT_EIO;
+    }
+
+    elf->size = st.st_size;
+
+    if (elf->size < sizeof(ElfW(Ehdr))) {
+        if (library) {
+            DEBUG_PRINT("file too short: " COL_PATH, path);
+        }
+
+        close(fd);
+        return CHECKRT_EFORMAT;
+    }
+
+#ifdef ENABLE_PREAD
+    elf->fd = fd;
+#else
+    elf->addr = mmap(NULL, elf->size, PROT_READ, MAP_SHARED, fd, 0);
+
+    /* file descriptor can now be closed */
+    close(fd);
+
+    if (elf->addr == MAP_FAILED) {
+        return CHECKRT_EIO;
+    }
+#endif
+
+    if ((elf->ehdr = get_offset(elf, 0, sizeof(ElfW(Ehdr)))) == NULL) {
+        elf_close(elf);
+        return elf->error;
+    }
+
+    if (library) {
+        const char *errmsg = check_elf_header(elf->ehdr);
+
+        if (!errmsg) {
+            errmsg = check_dynamic_segment(elf);
+        }
+
+        if (errmsg) {
+            elf_fail(elf, CHECKRT_EFORMAT, errmsg);
+            elf_close(elf);
+            return elf->error;
+        }
+    } else if (memcmp(elf->ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+               elf->ehdr->e_ident[EI_CLASS] != __ehdr_start.e_ident[EI_CLASS] ||
+               elf->ehdr->e_ident[EI_DATA] != __ehdr_start.e_ident[EI_DATA] ||
+               elf->ehdr->e_machine != __ehdr_start.e_machine)
+    {
+        elf_close(elf);
+        return CHECKRT_EFORMAT;
+    }
+
+    /* read section header table */
+    if (elf->ehdr->e_shoff == 0 || elf->ehdr->e_shentsize != sizeof(ElfW(Shdr))) {
+        return CHECKRT_OK;
+    }
+
+    /* the number of sections is stored in the first section header if it's too large */
+    size_t shnum = (elf->ehdr->e_shnum > 0) ? elf->ehdr->e_shnum : 1;
+    elf->shdr = get_offset(elf, elf->ehdr->e_shoff, shnum * sizeof(ElfW(Shdr)));
+    shnum = get_shnum(elf);
+
+    if (elf->shdr && shnum > (elf->size - elf->ehdr->e_shoff) / sizeof(ElfW(Shdr))) {
+        elf_fail(elf, CHECKRT_EFORMAT, "*** section header table exceeds filesize ***");
+    } else if (elf->shdr && elf->ehdr->e_shnum == 0 && shnum > 1) {
+        elf->shdr = get_offset(elf, elf->ehdr->e_shoff, shnum * sizeof(ElfW(Shdr)));
+    }
+
+    if (elf->error != CHECKRT_OK) {
+        elf_close(elf);
+        return elf->error;
+    }
+
+    return CHECKRT_OK;
+}
+
+
+static void elf_close(struct elf_file *elf)
+{
+#ifdef ENABLE_PREAD
+    while (elf->regions) {
+        struct elf_region *next = elf->regions->next;
+        free(elf->regions);
+        elf->regions = next;
+    }
+
+    close(elf->fd);
+#else
+    if (munmap(elf->addr, elf->size) == -1) {
+        DEBUG_PRINT("%s", "munmap() returned with an error");
+    }
+#endif
+}
+
+
+/* open library and look for symbol by prefix; "version" is set to
+ * NULL if there is none; returns CHECKRT_OK or an error code */
+static int symbol_version(const char *path, const char *prefix, const char *msg, char **version)
+{
+    struct elf_file elf;
+
+    *version = NULL;
+
+    uint64_t start = trace_begin();
+    int rv = elf_open(&elf, path, true);
+    trace_event(start, "elf_open", "path", path, "kind", msg, NULL);
+
+    if (rv != CHECKRT_OK) {
+        return rv;
+    }
+
+    /* look for symbol */
+    DEBUG_PRINT("searching " COL_XLIB " library: " COL_PATH, msg, path);
+
+    start = trace_begin();
+    char *symbol = find_symbol(&elf, prefix);
+    trace_event(start, "find_symbol", "path", path, "kind", msg, "version", symbol, NULL);
+
+    if (symbol) {
+        DEBUG_PRINT("symbol " COL_RES " found in " COL_PATH, symbol, path);
+    }
+
+    start = trace_begin();
+    elf_close(&elf);
+    trace_event(start, "elf_close", "path", path, "kind", msg, NULL);
+
+    if (elf.error != CHECKRT_OK) {
+        free(symbol);
+        return elf.error;
+    }
+
+    *version = symbol;
+
+    return CHECKRT_OK;
+}
+
+
+/* write "len" bytes at "offset"; errors are fatal */
+static void write_at(int fd, const void *buf, size_t len, off_t offset, const char *target)
+{
+    for (size_t n = 0; n < len; ) {
+        ssize_t rv = pwrite(fd, (const uint8_t *)buf + n, len - n, offset + n);
+
+        if (rv == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            err(1, "error writing to file: %s", target);
+        }
+
+        n += rv;
+    }
+}
+
+
+/**
+ * Strip a copied library in place: everything the dynamic loader and
+ * find_symbol() need (the ELF and program headers, the loadable segments
+ * and the SHF_ALLOC sections like .dynamic, .dynsym, .dynstr, .gnu.hash
+ * and .gnu.version*) is placed at the beginning of the file by the linker.
+ * The copy is truncated after that and a new .shstrtab and a section header
+ * table with only the SHF_ALLOC sections are appended. This removes .symtab,
+ * .strtab, .comment, .gnu_debuglink, DWARF sections and the like.
+ *
+ * "src" is the original file, "fd_out" the copy. Returns 1 if the copy
+ * was stripped, 0 if there was nothing to remove (e.g. the library is
+ * already stripped) and -1 if the file layout isn't understood; the copy
+ * isn't changed in the last two cases.
+ */
+static int strip_library(const char *src, int fd_out, const char *target)
+{
+    struct elf_file elf;
+
+    if (elf_open(&elf, src, true) != CHECKRT_OK) {
+        return -1;
+    }
+
+    ElfW(Ehdr) ehdr = *elf.ehdr;
+    size_t shnum = get_shnum(&elf);
+    size_t shstrndx = elf.shdr ? get_shstrndx(&elf) : 0;
+
+    /* no section headers at all, nothing to remove */
+    if (ehdr.e_shoff == 0 && ehdr.e_shnum == 0) {
+        elf_close(&elf);
+        return 0;
+    }
+
+    /* extended section numbering is not handled */
+    if (!elf.shdr || ehdr.e_shnum == 0 || shstrndx == 0 || shstrndx >= shnum) {
+        elf_close(&elf);
+        return -1;
+    }
+
+    ElfW(Phdr) *phdr = get_offset(&elf, ehdr.e_phoff, (size_t)ehdr.e_phnum * sizeof(ElfW(Phdr)));
+    size_t end = ehdr.e_phoff + (size_t)ehdr.e_phnum * sizeof(ElfW(Phdr));
+
+    for (size_t i = 0; phdr && i < ehdr.e_phnum; i++) {
+        if (phdr[i].p_filesz > 0 && phdr[i].p_offset + phdr[i].p_filesz > end) {
+            end = phdr[i].p_offset + phdr[i].p_filesz;
+        }
+    }
+
+    /* new section indices, section names and headers */
+    size_t *map = calloc(shnum, sizeof(size_t));
+    ElfW(Shdr) *shdr = calloc(shnum + 1, sizeof(ElfW(Shdr)));
+    char *names = calloc(1, 1);
+    size_t count = 1, names_len = 1;
+
+    for (size_t i = 1; i < shnum && elf.error == CHECKRT_OK; i++) {
+        const ElfW(Shdr) *sh = &elf.shdr[i];
+
+        if (!(sh->sh_flags & SHF_ALLOC)) {
+            continue;
+        }
+
+        const char *name = get_string(&elf, &elf.shdr[shstrndx], sh->sh_name);
+
+        if (!name) {
+            break;
+        }
+
+        if (sh->sh_type != SHT_NOBITS && sh->sh_offset + sh->sh_size > end) {
+            end = sh->sh_offset + sh->sh_size;
+        }
+
+        names = realloc(names, names_len + strlen(name) + 1);
+        strcpy(names + names_len, name);
+
+        map[i] = count;
+        shdr[count] = *sh;
+        shdr[count].sh_name = names_len;
+        names_len += strlen(name) + 1;
+        count++;
+    }
+
+    if (elf.error != CHECKRT_OK || end >= elf.size) {
+        /* error or nothing to remove */
+        int rv = (elf.error != CHECKRT_OK) ? -1 : 0;
+        free(map);
+        free(shdr);
+        free(names);
+        elf_close(&elf);
+        return rv;
+    }
+
+    /* section indices in sh_link and sh_info */
+    for (size_t i = 1; i < count; i++) {
+        shdr[i].sh_link = (shdr[i].sh_link < shnum) ? map[shdr[i].sh_link] : 0;
+
+        if ((shdr[i].sh_flags & SHF_INFO_LINK) && shdr[i].sh_info < shnum) {
+            shdr[i].sh_info = map[shdr[i].sh_info];
+        }
+    }
+
+    /* the new .shstrtab follows the loadable data, the section headers follow it */
+    names = realloc(names, names_len + sizeof(".shstrtab"));
+    strcpy(names + names_len, ".shstrtab");
+
+    shdr[count] = (ElfW(Shdr)) {
+        .sh_name = names_len,
+        .sh_type = SHT_STRTAB,
+        .sh_offset = end,
+        .sh_size = names_len + sizeof(".shstrtab"),
+        .sh_addralign = 1
+    };
+
+    names_len += sizeof(".shstrtab");
+    count++;
+
+    size_t shoff = (end + names_len + sizeof(ElfW(Addr)) - 1) & ~(sizeof(ElfW(Addr)) - 1);
+    size_t size = shoff + count * sizeof(ElfW(Shdr));
+
+    /* only the section headers and their names would be rewritten */
+    if (size >= elf.size) {
+        free(map);
+        free(shdr);
+        free(names);
+        elf_close(&elf);
+        return 0;
+    }
+
+    ehdr.e_shoff = shoff;
+    ehdr.e_shnum = count;
+    ehdr.e_shstrndx = count - 1;
+
+    if (ftruncate(fd_out, end) == -1) {
+        err(1, "ftruncate(): %s", target);
+    }
+
+    write_at(fd_out, names, names_len, end, target);
+    write_at(fd_out, shdr, count * sizeof(ElfW(Shdr)), shoff, target);
+    write_at(fd_out, &ehdr, sizeof(ehdr), 0, target);
+
+    printf("Stripped library: %s (%zu -> %zu bytes)\n", target, elf.size, size);
+
+    free(map);
+    free(shdr);
+    free(names);
+    elf_close(&elf);
+
+    return 1;
+}
+
+
+/* list of "VERSION name" strings */
+struct symbol_list {
+    char **items;
+    size_t count;
+};
+
+
+static void symbol_list_add(struct symbol_list *list, char *item)
+{
+    if ((list->count & (list->count - 1)) == 0) {
+        list->items = realloc(list->items, (list->count ? list->count * 2 : 1) * sizeof(char *));
+    }
+
+    list->items[list->count++] = item;
+}
+
+
+static void symbol_list_free(struct symbol_list *list)
+{
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->items[i]);
+    }
+
+    free(list->items);
+    list->items = NULL;
+    list->count = 0;
+}
+
+
+/* version index of a managed library's version, see find_requirements() */
+struct version_ref {
+    ElfW(Half) index;
+    size_t lib;
+    const char *name;
+};
+
+
+/* Add the undefined dynamic symbols of an ELF file that are bound to one
+ * of the versions in "refs" to the list of the library they come from.
+ * The SHT_GNU_versym section holds the version index of every symbol of
+ * the SHT_DYNSYM section; the hidden bit 0x8000 is masked out. */
+static void find_imports(struct elf_file *elf, const struct version_ref *refs, size_t nrefs,
+                         struct symbol_list *imports)
+{
+    ElfW(Shdr) *dynsym = get_shdr(elf, SHT_DYNSYM, ".dynsym");
+    ElfW(Shdr) *versym = get_shdr(elf, SHT_GNU_versym, ".gnu.version");
+
+    if (!dynsym || !versym || dynsym->sh_link >= get_shnum(elf) || dynsym->sh_entsize != sizeof(ElfW(Sym))) {
+        return;
+    }
+
+    ElfW(Shdr) *strings = &elf->shdr[dynsym->sh_link];
+    size_t nsyms = dynsym->sh_size / sizeof(ElfW(Sym));
+
+    if (versym->sh_size / sizeof(ElfW(Versym)) < nsyms) {
+        return;
+    }
+
+    ElfW(Sym) *syms = get_offset(elf, dynsym->sh_offset, dynsym->sh_size);
+    ElfW(Versym) *vers = get_offset(elf, versym->sh_offset, versym->sh_size);
+
+    if (!syms || !vers) {
+        return;
+    }
+
+    for (size_t i = 1; i < nsyms; i++) {
+        if (syms[i].st_shndx != SHN_UNDEF || syms[i].st_name == 0) {
+            continue;
+        }
+
+        for (size_t k = 0; k < nrefs; k++) {
+            if (refs[k].index != (vers[i] & 0x7fff)) {
+                continue;
+            }
+
+            const char *name = get_string(elf, strings, syms[i].st_name);
+
+            if (!name) {
+                return;
+            }
+
+            char *item = malloc(strlen(refs[k].name) + strlen(name) + 2);
+            sprintf(item, "%s %s", refs[k].name, name);
+            symbol_list_add(&imports[refs[k].lib], item);
+            break;
+        }
+    }
+}
+
+
+/**
+ * Find the highest versions of the managed libraries required by an ELF file
+ * and, if "imports" is not NULL, the symbols it imports from them.
+ *
+ * The SHT_GNU_verneed section holds an Elfxx_Verneed array for every needed
+ * library. vn_file is the offset of the library name in the section pointed
+ * to by sh_link, vn_aux is a relative offset to its Elfxx_Vernaux arrays and
+ * vn_next a relative offset to the next Elfxx_Verneed array.
+ *
+ * Each Elfxx_Vernaux array holds the offset of a required version string in
+ * vna_name and a relative offset to the next Elfxx_Vernaux array in vna_next.
+ */
+static void find_requirements(struct elf_file *elf, char **required, struct symbol_list *imports)
+{
+    struct version_ref *refs = NULL;
+    size_t nrefs = 0;
+
+    ElfW(Shdr) *verneed = get_shdr(elf, SHT_GNU_verneed, ".gnu.version_r");
+
+    if (!verneed || verneed->sh_link >= get_shnum(elf)) {
+        return;
+    }
+
+    ElfW(Shdr) *strings = &elf->shdr[verneed->sh_link];
+
+    /* read the whole section at once */
+    get_offset(elf, verneed->sh_offset, verneed->sh_size);
+
+    ElfW(Off) vn_off = verneed->sh_offset;
+
+    /* sh_info holds the number of entries */
+    for (size_t i = 0; i < verneed->sh_info && elf->error == CHECKRT_OK; i++) {
+        ElfW(Verneed) *vn = get_offset(elf, vn_off, sizeof(ElfW(Verneed)));
+        const char *file = vn ? get_string(elf, strings, vn->vn_file) : NULL;
+
+        if (!file) {
+            break;
+        }
+
+        for (size_t k = 0; k < RUNTIME_LIBS_NUM; k++) {
+            const struct runtime_lib *lib = &runtime_libs[k];
+
+            if (strcmp(file, lib->soname) != 0) {
+                continue;
+            }
+
+            ElfW(Off) vna_off = vn_off + vn->vn_aux;
+
+            for (size_t j = 0; j < vn->vn_cnt; j++) {
+                ElfW(Vernaux) *vna = get_offset(elf, vna_off, sizeof(ElfW(Vernaux)));
+                const char *name = vna ? get_string(elf, strings, vna->vna_name) : NULL;
+
+                if (!name) {
+                    break;
+                }
+
+                if (is_prefixed_and_higher_version(name, required[k], lib->prefix, strlen(lib->prefix))) {
+                    if (full_debug_mode) {
+                        DEBUG_PRINT(COL_RES " required by " COL_PATH, name, elf->path);
+                    }
+
+                    free(required[k]);
+                    required[k] = strdup(name);
+                }
+
+                if (imports) {
+                    refs = realloc(refs, (nrefs + 1) * sizeof(struct version_ref));
+                    refs[nrefs++] = (struct version_ref) { vna->vna_other, k, name };
+                }
+
+                if (vna->vna_next == 0) {
+                    break;
+                }
+
+                vna_off += vna->vna_next;
+            }
+        }
+
+        if (vn->vn_next == 0) {
+            break;
+        }
+
+        vn_off += vn->vn_next;
+    }
+
+    if (nrefs > 0 && elf->error == CHECKRT_OK) {
+        find_imports(elf, refs, nrefs, imports);
+    }
+
+    free(refs);
+}
+
+
+/* get a bit mask of the managed libraries in the DT_NEEDED entries */
+static int find_needed(struct elf_file *elf)
+{
+    int needed = 0;
+    ElfW(Shdr) *dynamic = get_shdr(elf, SHT_DYNAMIC, ".dynamic");
+
+    if (!dynamic || dynamic->sh_entsize != sizeof(ElfW(Dyn)) || dynamic->sh_link >= get_shnum(elf)) {
+        return 0;
+    }
+
+    ElfW(Shdr) *strings = &elf->shdr[dynamic->sh_link];
+    ElfW(Dyn) *dyn = get_offset(elf, dynamic->sh_offset, dynamic->sh_size);
+
+    for (size_t i = 0; dyn && i < dynamic->sh_size / sizeof(ElfW(Dyn)) && dyn[i].d_tag != DT_NULL; i++) {
+        const char *name = (dyn[i].d_tag == DT_NEEDED) ? get_string(elf, strings, dyn[i].d_un.d_val) : NULL;
+
+        for (size_t k = 0; name && k < RUNTIME_LIBS_NUM; k++) {
+            if (strcmp(name, runtime_libs[k].soname) == 0) {
+                needed |= 1 << k;
+            }
+        }
+    }
+
+    return needed;
+}
+
+
+/* files of the AppDir that are scanned for version requirements */
+struct scan_job {
+    char **files;
+    size_t count;
+    size_t next;  /* index of the next file, shared by all threads */
+    pthread_mutex_t lock;
+    char *required[RUNTIME_LIBS_NUM];
+    bool precise;  /* collect imported symbols too */
+    struct symbol_list imports[RUNTIME_LIBS_NUM];
+    int needed;    /* managed libraries linked against, as bit mask */
+};
+
+
+/* recursively collect all regular files */
+static void collect_files(const char *path, struct scan_job *job)
+{
+    struct dirent *e;
+    struct stat st;
+    DIR *dp = opendir(path);
+
+    if (!dp) {
+        return;
+    }
+
+    while ((e = readdir(dp)) != NULL) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) {
+            continue;
+        }
+
+        char *file = malloc(strlen(path) + strlen(e->d_name) + 2);
+        sprintf(file, "%s/%s", path, e->d_name);
+
+        unsigned char type = e->d_type;
+
+        if (type == DT_UNKNOWN && lstat(file, &st) == 0) {
+            type = S_ISDIR(st.st_mode) ? DT_DIR : (S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN);
+        }
+
+        if (type == DT_DIR) {
+            collect_files(file, job);
+        } else if (type == DT_REG) {
+            job->files = realloc(job->files, (job->count + 1) * sizeof(char *));
+            job->files[job->count++] = file;
+            continue;
+        }
+
+        free(file);
+    }
+
+    closedir(dp);
+}
+
+
+static void *scan_thread(void *arg)
+{
+    struct scan_job *job = arg;
+    char *required[RUNTIME_LIBS_NUM] = {0};
+    struct symbol_list imports[RUNTIME_LIBS_NUM] = {0};
+    struct elf_file elf;
+    int needed = 0;
+    size_t i;
+
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count) {
+        if (elf_open(&elf, job->files[i], false) == CHECKRT_OK) {
+            find_requirements(&elf, required, job->precise ? imports : NULL);
+            needed |= find_needed(&elf);
+            elf_close(&elf);
+        }
+    }
+
+    /* merge results */
+    pthread_mutex_lock(&job->lock);
+
+    job->needed |= needed;
+
+    for (size_t k = 0; k < RUNTIME_LIBS_NUM; k++) {
+        for (size_t n = 0; n < imports[k].count; n++) {
+            symbol_list_add(&job->imports[k], imports[k].items[n]);
+        }
+
+        free(imports[k].items);
+    }
+
+    for (size_t k = 0; k < RUNTIME_LIBS_NUM; k++) {
+        if (required[k] && (!job->required[k] || strverscmp(job->required[k], required[k]) < 0)) {
+            free(job->required[k]);
+            job->required[k] = required[k];
+        } else {
+            free(required[k]);
+        }
+    }
+
+    pthread_mutex_unlock(&job->lock);
+
+    return NULL;
+}
+
+
+/* run "func" on one thread per processor (at most 16 and not more than
+ * "count") and on the calling thread; the threads take work items from
+ * a shared index until all are done */
+static void run_threads(void *(*func)(void *), void *arg, size_t count)
+{
+    pthread_t threads[16];
+    size_t nthreads = 0;
+
+    long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max = (nproc < 1) ? 1 : (size_t)nproc;
+    max = (max > 16) ? 16 : max;
+    max = (max > count) ? count : max;
+
+    for ( ; nthreads < max; nthreads++) {
+        if (pthread_create(&threads[nthreads], NULL, func, arg) != 0) {
+            break;
+        }
+    }
+
+    func(arg);
+
+    for (size_t i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+
+static int compare_strings(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+/* write the sorted and deduplicated symbols imported from
+ * each managed library, or remove the file if "imports" is NULL */
+static void write_symbols(const char *dir, struct symbol_list *imports)
+{
+    char *path = malloc(strlen(dir) + sizeof(SYMBOLS_FILE) + 1);
+    sprintf(path, "%s/" SYMBOLS_FILE, dir);
+
+    if (!imports) {
+        unlink(path);
+        free(path);
+        return;
+    }
+
+    FILE *f = fopen(path, "w");
+
+    if (!f) {
+        err(1, "cannot open file for writing: %s", path);
+    }
+
+    fprintf(f, "%s\n", SYMBOLS_MAGIC);
+
+    for (size_t k = 0; k < RUNTIME_LIBS_NUM; k++) {
+        struct symbol_list *list = &imports[k];
+        size_t count = 0;
+
+        if (list->count == 0) {
+            continue;
+        }
+
+        qsort(list->items, list->count, sizeof(char *), compare_strings);
+        fprintf(f, "@%s/%s\n", runtime_libs[k].subdir, runtime_libs[k].soname);
+
+        for (size_t n = 0; n < list->count; n++) {
+            if (n == 0 || strcmp(list->items[n], list->items[n - 1]) != 0) {
+                fprintf(f, "%s\n", list->items[n]);
+                count++;
+            }
+        }
+
+        printf("Symbols imported from %s: %zu\n", runtime_libs[k].soname, count);
+    }
+
+    if (fclose(f) != 0) {
+        err(1, "error writing to file: %s", path);
+    }
+
+    free(path);
+}
+
+
+/* scan all ELF files of the AppDir in parallel and save the highest
+ * required version of each managed library to "required"; if "precise"
+ * is true the imported symbols are written to the symbols file.
+ * Optional libraries are only copied (see copy_lib()) once a scanned file
+ * links against them, and are then scanned too. */
+static void scan_requirements(const char *dir, char **required, bool precise, bool strip)
+{
+    struct scan_job job = { .lock = PTHREAD_MUTEX_INITIALIZER, .precise = precise };
+    int copied = 0;
+
+    /* the AppDir is the parent directory; the bundled libraries are
+     * scanned too because they may depend on each other */
+    char *appdir = strdup(dir);
+    collect_files(dirname(appdir), &job);
+
+    for (size_t start = 0; start < job.count; ) {
+        job.next = start;
+        run_threads(scan_thread, &job, job.count - start);
+        start = job.count;
+
+        for (size_t k = 0; k < RUNTIME_LIBS_NUM; k++) {
+            if (!runtime_libs[k].optional || !(job.needed & (1 << k)) || (copied & (1 << k))) {
+                continue;
+            }
+
+            uint64_t t = trace_begin();
+            char *path = copy_lib(dir, &runtime_libs[k], strip);
+            trace_event(t, "copy", "lib", runtime_libs[k].soname, NULL);
+            copied |= 1 << k;
+
+            if (path) {
+                job.files = realloc(job.files, (job.count + 1) * sizeof(char *));
+                job.files[job.count++] = path;
+            }
+        }
+    }
+
+    for (size_t k = 0; k < RUNTIME_LIBS_NUM; k++) {
+        required[k] = job.required[k];
+
+        if (required[k]) {
+            printf("Required version of %s: %s\n", runtime_libs[k].soname, required[k]);
+        }
+    }
+
+    write_symbols(dir, precise ? job.imports : NULL);
+
+    for (size_t k = 0; k < RUNTIME_LIBS_NUM; k++) {
+        symbol_list_free(&job.imports[k]);
+    }
+
+    for (size_t i = 0; i < job.count; i++) {
+        free(job.files[i]);
+    }
+
+    free(job.files);
+    free(appdir);
+}
+
+
+/* state of a single library comparison */
+struct lib_check {
+    const struct runtime_lib *lib;
+    char *lib_bundle;
+    char *lib_sys;
+    char *sym_bundle;    /* taken from the manifest if has_manifest is true */
+    char *required;      /* highest version required by the AppDir, from the manifest */
+    struct symbol_list imports;  /* symbols imported by the AppDir, from the symbols file */
+    bool has_manifest;
+    int use_bundled;     /* result of use_bundled_library() */
+    const char *error_path;  /* library that caused an error */
+};
+
+
+/* GNU hash function of the .gnu.hash section */
+static uint32_t gnu_hash(const char *name)
+{
+    uint32_t h = 5381;
+
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        h = (h << 5) + h + *p;
+    }
+
+    return h;
+}
+
+
+/**
+ * Look up every "VERSION name" entry of "list" in the dynamic symbol table
+ * of a library. Returns 1 if all symbols are defined with these versions,
+ * 0 if one is missing and -1 if the library has no usable hash table.
+ *
+ * The SHT_GNU_HASH section starts with the number of buckets, the index of
+ * the first hashed symbol, the number of bloom filter words and the bloom
+ * filter shift, followed by the bloom filter words, the buckets and the
+ * hash chain. Each bucket holds the index of the first symbol with that
+ * hash modulo the number of buckets; a chain entry holds the hash of its
+ * symbol with the lowest bit marking the end of the chain.
+ */
+static int provides_symbols(const char *path, const struct symbol_list *list)
+{
+    struct elf_file elf;
+    const size_t bits = sizeof(ElfW(Addr)) * 8;
+    int rv = -1;
+
+    uint64_t start = trace_begin();
+
+    if (elf_open(&elf, path, true) != CHECKRT_OK) {
+        return -1;
+    }
+
+    ElfW(Shdr) *hash = get_shdr(&elf, SHT_GNU_HASH, ".gnu.hash");
+    ElfW(Shdr) *dynsym = get_shdr(&elf, SHT_DYNSYM, ".dynsym");
+    ElfW(Shdr) *versym = get_shdr(&elf, SHT_GNU_versym, ".gnu.version");
+    ElfW(Shdr) *verdef = get_shdr(&elf, SHT_GNU_verdef, ".gnu.version_d");
+    ElfW(Shdr) *dynamic = get_shdr(&elf, SHT_DYNAMIC, ".dynamic");
+    size_t verdefnum = dynamic ? get_dyn_val(&elf, dynamic, DT_VERDEFNUM) : 0;
+
+    if (!hash || !dynsym || !versym || !verdef || verdefnum == 0 || hash->sh_size < 16 ||
+        dynsym->sh_link >= get_shnum(&elf) || verdef->sh_link >= get_shnum(&elf) ||
+        dynsym->sh_entsize != sizeof(ElfW(Sym)))
+    {
+        elf_close(&elf);
+        return -1;
+    }
+
+    size_t nsyms = dynsym->sh_size / sizeof(ElfW(Sym));
+    ElfW(Shdr) *strings = &elf.shdr[dynsym->sh_link];
+
+    /* read the tables at once */
+    uint32_t *header = get_offset(&elf, hash->sh_offset, hash->sh_size);
+    ElfW(Sym) *syms = get_offset(&elf, dynsym->sh_offset, dynsym->sh_size);
+    ElfW(Versym) *vers = get_offset(&elf, versym->sh_offset, versym->sh_size);
+
+    if (!header || !syms || !vers || !get_offset(&elf, strings->sh_offset, strings->sh_size)) {
+        elf_close(&elf);
+        return -1;
+    }
+
+    uint32_t nbuckets = header[0], symoffset = header[1], bloom_size = header[2], bloom_shift = header[3];
+    size_t words = (hash->sh_size - 16) / 4;
+
+    if (nbuckets == 0 || bloom_size == 0 || (size_t)bloom_size * (bits / 32) + nbuckets > words ||
+        versym->sh_size / sizeof(ElfW(Versym)) < nsyms)
+    {
+        elf_close(&elf);
+        return -1;
+    }
+
+    ElfW(Addr) *bloom = (ElfW(Addr) *)(header + 4);
+    uint32_t *buckets = (uint32_t *)(bloom + bloom_size);
+    uint32_t *chain = buckets + nbuckets;
+    size_t chain_len = words - (size_t)bloom_size * (bits / 32) - nbuckets;
+
+    /* version names by version index */
+    const char **version_names = calloc(verdefnum + 2, sizeof(char *));
+    ElfW(Off) vd_off = verdef->sh_offset;
+    get_offset(&elf, verdef->sh_offset, verdef->sh_size);
+
+    for (size_t i = 0; i < verdefnum && elf.error == CHECKRT_OK; i++) {
+        ElfW(Verdef) *vd = get_offset(&elf, vd_off, sizeof(ElfW(Verdef)));
+
+        if (!vd) {
+            break;
+        }
+
+        if (vd->vd_ndx < verdefnum + 2 && vd->vd_aux >= sizeof(ElfW(Verdef))) {
+            ElfW(Verdaux) *vda = get_offset(&elf, vd_off + vd->vd_aux, sizeof(ElfW(Verdaux)));
+            version_names[vd->vd_ndx] = vda ? get_string(&elf, &elf.shdr[verdef->sh_link], vda->vda_name) : NULL;
+        }
+
+        vd_off += vd->vd_next;
+    }
+
+    rv = (elf.error == CHECKRT_OK) ? 1 : -1;
+
+    for (size_t n = 0; n < list->count && rv == 1; n++) {
+        const char *version = list->items[n];
+        const char *name = strchr(version, ' ') + 1;
+        size_t verlen = name - version - 1;
+        uint32_t h = gnu_hash(name);
+        bool found = false;
+
+        ElfW(Addr) word = bloom[(h / bits) % bloom_size];
+        ElfW(Addr) mask = ((ElfW(Addr))1 << (h % bits)) | ((ElfW(Addr))1 << ((h >> bloom_shift) % bits));
+
+        if ((word & mask) == mask) {
+            for (size_t i = buckets[h % nbuckets]; i >= symoffset && i < nsyms && i - symoffset < chain_len; i++) {
+                uint32_t h2 = chain[i - symoffset];
+
+                const char *sym_name = ((h | 1) == (h2 | 1) && syms[i].st_shndx != SHN_UNDEF) ?
+                    get_string(&elf, strings, syms[i].st_name) : NULL;
+
+                if (sym_name && strcmp(sym_name, name) == 0) {
+                    const char *defined = ((vers[i] & 0x7fff) < verdefnum + 2) ? version_names[vers[i] & 0x7fff] : NULL;
+
+                    if (defined && strlen(defined) == verlen && strncmp(defined, version, verlen) == 0) {
+                        found = true;
+                        break;
+                    }
+                }
+
+                if (h2 & 1) {
+                    break;
+                }
+            }
+        }
+
+        if (elf.error != CHECKRT_OK) {
+            rv = -1;
+        } else if (!found) {
+            DEBUG_PRINT("symbol " COL_RES " not found in " COL_PATH, list->items[n], path);
+            rv = 0;
+        }
+    }
+
+    free(version_names);
+    elf_close(&elf);
+
+    trace_event(start, "provides_symbols", "path", path, "result", (rv < 0) ? "error" : (rv ? "all" : "missing"), NULL);
+
+    return rv;
+}
+
+
+/* Decide between the bundled and the system library: the system library
+ * is kept if it provides the version the AppDir's binaries require, the
+ * bundled one is used if it's newer or if there is no system library */
+static bool prefer_bundled(const char *sym_bundle, const char *lib_sys, const char *sym_sys, const char *required)
+{
+    if (!lib_sys) {
+        return true;
+    }
+
+    if (required && sym_sys && strverscmp(sym_sys, required) >= 0) {
+        DEBUG_PRINT("system library provides required version " COL_RES, required);
+        return false;
+    }
+
+    return (sym_bundle && sym_sys && strverscmp(sym_bundle, sym_sys) > 0);
+}
+
+
+/* compare symbol versions; returns 1 if we should use the bundled
+ * library, 0 for the system library or an error code */
+static int use_bundled_library(struct lib_check *check)
+{
+    const struct runtime_lib *lib = check->lib;
+    uint64_t start = trace_begin();
+    int rv = CHECKRT_OK;
+
+    /* get symbols */
+    char *sym_bundle = check->sym_bundle;
+    char *lib_sys = get_system_library_path(lib->soname, true);
+    char *sym_sys = NULL;
+
+    if (!check->has_manifest) {
+        rv = symbol_version(check->lib_bundle, lib->prefix, "bundled", &sym_bundle);
+    }
+
+    /* with the list of imported symbols the system library
+     * is kept exactly if it provides all of them */
+    int provided = (rv == CHECKRT_OK && lib_sys && check->imports.count > 0) ?
+        provides_symbols(lib_sys, &check->imports) : -1;
+
+    if (rv != CHECKRT_OK) {
+        DEBUG_PRINT("cannot read bundled library: " COL_PATH, check->lib_bundle);
+        check->error_path = check->lib_bundle;
+    } else if (provided >= 0) {
+        DEBUG_PRINT("system library provides %s imported symbols", provided ? "all" : "not all");
+        rv = !provided;
+    } else if (lib_sys && (rv = symbol_version(lib_sys, lib->prefix, "system", &sym_sys)) != CHECKRT_OK) {
+        DEBUG_PRINT("cannot read system library: " COL_PATH, lib_sys);
+        check->error_path = lib_sys;
+    } else {
+        rv = prefer_bundled(sym_bundle, lib_sys, sym_sys, check->required);
+    }
+
+    if (rv >= 0) {
+        DEBUG_PRINT("use " COL_SYS " " COL_LIB " library", rv ? "BUNDLED" : "SYSTEM", lib->soname);
+    }
+
+    trace_event(start, "decision", "lib", lib->soname, "bundled", sym_bundle, "system", sym_sys,
+                "required", check->required, "system_path", lib_sys, "method", (provided >= 0) ? "symbols" : "versions",
+                "use", (rv < 0) ? checkrt_strerror(rv) : (rv ? "bundled" : "system"), NULL);
+
+    check->lib_sys = lib_sys;
+    check->sym_bundle = sym_bundle;
+    free(sym_sys);
+
+    return rv;
+}
+
+
+/* get full dirname of executable */
+static char *get_exe_dir()
+{
+    uint64_t start = trace_begin();
+    char *self = realpath("/proc/self/exe", NULL);
+
+    if (!self) {
+        err(1, "%s", "realpath() failed to resolve /proc/self/exe");
+    }
+
+    /* dirname() modifies and returns "self" */
+    char *pdirname = dirname(self);
+
+    if (pdirname != self || pdirname[0] != '/') {
+        errx(1, "dirname() returned an unexpected result: %s", pdirname);
+    }
+
+    DEBUG_PRINT("exe directory found at: " COL_PATH, self);
+    trace_event(start, "exe_dir", "path", self, NULL);
+
+    return self;
+}
+
+
+/* FNV-1a hash */
+static uint64_t hash_str(uint64_t h, const char *str)
+{
+    for ( ; *str; str++) {
+        h = (h ^ (uint8_t)*str) * 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+
+/* get path of the cache file for this AppImage or AppDir;
+ * returns NULL if caching is disabled or no cache directory was found */
+static char *get_cache_path(const char *dir)
+{
+    const char *env = getenv("CHECKRT_NOCACHE");
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char *path = NULL;
+
+    if (env && *env) {
+        return NULL;
+    }
+
+    /* the mountpoint of an AppImage changes with every launch,
+     * so use the path to the AppImage file if we have it */
+    const char *id = getenv("APPIMAGE");
+
+    if (!id || *id != '/') {
+        id = dir;
+    }
+
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", (unsigned long long)hash_str(0xcbf29ce484222325ULL, id));
+
+    if (base && *base == '/') {
+        path = malloc(strlen(base) + sizeof(CACHE_SUBDIR) + sizeof(key) + 2);
+        mkdir(base, 0700);
+        sprintf(path, "%s/" CACHE_SUBDIR, base);
+    } else if (home && *home == '/') {
+        path = malloc(strlen(home) + sizeof("/.cache/" CACHE_SUBDIR) + sizeof(key) + 1);
+        sprintf(path, "%s/.cache", home);
+        mkdir(path, 0700);
+        strcat(path, "/" CACHE_SUBDIR);
+    } else {
+        return NULL;
+    }
+
+    if (mkdir(path, 0700) == -1 && errno != EEXIST) {
+        DEBUG_PRINT("cannot create cache directory: " COL_PATH, path);
+        free(path);
+        return NULL;
+    }
+
+    strcat(path, "/");
+    strcat(path, key);
+
+    return path;
+}
+
+
+/* create a fingerprint string from the file's metadata; device and inode
+ * are skipped for bundled files because they change with every mount */
+static void fingerprint(char *buf, size_t bufsize, char type, const char *path)
+{
+    struct stat st;
+
+    if (stat(path, &st) == -1) {
+        snprintf(buf, bufsize, "%c -", type);
+    } else if (type == 'S') {
+        snprintf(buf, bufsize, "%c %ju %ju %jd %jd %ld", type,
+            (uintmax_t)st.st_dev, (uintmax_t)st.st_ino, (intmax_t)st.st_size,
+            (intmax_t)st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+    } else {
+        snprintf(buf, bufsize, "%c %jd %jd %ld", type, (intmax_t)st.st_size,
+            (intmax_t)st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+    }
+}
+
+
+/* key over everything else that can change how libraries are resolved */
+static uint64_t get_cache_key(const char *env)
+{
+    char buf[128];
+
+    fingerprint(buf, sizeof(buf), 'S', LDSO_CACHE);
+
+    uint64_t h = hash_str(0xcbf29ce484222325ULL, CACHE_MAGIC);
+    h = hash_str(h, buf);
+    h = hash_str(h, env ? env : "");
+
+    return h;
+}
+
+
+/* read result from cache and the paths of the system libraries it was made
+ * with into "system"; returns -1 if the cache is missing or stale */
+static int read_cache(const char *cache, const char *dir, char **system, size_t n)
+{
+    char line[4096], fp[128];
+    unsigned long long key = 0;
+    size_t count = 0;
+    int res = -1;
+
+    FILE *f = fopen(cache, "r");
+
+    if (!f) {
+        return -1;
+    }
+
+    if (!fgets(line, sizeof(line), f) || strcmp(line, CACHE_MAGIC "\n") != 0 ||
+        !fgets(line, sizeof(line), f) || sscanf(line, "K %llx", &key) != 1 ||
+        key != get_cache_key(getenv("LD_LIBRARY_PATH")))
+    {
+        DEBUG_PRINT("cache is outdated: " COL_PATH, cache);
+        fclose(f);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        char *tab = strchr(line, '\t');
+        char *nl = strchr(line, '\n');
+
+        if (sscanf(line, "R %d", &res) == 1) {
+            break;
+        } else if (!tab || !nl || (line[0] != 'S' && line[0] != 'B')) {
+            break;
+        }
+
+        *tab++ = 0;
+        *nl = 0;
+
+        /* bundled files are stored relative to the exe directory;
+         * the system library follows the bundled one */
+        if (line[0] == 'B') {
+            char *path = malloc(strlen(dir) + strlen(tab) + 2);
+            sprintf(path, "%s/%s", dir, tab);
+            fingerprint(fp, sizeof(fp), line[0], path);
+            free(path);
+            count++;
+        } else {
+            fingerprint(fp, sizeof(fp), line[0], tab);
+
+            if (count > 0 && count <= n) {
+                free(system[count - 1]);
+                system[count - 1] = strdup(tab);
+            }
+        }
+
+        if (strcmp(fp, line) != 0) {
+            DEBUG_PRINT("file has changed: " COL_PATH, tab);
+            break;
+        }
+    }
+
+    fclose(f);
+
+    if (res < 0) {
+        for (size_t i = 0; i < n; i++) {
+            free(system[i]);
+            system[i] = NULL;
+        }
+
+        return -1;
+    }
+
+    DEBUG_PRINT("using cached result from: " COL_PATH, cache);
+
+    return res;
+}
+
+
+/* save result to cache; failures are not fatal */
+static void write_cache(const char *cache, const char *dir, int res, const char **bundled, char **system, size_t n)
+{
+    char fp[128];
+
+    /* unique temporary file, other threads may write the same cache */
+    char *tmp = malloc(strlen(cache) + sizeof(".XXXXXX"));
+    sprintf(tmp, "%s.XXXXXX", cache);
+
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    FILE *f = (fd == -1) ? NULL : fdopen(fd, "w");
+
+    if (!f) {
+        DEBUG_PRINT("cannot write cache file: " COL_PATH, tmp);
+
+        if (fd != -1) {
+            close(fd);
+            unlink(tmp);
+        }
+
+        free(tmp);
+        return;
+    }
+
+    fprintf(f, CACHE_MAGIC "\nK %016llx\n", (unsigned long long)get_cache_key(getenv("LD_LIBRARY_PATH")));
+
+    for (size_t i = 0; i < n; i++) {
+        char *path = malloc(strlen(dir) + strlen(bundled[i]) + 2);
+        sprintf(path, "%s/%s", dir, bundled[i]);
+        fingerprint(fp, sizeof(fp), 'B', path);
+        fprintf(f, "%s\t%s\n", fp, bundled[i]);
+        free(path);
+
+        if (system[i]) {
+            fingerprint(fp, sizeof(fp), 'S', system[i]);
+            fprintf(f, "%s\t%s\n", fp, system[i]);
+        }
+    }
+
+    fprintf(f, "R %d\n", res);
+
+    /* replace the old file atomically */
+    if (fclose(f) != 0 || rename(tmp, cache) == -1) {
+        DEBUG_PRINT("cannot write cache file: " COL_PATH, cache);
+        unlink(tmp);
+    }
+
+    free(tmp);
+}
+
+
+/* get colon separated list of library directories in load order,
+ * or NULL if no bundled library should be used */
+static char *get_library_dirs(const char *dir, int res)
+{
+    char *list = NULL;
+    size_t len = 0;
+
+    for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+        if (res & (1 << i)) {
+            list = realloc(list, len + strlen(dir) + strlen(runtime_libs[i].subdir) + 3);
+            len += sprintf(list + len, "%s%s/%s", len ? ":" : "", dir, runtime_libs[i].subdir);
+        }
+    }
+
+    return list;
+}
+
+
+/* get colon separated list of the bundled libraries to preload,
+ * or NULL if no bundled library should be used */
+static char *get_library_paths(const char *dir, int res)
+{
+    char *list = NULL;
+    size_t len = 0;
+
+    for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+        if (res & (1 << i)) {
+            const struct runtime_lib *lib = &runtime_libs[i];
+            list = realloc(list, len + strlen(dir) + strlen(lib->subdir) + strlen(lib->soname) + 4);
+            len += sprintf(list + len, "%s%s/%s/%s", len ? ":" : "", dir, lib->subdir, lib->soname);
+        }
+    }
+
+    return list;
+}
+
+
+/* hash over the result and everything it depends on, like the cache file;
+ * LD_LIBRARY_PATH is taken without the directories added for the result */
+static uint64_t token_hash(const char *dir, int res, const char **bundled, char **system, size_t n)
+{
+    char buf[128];
+    char *dirs = get_library_dirs(dir, res);
+    const char *env = getenv("LD_LIBRARY_PATH");
+    size_t len = dirs ? strlen(dirs) : 0;
+
+    if (env && len > 0 && strncmp(env, dirs, len) == 0 && (env[len] == ':' || env[len] == 0)) {
+        env += (env[len] == ':') ? len + 1 : len;
+    }
+
+    snprintf(buf, sizeof(buf), "%d %016llx\t", res, (unsigned long long)get_cache_key(env));
+
+    uint64_t h = hash_str(0xcbf29ce484222325ULL, TOKEN_MAGIC);
+    h = hash_str(h, buf);
+    h = hash_str(hash_str(h, dir), "\t");
+
+    for (size_t i = 0; i < n; i++) {
+        char *path = malloc(strlen(dir) + strlen(bundled[i]) + 2);
+        sprintf(path, "%s/%s", dir, bundled[i]);
+        fingerprint(buf, sizeof(buf), 'B', path);
+        h = hash_str(hash_str(h, buf), "\t");
+        free(path);
+
+        if (system[i]) {
+            fingerprint(buf, sizeof(buf), 'S', system[i]);
+            h = hash_str(hash_str(h, buf), "\t");
+            h = hash_str(hash_str(h, system[i]), "\t");
+        }
+    }
+
+    free(dirs);
+
+    return h;
+}
+
+
+/* create a token with the result, its hash and the system library paths;
+ * the format is "<result>:<hash>:<path>:<path>..." with one path or an
+ * empty string per fingerprinted file */
+static char *make_token(const char *dir, int res, const char **bundled, char **system, size_t n)
+{
+    size_t len = 32;
+
+    for (size_t i = 0; i < n; i++) {
+        len += (system[i] ? strlen(system[i]) : 0) + 1;
+    }
+
+    char *token = malloc(len);
+    char *p = token + sprintf(token, "%d:%016llx", res,
+        (unsigned long long)token_hash(dir, res, bundled, system, n));
+
+    for (size_t i = 0; i < n; i++) {
+        p += sprintf(p, ":%s", system[i] ? system[i] : "");
+    }
+
+    return token;
+}
+
+
+/**
+ * Take the result from a token in the environment, which was set by checkrt
+ * for a parent process started from the same AppDir. It's only accepted if
+ * the hash over the result, the bundled files, the system libraries and the
+ * library search path still matches, so an outdated or modified token is
+ * ignored. Only stat() is needed for this, no library is opened.
+ * Returns the result or -1.
+ */
+static int read_token(const char *dir, const char **bundled, char **system, size_t n)
+{
+    const char *token = getenv(TOKEN_ENV);
+    unsigned long long hash;
+    int res, pos = 0;
+
+    if (!token || !*token) {
+        return -1;
+    }
+
+    if (sscanf(token, "%d:%16llx%n", &res, &hash, &pos) != 2 || res < 0 || pos == 0) {
+        DEBUG_PRINT("invalid token: %s", token);
+        return -1;
+    }
+
+    const char *p = token + pos;
+
+    for (size_t i = 0; i < n && *p == ':'; i++) {
+        size_t len = strcspn(++p, ":");
+        system[i] = (len > 0) ? strndup(p, len) : NULL;
+        p += len;
+    }
+
+    if (*p != 0 || token_hash(dir, res, bundled, system, n) != hash) {
+        DEBUG_PRINT("token is outdated: %s", token);
+
+        for (size_t i = 0; i < n; i++) {
+            free(system[i]);
+            system[i] = NULL;
+        }
+
+        return -1;
+    }
+
+    DEBUG_PRINT("using result from %s", TOKEN_ENV);
+
+    return res;
+}
+
+
+/* FNV-1a hash over the file's content */
+static uint64_t hash_file(const char *path)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t bufsize = 64*1024;
+    uint8_t *buf = malloc(bufsize);
+    ssize_t nread;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1) {
+        err(1, "cannot open file for reading: %s", path);
+    }
+
+    while ((nread = read(fd, buf, bufsize)) > 0) {
+        for (ssize_t i = 0; i < nread; i++) {
+            h = (h ^ buf[i]) * 0x100000001b3ULL;
+        }
+    }
+
+    if (nread == -1) {
+        err(1, "error reading from file: %s", path);
+    }
+
+    close(fd);
+    free(buf);
+
+    return h;
+}
+
+
+/* write a manifest with the versions of the bundled libraries and the highest
+ * versions required by the AppDir; lines have the format
+ * "<version> <required version> <checksum> <size>\t<path>" */
+static void write_manifest(const char *dir, char **required)
+{
+    struct stat st;
+
+    char *manifest = malloc(strlen(dir) + sizeof(MANIFEST_FILE) + 1);
+    sprintf(manifest, "%s/" MANIFEST_FILE, dir);
+
+    FILE *f = fopen(manifest, "w");
+
+    if (!f) {
+        err(1, "cannot open file for writing: %s", manifest);
+    }
+
+    fprintf(f, "%s\n", MANIFEST_MAGIC);
+
+    for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+        const struct runtime_lib *lib = &runtime_libs[i];
+        char *path = malloc(strlen(dir) + strlen(lib->subdir) + strlen(lib->soname) + 3);
+        sprintf(path, "%s/%s/%s", dir, lib->subdir, lib->soname);
+
+        if (stat(path, &st) == 0) {
+            char *symbol;
+            int rv = symbol_version(path, lib->prefix, "bundled", &symbol);
+
+            if (rv != CHECKRT_OK) {
+                errx(1, "%s: %s", path, checkrt_strerror(rv));
+            }
+
+            fprintf(f, "%s %s %016llx %jd\t%s/%s\n", symbol ? symbol : "-", required[i] ? required[i] : "-",
+                (unsigned long long)hash_file(path), (intmax_t)st.st_size, lib->subdir, lib->soname);
+            free(symbol);
+        }
+
+        free(path);
+    }
+
+    if (fclose(f) != 0) {
+        err(1, "error writing to file: %s", manifest);
+    }
+
+    free(manifest);
+}
+
+
+/* create or remove the file that selects the preload mode */
+static void write_preload_file(const char *dir, bool preload)
+{
+    char *path = malloc(strlen(dir) + sizeof(PRELOAD_FILE) + 1);
+    sprintf(path, "%s/" PRELOAD_FILE, dir);
+
+    if (!preload) {
+        unlink(path);
+        free(path);
+        return;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd == -1 || close(fd) == -1) {
+        err(1, "cannot create file: %s", path);
+    }
+
+    puts("Bundled libraries will be preloaded");
+    free(path);
+}
+
+
+/* whether the bundled libraries should be preloaded */
+static bool use_preload(const char *dir)
+{
+    char *path = malloc(strlen(dir) + sizeof(PRELOAD_FILE) + 1);
+    sprintf(path, "%s/" PRELOAD_FILE, dir);
+
+    bool rv = (access(path, F_OK) == 0);
+    free(path);
+
+    return rv;
+}
+
+
+/* take the versions of the bundled libraries from the manifest if their size
+ * hasn't changed; the modification time isn't used because squashfs only
+ * stores seconds and AppImage tools may reset it for reproducible builds */
+static void read_manifest(const char *dir, struct lib_check *checks)
+{
+    struct stat st;
+    char line[4096], version[256], required[256];
+    unsigned long long checksum;
+    intmax_t size;
+
+    char *manifest = malloc(strlen(dir) + sizeof(MANIFEST_FILE) + 1);
+    sprintf(manifest, "%s/" MANIFEST_FILE, dir);
+
+    FILE *f = fopen(manifest, "r");
+
+    if (!f || !fgets(line, sizeof(line), f) || strcmp(line, MANIFEST_MAGIC "\n") != 0) {
+        DEBUG_PRINT("no manifest found: " COL_PATH, manifest);
+
+        if (f) {
+            fclose(f);
+        }
+
+        free(manifest);
+        return;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        char *tab = strchr(line, '\t');
+        char *nl = strchr(line, '\n');
+
+        if (!tab || !nl || sscanf(line, "%255s %255s %llx %jd", version, required, &checksum, &size) != 4) {
+            break;
+        }
+
+        *tab++ = 0;
+        *nl = 0;
+
+        for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+            struct lib_check *check = &checks[i];
+
+            if (strcmp(check->lib_bundle + strlen(dir) + 1, tab) != 0) {
+                continue;
+            }
+
+            if (stat(check->lib_bundle, &st) == -1 || st.st_size != size) {
+                DEBUG_PRINT("manifest entry is outdated: " COL_PATH, tab);
+            } else if (full_debug_mode && hash_file(check->lib_bundle) != checksum) {
+                DEBUG_PRINT("checksum mismatch: " COL_PATH, tab);
+            } else {
+                DEBUG_PRINT("version of " COL_LIB " from manifest: " COL_RES, tab, version);
+                check->sym_bundle = (strcmp(version, "-") == 0) ? NULL : strdup(version);
+                check->required = (strcmp(required, "-") == 0) ? NULL : strdup(required);
+                check->has_manifest = true;
+            }
+
+            break;
+        }
+    }
+
+    fclose(f);
+    free(manifest);
+}
+
+
+/* read the symbols imported from each managed library, see write_symbols() */
+static void read_symbols(const char *dir, struct lib_check *checks)
+{
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    struct lib_check *check = NULL;
+
+    char *path = malloc(strlen(dir) + sizeof(SYMBOLS_FILE) + 1);
+    sprintf(path, "%s/" SYMBOLS_FILE, dir);
+
+    FILE *f = fopen(path, "r");
+
+    if (!f || getline(&line, &size, f) == -1 || strcmp(line, SYMBOLS_MAGIC "\n") != 0) {
+        if (f) {
+            DEBUG_PRINT("invalid symbols file: " COL_PATH, path);
+            fclose(f);
+        }
+
+        free(line);
+        free(path);
+        return;
+    }
+
+    /* lines can be of any length, symbol names aren't limited */
+    while ((len = getline(&line, &size, f)) != -1) {
+        if (line[len - 1] == '\n') {
+            line[len - 1] = 0;
+        }
+
+        if (line[0] == '@') {
+            check = NULL;
+
+            for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+                if (strcmp(checks[i].lib_bundle + strlen(dir) + 1, line + 1) == 0) {
+                    check = &checks[i];
+                    break;
+                }
+            }
+        } else if (check && strchr(line, ' ')) {
+            symbol_list_add(&check->imports, strdup(line));
+        }
+    }
+
+    for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+        if (checks[i].imports.count > 0) {
+            DEBUG_PRINT("%zu symbols imported from " COL_LIB, checks[i].imports.count, checks[i].lib->soname);
+        }
+    }
+
+    fclose(f);
+    free(line);
+    free(path);
+}
+
+
+static void *check_library_thread(void *arg)
+{
+    struct lib_check *check = arg;
+    check->use_bundled = use_bundled_library(check);
+    return NULL;
+}
+
+
+/* compare symbol versions of bundled and system libraries; returns a bitmask
+ * of the runtime_libs[] entries to use from the bundle or an error code;
+ * if "token" is not NULL it's set to a token for child processes, and if
+ * "error_path" is not NULL it's set to the library that caused an error */
+static int compare_library_symbols(const char *dir, char **token, char **error_path)
+{
+    char *cache = NULL;
+
+    struct lib_check checks[RUNTIME_LIBS_NUM] = {0};
+    pthread_t threads[RUNTIME_LIBS_NUM];
+    bool started[RUNTIME_LIBS_NUM] = {0};
+
+    /* the checkrt binary, the manifest and the symbols file are part of the fingerprint */
+    const char *bundled[RUNTIME_LIBS_NUM + 3] = { "checkrt", MANIFEST_FILE, SYMBOLS_FILE };
+    char *system[RUNTIME_LIBS_NUM + 3] = { NULL };
+
+    for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+        const struct runtime_lib *lib = &runtime_libs[i];
+
+        checks[i].lib = lib;
+        checks[i].lib_bundle = malloc(strlen(dir) + strlen(lib->subdir) + strlen(lib->soname) + 3);
+        sprintf(checks[i].lib_bundle, "%s/%s/%s", dir, lib->subdir, lib->soname);
+        bundled[i + 3] = checks[i].lib_bundle + strlen(dir) + 1;
+    }
+
+    const size_t n = RUNTIME_LIBS_NUM + 3;
+    uint64_t start = trace_begin();
+    int res = read_token(dir, bundled, system, n);
+    bool from_token = (res >= 0);
+
+    trace_event(start, "token", "result", from_token ? "hit" : "miss", NULL);
+
+    if (!from_token && (cache = get_cache_path(dir)) != NULL) {
+        start = trace_begin();
+        res = read_cache(cache, dir, system, n);
+        trace_event(start, "cache_read", "path", cache, "result", res < 0 ? "miss" : "hit", NULL);
+    }
+
+    if (res < 0) {
+        struct lib_check *first = NULL;
+        res = 0;
+
+        start = trace_begin();
+        read_manifest(dir, checks);
+        read_symbols(dir, checks);
+        trace_event(start, "manifest_read", "path", dir, NULL);
+
+        /* check the libraries concurrently; the first one is checked
+         * on the main thread while the others are running */
+        for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+            if (access(checks[i].lib_bundle, F_OK) != 0) {
+                if (!runtime_libs[i].optional) {
+                    DEBUG_PRINT("no access or file does not exist: " COL_PATH, checks[i].lib_bundle);
+                }
+            } else if (!first) {
+                first = &checks[i];
+            } else if (pthread_create(&threads[i], NULL, check_library_thread, &checks[i]) == 0) {
+                started[i] = true;
+            } else {
+                check_library_thread(&checks[i]);
+            }
+        }
+
+        if (first) {
+            check_library_thread(first);
+        }
+
+        for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+            if (started[i]) {
+                pthread_join(threads[i], NULL);
+            }
+
+            if (checks[i].use_bundled < 0 && res >= 0) {
+                res = checks[i].use_bundled;
+
+                if (error_path) {
+                    *error_path = strdup(checks[i].error_path ? checks[i].error_path : dir);
+                }
+            } else if (checks[i].use_bundled > 0 && res >= 0) {
+                res |= 1 << i;
+            }
+
+            system[i + 3] = checks[i].lib_sys;
+            checks[i].lib_sys = NULL;
+        }
+
+        if (cache && res >= 0) {
+            start = trace_begin();
+            write_cache(cache, dir, res, bundled, system, n);
+            trace_event(start, "cache_write", "path", cache, NULL);
+        }
+    }
+
+    if (token && res >= 0) {
+        *token = from_token ? strdup(getenv(TOKEN_ENV)) : make_token(dir, res, bundled, system, n);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        free(system[i]);
+    }
+
+    for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+        free(checks[i].lib_bundle);
+        free(checks[i].sym_bundle);
+        free(checks[i].required);
+        symbol_list_free(&checks[i].imports);
+    }
+
+    free(cache);
+
+    return res;
+}
+
+
+const char *checkrt_strerror(int error)
+{
+    static const char *const messages[] = {
+        "success",
+        "library or version not found",
+        "cannot read file",
+        "malformed or incompatible ELF file",
+        "buffer too small"
+    };
+
+    if (error > 0 || (size_t)-error >= sizeof(messages) / sizeof(messages[0])) {
+        return "unknown error";
+    }
+
+    return messages[-error];
+}
+
+
+/* copy a string into a buffer provided by the caller */
+static int copy_string(const char *str, char *buf, size_t size)
+{
+    size_t len = strlen(str);
+
+    if (len >= size) {
+        return CHECKRT_ERANGE;
+    }
+
+    memcpy(buf, str, len + 1);
+
+    return CHECKRT_OK;
+}
+
+
+int checkrt_system_library_path(const char *soname, char *buf, size_t size)
+{
+    char *path = get_system_library_path(soname, true);
+
+    if (!path) {
+        return CHECKRT_ENOTFOUND;
+    }
+
+    int rv = copy_string(path, buf, size);
+    free(path);
+
+    return rv;
+}
+
+
+int checkrt_symbol_version(const char *path, const char *prefix, char *buf, size_t size)
+{
+    char *version;
+    int rv = symbol_version(path, prefix, "requested", &version);
+
+    if (rv == CHECKRT_OK) {
+        rv = version ? copy_string(version, buf, size) : CHECKRT_ENOTFOUND;
+    }
+
+    free(version);
+
+    return rv;
+}
+
+
+int checkrt_use_bundled(const char *bundled, const char *required)
+{
+    struct lib_check check = {0};
+    const char *name = strrchr(bundled, '/');
+
+    name = name ? name + 1 : bundled;
+
+    for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+        if (strcmp(name, runtime_libs[i].soname) == 0) {
+            check.lib = &runtime_libs[i];
+            break;
+        }
+    }
+
+    if (!check.lib) {
+        return CHECKRT_ENOTFOUND;
+    }
+
+    check.lib_bundle = strdup(bundled);
+    check.required = required ? strdup(required) : NULL;
+
+    int rv = use_bundled_library(&check);
+
+    free(check.lib_bundle);
+    free(check.lib_sys);
+    free(check.sym_bundle);
+    free(check.required);
+
+    return rv;
+}
+
+
+int checkrt_library_dirs(const char *dir, char *buf, size_t size)
+{
+    int res = compare_library_symbols(dir, NULL, NULL);
+
+    if (res < 0) {
+        return res;
+    }
+
+    char *libs = get_library_dirs(dir, res);
+    int rv = copy_string(libs ? libs : "", buf, size);
+    free(libs);
+
+    return rv;
+}
+
+
+int checkrt_library_paths(const char *dir, char *buf, size_t size)
+{
+    int res = compare_library_symbols(dir, NULL, NULL);
+
+    if (res < 0) {
+        return res;
+    }
+
+    char *libs = get_library_paths(dir, res);
+    int rv = copy_string(libs ? libs : "", buf, size);
+    free(libs);
+
+    return rv;
+}
+
+
+/* compare the libraries for the command line and print errors */
+static int compare_library_symbols_or_warn(const char *dir, char **token)
+{
+    char *error_path = NULL;
+    int res = compare_library_symbols(dir, token, &error_path);
+
+    if (res < 0) {
+        warnx("%s: %s", error_path, checkrt_strerror(res));
+        free(error_path);
+    }
+
+    return res;
+}
+
+
+/* compare the libraries for the command line; errors are fatal */
+static int compare_library_symbols_or_exit(const char *dir, char **token)
+{
+    int res = compare_library_symbols_or_warn(dir, token);
+
+    if (res < 0) {
+        exit(1);
+    }
+
+    return res;
+}
+
+
+/* Remember the original value of a variable in APPIMAGE_ORIG_<name> and
+ * list it in APPIMAGE_ORIG_VARS, like the AppRun hook does for exec.so */
+static void save_env(const char *name)
+{
+    const char *vars = getenv("APPIMAGE_ORIG_VARS");
+    size_t len = strlen(name);
+
+    for (const char *p = vars; p && *p; ) {
+        size_t n = strcspn(p, ":");
+        if (n == len && strncmp(p, name, len) == 0)
+            return;
+        p += n;
+        if (*p)
+            p++;
+    }
+
+    char *buf = malloc((vars ? strlen(vars) : 0) + len + sizeof("APPIMAGE_ORIG_") + 1);
+    sprintf(buf, "%s%s%s", vars && *vars ? vars : "", vars && *vars ? ":" : "", name);
+    setenv("APPIMAGE_ORIG_VARS", buf, 1);
+
+    const char *value = getenv(name);
+    if (value) {
+        sprintf(buf, "APPIMAGE_ORIG_%s", name);
+        setenv(buf, value, 1);
+    }
+    free(buf);
+}
+
+
+/* prepend value to a colon separated environment variable unless it was
+ * inherited from a process of the same AppDir; that is if the variable
+ * starts with it or, if "anywhere" is true, contains it */
+static void prepend_env(const char *name, const char *value, bool anywhere)
+{
+    const char *old = getenv(name);
+    size_t len = strlen(value);
+
+    for (const char *p = old; p; p = p ? p + 1 : NULL) {
+        if (strncmp(p, value, len) == 0 && (p[len] == ':' || p[len] == 0)) {
+            return;
+        }
+
+        p = anywhere ? strchr(p, ':') : NULL;
+    }
+
+    save_env(name);
+    old = getenv(name);
+
+    if (old && *old) {
+        char *buf = malloc(strlen(value) + strlen(old) + 2);
+        sprintf(buf, "%s:%s", value, old);
+        setenv(name, buf, 1);
+        free(buf);
+    } else {
+        setenv(name, value, 1);
+    }
+}
+
+
+/* set up the environment for the result like the AppRun hook does */
+static void setup_environment(const char *dir, int res, const char *token)
+{
+    bool preload = use_preload(dir);
+    char *libs = preload ? get_library_paths(dir, res) : get_library_dirs(dir, res);
+
+    if (libs) {
+        prepend_env(preload ? "LD_PRELOAD" : "LD_LIBRARY_PATH", libs, preload);
+        free(libs);
+    }
+
+    /* exec.so restores the original value for external processes */
+    save_env(TOKEN_ENV);
+    setenv(TOKEN_ENV, token, 1);
+
+    char *exec_so = malloc(strlen(dir) + sizeof("/exec.so"));
+    sprintf(exec_so, "%s/exec.so", dir);
+
+    if (access(exec_so, F_OK) == 0) {
+        prepend_env("LD_PRELOAD", exec_so, true);
+    }
+
+    free(exec_so);
+}
+
+
+/* set up the environment and execute the program; if the check fails
+ * it's executed with the environment unchanged, like the AppRun hook does */
+static void exec_program(const char *dir, char **argv)
+{
+    char *token = NULL;
+    int res = compare_library_symbols_or_warn(dir, &token);
+
+    if (res >= 0) {
+        setup_environment(dir, res, token);
+    }
+
+    free(token);
+
+    if (debug_mode) {
+        const char *p;
+        fprintf(stderr, "[DEBUG] LD_LIBRARY_PATH=%s\n", (p = getenv("LD_LIBRARY_PATH")) ? p : "");
+        fprintf(stderr, "[DEBUG] LD_PRELOAD=%s\n", (p = getenv("LD_PRELOAD")) ? p : "");
+    }
+
+    if (trace_file) {
+        trace_event(trace_begin(), "exec", "program", argv[0], "LD_LIBRARY_PATH", getenv("LD_LIBRARY_PATH"), NULL);
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+
+    execvp(argv[0], argv);
+    err(127, "cannot execute: %s", argv[0]);
+}
+
+
+/* library file examined by --scan; every file is parsed only once */
+struct batch_task {
+    const char *root;               /* system root to resolve the library in, NULL if bundled */
+    const struct runtime_lib *lib;
+    char **path;                    /* bundled library, or receives the resolved system library */
+    char **version;                 /* receives the highest version */
+};
+
+
+struct batch_job {
+    struct batch_task *tasks;
+    size_t count;
+    size_t next;  /* index of the next task, shared by all threads */
+};
+
+
+static void *batch_thread(void *arg)
+{
+    struct batch_job *job = arg;
+    struct elf_file elf;
+    size_t i;
+
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count) {
+        struct batch_task *task = &job->tasks[i];
+
+        if (task->root) {
+            *task->path = resolve_library_path(task->root, task->lib->soname);
+        }
+
+        if (*task->path && elf_open(&elf, *task->path, false) == CHECKRT_OK) {
+            *task->version = find_symbol(&elf, task->lib->prefix);
+            elf_close(&elf);
+        }
+    }
+
+    return NULL;
+}
+
+
+/* Compare the bundled libraries of every AppDir with the system libraries
+ * of every system root and print the decisions as a tab separated table.
+ * The libraries are parsed in parallel, each file only once; bundled
+ * versions are taken from the manifest where possible. */
+static void batch_scan(char **appdirs, size_t nappdirs, char **roots, size_t nroots)
+{
+    struct batch_job job = {0};
+    struct lib_check (*checks)[RUNTIME_LIBS_NUM] = calloc(nappdirs, sizeof(*checks));
+    char *(*sys_path)[RUNTIME_LIBS_NUM] = calloc(nroots, sizeof(*sys_path));
+    char *(*sys_version)[RUNTIME_LIBS_NUM] = calloc(nroots, sizeof(*sys_version));
+    bool (*present)[RUNTIME_LIBS_NUM] = calloc(nappdirs, sizeof(*present));
+
+    /* a mistyped path would otherwise show up as missing libraries */
+    for (size_t r = 0; r < nroots; r++) {
+        int fd = open(roots[r], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+        if (fd == -1) {
+            err(1, "cannot open system root: %s", roots[r]);
+        }
+
+        close(fd);
+    }
+
+    job.tasks = calloc((nappdirs + nroots) * RUNTIME_LIBS_NUM, sizeof(struct batch_task));
+
+    for (size_t a = 0; a < nappdirs; a++) {
+        char *dir = malloc(strlen(appdirs[a]) + sizeof("/checkrt"));
+        sprintf(dir, "%s/checkrt", appdirs[a]);
+
+        for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+            const struct runtime_lib *lib = &runtime_libs[i];
+            struct lib_check *check = &checks[a][i];
+
+            check->lib = lib;
+            check->lib_bundle = malloc(strlen(dir) + strlen(lib->subdir) + strlen(lib->soname) + 3);
+            sprintf(check->lib_bundle, "%s/%s/%s", dir, lib->subdir, lib->soname);
+        }
+
+        read_manifest(dir, checks[a]);
+
+        for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+            struct lib_check *check = &checks[a][i];
+
+            present[a][i] = (access(check->lib_bundle, F_OK) == 0);
+
+            if (present[a][i] && !check->has_manifest) {
+                job.tasks[job.count++] = (struct batch_task) {
+                    NULL, check->lib, &check->lib_bundle, &check->sym_bundle
+                };
+            }
+        }
+
+        free(dir);
+    }
+
+    for (size_t r = 0; r < nroots; r++) {
+        for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+            job.tasks[job.count++] = (struct batch_task) {
+                roots[r], &runtime_libs[i], &sys_path[r][i], &sys_version[r][i]
+            };
+        }
+    }
+
+    run_threads(batch_thread, &job, job.count);
+
+    printf("appdir\tsysroot\tlibrary\tbundled\tsystem\trequired\tuse\n");
+
+    for (size_t a = 0; a < nappdirs; a++) {
+        for (size_t r = 0; r < nroots; r++) {
+            for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+                struct lib_check *check = &checks[a][i];
+
+                if (!present[a][i]) {
+                    continue;
+                }
+
+                bool bundled = prefer_bundled(check->sym_bundle, sys_path[r][i], sys_version[r][i], check->required);
+
+                printf("%s\t%s\t%s\t%s\t%s\t%s\t%s\n", appdirs[a], roots[r], runtime_libs[i].soname,
+                    check->sym_bundle ? check->sym_bundle : "-",
+                    sys_version[r][i] ? sys_version[r][i] : (sys_path[r][i] ? "-" : "missing"),
+                    check->required ? check->required : "-",
+                    bundled ? "bundled" : "system");
+            }
+        }
+    }
+
+    for (size_t a = 0; a < nappdirs; a++) {
+        for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+            free(checks[a][i].lib_bundle);
+            free(checks[a][i].sym_bundle);
+            free(checks[a][i].required);
+        }
+    }
+
+    for (size_t r = 0; r < nroots; r++) {
+        for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+            free(sys_path[r][i]);
+            free(sys_version[r][i]);
+        }
+    }
+
+    free(job.tasks);
+    free(checks);
+    free(present);
+    free(sys_path);
+    free(sys_version);
+}
+
+
+#ifndef CHECKRT_LIBRARY
+int main(int argc, char **argv)
+{
+    const char *usage =
+        "usage: %s [--token] [--preload]\n"
+        "       %s --copy|--help\n"
+        "       %s --exec <program> [<args>...]\n"
+        "       %s --scan <appdir>... [--sysroot <dir>...]\n"
+        "\n"
+        "  --copy     copy the system libraries next to the executable\n"
+        "  --token    print a token for " TOKEN_ENV " after the library directories;\n"
+        "             a valid token in the environment is used instead of checking\n"
+        "  --preload  print the paths of the bundled libraries to preload instead\n"
+        "             of their directories\n"
+        "  --exec     set up the library search path and execute program\n"
+        "  --scan     compare the libraries bundled in each AppDir with those of\n"
+        "             each system root (default: /) and print a table\n"
+        "  --help     print this message\n"
+        "\n"
+        "Set environment variable CHECKRT_DEBUG to enable extra verbose output.\n"
+        "Set CHECKRT_DEBUG=FULL to enable full verbosity.\n"
+        "Set CHECKRT_NOCACHE to ignore and not write the result cache.\n"
+        "Set CHECKRT_PRECISE with --copy to record the imported symbols and\n"
+        "compare the system libraries by symbol instead of by version.\n"
+        "Set CHECKRT_STRIP with --copy to remove sections not needed at runtime.\n"
+        "Set CHECKRT_PRELOAD with --copy to let the AppRun hook and --exec preload\n"
+        "the bundled libraries instead of setting LD_LIBRARY_PATH.\n"
+        "Set CHECKRT_TRACE to a file path to append per-phase timings as JSON lines.\n";
+
+    char *env = getenv("CHECKRT_DEBUG");
+
+    if (env && *env) {
+        /* environment variable is non-empty */
+        if (strcasecmp(env, "full") == 0) {
+            full_debug_mode = true;
+        }
+        debug_mode = true;
+    }
+
+    env = getenv("CHECKRT_TRACE");
+
+    if (env && *env && (trace_file = fopen(env, "ae")) == NULL) {
+        warn("cannot open trace file: %s", env);
+    }
+
+    uint64_t main_start = trace_begin();
+
+    /* check and print the result, optionally with a token and as paths */
+    bool want_token = false, preload = false, print_result = true;
+
+    for (int i = 1; i < argc && print_result; i++) {
+        if (strcmp(argv[i], "--token") == 0 && !want_token) {
+            want_token = true;
+        } else if (strcmp(argv[i], "--preload") == 0 && !preload) {
+            preload = true;
+        } else {
+            print_result = false;
+        }
+    }
+
+    if (print_result) {
+        char *dir = get_exe_dir();
+        char *token = NULL;
+        int res = compare_library_symbols_or_exit(dir, want_token ? &token : NULL);
+        char *libs = preload ? get_library_paths(dir, res) : get_library_dirs(dir, res);
+
+        uint64_t start = trace_begin();
+
+        if (token) {
+            printf("%s\n%s\n", libs ? libs : "", token);
+            fflush(stdout);
+        } else if (libs) {
+            printf("%s\n", libs);
+            fflush(stdout);
+        }
+
+        trace_event(start, "output", preload ? "paths" : "dirs", libs, NULL);
+        trace_event(main_start, "total", "dir", dir, NULL);
+
+        free(token);
+        free(libs);
+        free(dir);
+        return 0;
+    }
+
+    if (argc > 2 && strcmp(argv[1], "--exec") == 0) {
+        char *dir = get_exe_dir();
+        exec_program(dir, argv + 2);
+    }
+
+    if (argc == 2 && strcmp(argv[1], "--copy") == 0) {
+        /* copy system libraries next to executable */
+        char *dir = get_exe_dir();
+        const char *strip = getenv("CHECKRT_STRIP");
+
+        /* the optional libraries are copied by scan_requirements() if needed */
+        for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+            if (runtime_libs[i].optional) {
+                remove_lib(dir, &runtime_libs[i]);
+                continue;
+            }
+
+            uint64_t start = trace_begin();
+            free(copy_lib(dir, &runtime_libs[i], strip && *strip));
+            trace_event(start, "copy", "lib", runtime_libs[i].soname, NULL);
+        }
+
+        char *required[RUNTIME_LIBS_NUM] = {0};
+        const char *precise = getenv("CHECKRT_PRECISE");
+        uint64_t start = trace_begin();
+        scan_requirements(dir, required, precise && *precise, strip && *strip);
+        trace_event(start, "scan_requirements", "dir", dir, NULL);
+
+        start = trace_begin();
+        write_manifest(dir, required);
+        trace_event(start, "manifest_write", "dir", dir, NULL);
+
+        const char *preload_env = getenv("CHECKRT_PRELOAD");
+        write_preload_file(dir, preload_env && *preload_env);
+        trace_event(main_start, "total", "dir", dir, NULL);
+
+        for (size_t i = 0; i < RUNTIME_LIBS_NUM; i++) {
+            free(required[i]);
+        }
+
+        free(dir);
+        return 0;
+    }
+
+    if (argc > 2 && strcmp(argv[1], "--scan") == 0) {
+        char *default_root[] = { "/" };
+        char **roots = default_root;
+        size_t nappdirs = 0, nroots = 1;
+
+        while (2 + nappdirs < (size_t)argc && strcmp(argv[2 + nappdirs], "--sysroot") != 0) {
+            nappdirs++;
+        }
+
+        if (2 + nappdirs < (size_t)argc) {
+            roots = argv + 2 + nappdirs + 1;
+            nroots = argc - (2 + nappdirs + 1);
+        }
+
+        if (nappdirs > 0 && nroots > 0) {
+            batch_scan(argv + 2, nappdirs, roots, nroots);
+            trace_event(main_start, "total", "dir", NULL, NULL);
+            return 0;
+        }
+    }
+
+    if (argc == 2 && strcmp(argv[1], "--help") == 0) {
+        fprintf(stderr, usage, argv[0], argv[0], argv[0], argv[0]);
+        return 0;
+    }
+
+    fprintf(stderr, "%s\n", "error: unknown argument(s) given");
+    fprintf(stderr, usage, argv[0], argv[0], argv[0], argv[0]);
+
+    return 1;
+}
+#endif /* !CHECKRT_LIBRARY */
+
+__EOF__
+
+    cat > checkrt.h << \__EOF__
+/* Copyright (c) 2022-2025 Carsten Janssen <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/*
+ * libcheckrt makes the decision of checkrt available to a native AppRun,
+ * so that it doesn't need to run checkrt and parse its output.
+ *
+ * Compile checkrt.c with CHECKRT_LIBRARY defined and link the object file
+ * into the program:
+ *
+ *   cc -O2 -DCHECKRT_LIBRARY -c checkrt.c -o libcheckrt.o
+ *   cc myapprun.c libcheckrt.o -o AppRun -pthread -ldl
+ *
+ * Add CHECKRT_STATIC to leave out the dlmopen() fallback and libdl.
+ *
+ * All functions can be called concurrently from multiple threads. They never
+ * print anything or exit the process; errors are returned as negative codes
+ * and strings are written to buffers provided by the caller.
+ */
+#ifndef CHECKRT_H
+#define CHECKRT_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* return codes of the checkrt_*() functions */
+enum checkrt_error {
+    CHECKRT_OK        =  0,
+    CHECKRT_ENOTFOUND = -1,  /* library or version not found */
+    CHECKRT_EIO       = -2,  /* file cannot be opened or read */
+    CHECKRT_EFORMAT   = -3,  /* malformed or incompatible ELF file */
+    CHECKRT_ERANGE    = -4   /* buffer too small */
+};
+
+/* get a description of an error code */
+const char *checkrt_strerror(int error);
+
+/* Resolve the path of a system library in the same order as ld.so.
+ * Libraries that can't be found in LD_LIBRARY_PATH, ld.so.cache or the
+ * default directories are loaded with dlmopen() into a new namespace. */
+int checkrt_system_library_path(const char *soname, char *buf, size_t size);
+
+/* Get the highest version with the given prefix (e.g. "GLIBCXX_")
+ * defined by a library. */
+int checkrt_symbol_version(const char *path, const char *prefix, char *buf, size_t size);
+
+/* Decide whether a bundled GCC runtime library should be used instead
+ * of the system one. "required" is the highest version required by the
+ * application or NULL. Returns 1 for the bundled library, 0 for the
+ * system library or an error code. */
+int checkrt_use_bundled(const char *bundled, const char *required);
+
+/* Make the decision of checkrt for the checkrt directory of an AppDir,
+ * including its manifest and the result cache, and write the library
+ * directories to prepend to LD_LIBRARY_PATH to "buf" (colon separated,
+ * empty if no bundled library is used). */
+int checkrt_library_dirs(const char *dir, char *buf, size_t size);
+
+/* Like checkrt_library_dirs(), but write the absolute paths of the bundled
+ * libraries to add to LD_PRELOAD instead of their directories. */
+int checkrt_library_paths(const char *dir, char *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CHECKRT_H */
+
+__EOF__
+
+    cat > COPYING << \__EOF__
+checkrt.c: 2022-2023 <djcj@gmx.de>
+exec.c: 2018 Pablo Marcos Oltra <pablo.marcos.oltra@gmail.com>
+
+The MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+
+__EOF__
+
+    cat > COPYING3 << \__EOF__
+                    GNU GENERAL PUBLIC LICENSE
+                       Version 3, 29 June 2007
+
+ Copyright (C) 2007 Free Software Foundation, Inc. <http://fsf.org/>
+ Everyone is permitted to copy and distribute verbatim copies
+ of this license document, but changing it is not allowed.
+
+                            Preamble
+
+  The GNU General Public License is a free, copyleft license for
+software and other kinds of works.
+
+  The licenses for most software and other practical works are designed
+to take away your freedom to share and change the works.  By contrast,
+the GNU General Public License is intended to guarantee your freedom to
+share and change all versions of a program--to make sure it remains free
+software for all its users.  We, the Free Software Foundation, use the
+GNU General Public License for most of our software; it applies also to
+any other work released this way by its authors.  You can apply it to
+your programs, too.
+
+  When we speak of free software, we are referring to freedom, not
+price.  Our General Public Licenses are designed to make sure that you
+have the freedom to distribute copies of free software (and charge for
+them if you wish), that you receive source code or can get it if you
+want it, that you can change the software or use pieces of it in new
+free programs, and that you know you can do these things.
+
+  To protect your rights, we need to prevent others from denying you
+these rights or asking you to surrender the rights.  Therefore, you have
+certain responsibilities if you distribute copies of the software, or if
+you modify it: responsibilities to respect the freedom of others.
+
+  For example, if you distribute copies of such a program, whether
+gratis or for a fee, you must pass on to the recipients the same
+freedoms that you received.  You must make sure that they, too, receive
+or can get the source code.  And you must show them these terms so they
+know their rights.
+
+  Developers that use the GNU GPL protect your rights with two steps:
+(1) assert copyright on the software, and (2) offer you this License
+giving you legal permission to copy, distribute and/or modify it.
+
+  For the developers' and authors' protection, the GPL clearly explains
+that there is no warranty for this free software.  For both users' and
+authors' sake, the GPL requires that modified versions be marked as
+changed, so that their problems will not be attributed erroneously to
+authors of previous versions.
+
+  Some devices are designed to deny users access to install or run
+modified versions of the software inside them, although the manufacturer
+can do so.  This is fundamentally incompatible with the aim of
+protecting users' freedom to change the software.  The systematic
+pattern of such abuse occurs in the area of products for individuals to
+use, which is precisely where it is most unacceptable.  Therefore, we
+have designed this version of the GPL to prohibit the practice for those
+products.  If such problems arise substantially in other domains, we
+stand ready to extend this provision to those domains in future versions
+of the GPL, as needed to protect the freedom of users.
+
+  Finally, every program is threatened constantly by software patents.
+States should not allow patents to restrict development and use of
+software on general-purpose computers, but in those that do, we wish to
+avoid the special danger that patents applied to a free program could
+make it effectively proprietary.  To prevent this, the GPL assures that
+patents cannot be used to render the program non-free.
+
+  The precise terms and conditions for copying, distribution and
+modification follow.
+
+                       TERMS AND CONDITIONS
+
+  0. Definitions.
+
+  "This License" refers to version 3 of the GNU General Public License.
+
+  "Copyright" also means copyright-like laws that apply to other kinds of
+works, such as semiconductor masks.
+
+  "The Program" refers to any copyrightable work licensed under this
+License.  Each licensee is addressed as "you".  "Licensees" and
+"recipients" may be individuals or organizations.
+
+  To "modify" a work means to copy from or adapt all or part of the work
+in a fashion requiring copyright permission, other than the making of an
+exact copy.  The resulting work is called a "modified version" of the
+earlier work or a work "based on" the earlier work.
+
+  A "covered work" means either the unmodified Program or a work based
+on the Program.
+
+  To "propagate" a work means to do anything with it that, without
+permission, would make you directly or secondarily liable for
+infringement under applicable copyright law, except executing it on a
+computer or modifying a private copy.  Propagation includes copying,
+distribution (with or without modification), making available to the
+public, and in some countries other activities as well.
+
+  To "convey" a work means any kind of propagation that enables other
+parties to make or receive copies.  Mere interaction with a user through
+a computer network, with no transfer of a copy, is not conveying.
+
+  An interactive user interface displays "Appropriate Legal Notices"
+to the extent that it includes a convenient and prominently visible
+feature that (1) displays an appropriate copyright notice, and (2)
+tells the user that there is no warranty for the work (except to the
+extent that warranties are provided), that licensees may convey the
+work under this License, and how to view a copy of this License.  If
+the interface presents a list of user commands or options, such as a
+menu, a prominent item in the list meets this criterion.
+
+  1. Source Code.
+
+  The "source code" for a work means the preferred form of the work
+for making modifications to it.  "Object code" means any non-source
+form of a work.
+
+  A "Standard Interface" means an interface that either is an official
+standard defined by a recognized standards body, or, in the case of
+interfaces specified for a particular programming language, one that
+is widely used among developers working in that language.
+
+  The "System Libraries" of an executable work include anything, other
+than the work as a whole, that (a) is included in the normal form of
+packaging a Major Component, but which is not part of that Major
+Component, and (b) serves only to enable use of the work with that
+Major Component, or to implement a Standard Interface for which an
+implementation is available to the public in source code form.  A
+"Major Component", in this context, means a major essential component
+(kernel, window system, and so on) of the specific operating system
+(if any) on which the executable work runs, or a compiler used to
+produce the work, or an object code interpreter used to run it.
+
+  The "Corresponding Source" for a work in object code form means all
+the source code needed to generate, install, and (for an executable
+work) run the object code and to modify the work, including scripts to
+control those activities.  However, it does not include the work's
+System Libraries, or general-purpose tools or generally available free
+programs which are used unmodified in performing those activities but
+which are not part of the work.  For example, Corresponding Source
+includes interface definition files associated with source files for
+the work, and the source code for shared libraries and dynamically
+linked subprograms that the work is specifically designed to require,
+such as by intimate data communication or control flow between those
+subprograms and other parts of the work.
+
+  The Corresponding Source need not include anything that users
+can regenerate automatically from other parts of the Corresponding
+Source.
+
+  The Corresponding Source for a work in source code form is that
+same work.
+
+  2. Basic Permissions.
+
+  All rights granted under this License are granted for the term of
+copyright on the Program, and are irrevocable provided the stated
+conditions are met.  This License explicitly affirms your unlimited
+permission to run the unmodified Program.  The output from running a
+covered work is covered by this License only if the output, given its
+content, constitutes a covered work.  This License acknowledges your
+rights of fair use or other equivalent, as provided by copyright law.
+
+  You may make, run and propagate covered works that you do not
+convey, without conditions so long as your license otherwise remains
+in force.  You may convey covered works to others for the sole purpose
+of having them make modifications exclusively for you, or provide you
+with facilities for running those works, provided that you comply with
+the terms of this License in conveying all material for which you do
+not control copyright.  Those thus making or running the covered works
+for you must do so exclusively on your behalf, under your direction
+and control, on terms that prohibit them from making any copies of
+your copyrighted material outside their relationship with you.
+
+  Conveying under any other circumstances is permitted solely under
+the conditions stated below.  Sublicensing is not allowed; section 10
+makes it unnecessary.
+
+  3. Protecting Users' Legal Rights From Anti-Circumvention Law.
+
+  No covered work shall be deemed part of an effective technological
+measure under any applicable law fulfilling obligations under article
+11 of the WIPO copyright treaty adopted on 20 December 1996, or
+similar laws prohibiting or restricting circumvention of such
+measures.
+
+  When you convey a covered work, you waive any legal power to forbid
+circumvention of technological measures to the extent such circumvention
+is effected by exercising rights under this License with respect to
+the covered work, and you disclaim any intention to limit operation or
+modification of the work as a means of enforcing, against the work's
+users, your or third parties' legal rights to forbid circumvention of
+technological measures.
+
+  4. Conveying Verbatim Copies.
+
+  You may convey verbatim copies of the Program's source code as you
+receive it, in any medium, provided that you conspicuously and
+appropriately publish on each copy an appropriate copyright notice;
+keep intact all notices stating that this License and any
+non-permissive terms added in accord with section 7 apply to the code;
+keep intact all notices of the absence of any warranty; and give all
+recipients a copy of this License along with the Program.
+
+  You may charge any price or no price for each copy that you convey,
+and you may offer support or warranty protection for a fee.
+
+  5. Conveying Modified Source Versions.
+
+  You may convey a work based on the Program, or the modifications to
+produce it from the Program, in the form of source code under the
+terms of section 4, provided that you also meet all of these conditions:
+
+    a) The work must carry prominent notices stating that you modified
+    it, and giving a relevant date.
+
+    b) The work must carry prominent notices stating that it is
+    released under this License and any conditions added under section
+    7.  This requirement modifies the requirement in section 4 to
+    "keep intact all notices".
+
+    c) You must license the entire work, as a whole, under this
+    License to anyone who comes into possession of a copy.  This
+    License will therefore apply, along with any applicable section 7
+    additional terms, to the whole of the work, and all its parts,
+    regardless of how they are packaged.  This License gives no
+    permission to license the work in any other way, but it does not
+    invalidate such permission if you have separately received it.
+
+    d) If the work has interactive user interfaces, each must display
+    Appropriate Legal Notices; however, if the Program has interactive
+    interfaces that do not display Appropriate Legal Notices, your
+    work need not make them do so.
+
+  A compilation of a covered work with other separate and independent
+works, which are not by their nature extensions of the covered work,
+and which are not combined with it such as to form a larger program,
+in or on a volume of a storage or distribution medium, is called an
+"aggregate" if the compilation and its resulting copyright are not
+used to limit the access or legal rights of the compilation's users
+beyond what the individual works permit.  Inclusion of a covered work
+in an aggregate does not cause this License to apply to the other
+parts of the aggregate.
+
+  6. Conveying Non-Source Forms.
+
+  You may convey a covered work in object code form under the terms
+of sections 4 and 5, provided that you also convey the
+machine-readable Corresponding Source under the terms of this License,
+in one of these ways:
+
+    a) Convey the object code in, or embodied in, a physical product
+    (including a physical distribution medium), accompanied by the
+    Corresponding Source fixed on a durable physical medium
+    customarily used for software interchange.
+
+    b) Convey the object code in, or embodied in, a physical product
+    (including a physical distribution medium), accompanied by a
+    written offer, valid for at least three years and valid for as
+    long as you offer spare parts or customer support for that product
+    model, to give anyone who possesses the object code either (1) a
+    copy of the Corresponding Source for all the software in the
+    product that is covered by this License, on a durable physical
+    medium customarily used for software interchange, for a price no
+    more than your reasonable cost of physically performing this
+    conveying of source, or (2) access to copy the
+    Corresponding Source from a network server at no charge.
+
+    c) Convey individual copies of the object code with a copy of the
+    written offer to provide the Corresponding Source.  This
+    alternative is allowed only occasionally and noncommercially, and
+    only if you received the object code with such an offer, in accord
+    with subsection 6b.
+
+    d) Convey the object code by offering access from a designated
+    place (gratis or for a charge), and offer equivalent access to the
+    Corresponding Source in the same way through the same place at no
+    further charge.  You need not require recipients to copy the
+    Corresponding Source along with the object code.  If the place to
+    copy the object code is a network server, the Corresponding Source
+    may be on a different server (operated by you or a third party)
+    that supports equivalent copying facilities, provided you maintain
+    clear directions next to the object code saying where to find the
+    Corresponding Source.  Regardless of what server hosts the
+    Corresponding Source, you remain obligated to ensure that it is
+    available for as long as needed to satisfy these requirements.
+
+    e) Convey the object code using peer-to-peer transmission, provided
+    you inform other peers where the object code and Corresponding
+    Source of the work are being offered to the general public at no
+    charge under subsection 6d.
+
+  A separable portion of the object code, whose source code is excluded
+from the Corresponding Source as a System Library, need not be
+included in conveying the object code work.
+
+  A "User Product" is either (1) a "consumer product", which means any
+tangible personal property which is normally used for personal, family,
+or household purposes, or (2) anything designed or sold for incorporation
+into a dwelling.  In determining whether a product is a consumer product,
+doubtful cases shall be resolved in favor of coverage.  For a particular
+product received by a particular user, "normally used" refers to a
+typical or common use of that class of product, regardless of the status
+of the particular user or of the way in which the particular user
+actually uses, or expects or is expected to use, the product.  A product
+is a consumer product regardless of whether the product has substantial
+commercial, industrial or non-consumer uses, unless such uses represent
+the only significant mode of use of the product.
+
+  "Installation Information" for a User Product means any methods,
+procedures, authorization keys, or other information required to install
+and execute modified versions of a covered work in that User Product from
+a modified version of its Corresponding Source.  The information must
+suffice to ensure that the continued functioning of the modified object
+code is in no case prevented or interfered with solely because
+modification has been made.
+
+  If you convey an object code work under this section in, or with, or
+specifically for use in, a User Product, and the conveying occurs as
+part of a transaction in which the right of possession and use of the
+User Product is transferred to the recipient in perpetuity or for a
+fixed term (regardless of how the transaction is characterized), the
+Corresponding Source conveyed under this section must be accompanied
+by the Installation Information.  But this requirement does not apply
+if neither you nor any third party retains the ability to install
+modified object code on the User Product (for example, the work has
+been installed in ROM).
+
+  The requirement to provide Installation Information does not include a
+requirement to continue to provide support service, warranty, or updates
+for a work that has been modified or installed by the recipient, or for
+the User Product in which it has been modified or installed.  Access to a
+network may be denied when the modification itself materially and
+adversely affects the operation of the network or violates the rules and
+protocols for communication across the network.
+
+  Corresponding Source conveyed, and Installation Information provided,
+in accord with this section must be in a format that is publicly
+documented (and with an implementation available to the public in
+source code form), and must require no special password or key for
+unpacking, reading or copying.
+
+  7. Additional Terms.
+
+  "Additional permissions" are terms that supplement the terms of this
+License by making exceptions from one or more of its conditions.
+Additional permissions that are applicable to the entire Program shall
+be treated as though they were included in this License, to the extent
+that they are valid under applicable law.  If additional permissions
+apply only to part of the Program, that part may be used separately
+under those permissions, but the entire Program remains governed by
+this License without regard to the additional permissions.
+
+  When you convey a copy of a covered work, you may at your option
+remove any additional permissions from that copy, or from any part of
+it.  (Additional permissions may be written to require their own
+removal in certain cases when you modify the work.)  You may place
+additional permissions on material, added by you to a covered work,
+for which you have or can give appropriate copyright permission.
+
+  Notwithstanding any other provision of this License, for material you
+add to a covered work, you may (if authorized by the copyright holders of
+that material) supplement the terms of this License with terms:
+
+    a) Disclaiming warranty or limiting liability differently from the
+    terms of sections 15 and 16 of this License; or
+
+    b) Requiring preservation of specified reasonable legal notices or
+    author attributions in that material or in the Appropriate Legal
+    Notices displayed by works containing it; or
+
+    c) Prohibiting misrepresentation of the origin of that material, or
+    requiring that modified versions of such material be marked in
+    reasonable ways as different from the original version; or
+
+    d) Limiting the use for publicity purposes of names of licensors or
+    authors of the material; or
+
+    e) Declining to grant rights under trademark law for use of some
+    trade names, trademarks, or service marks; or
+
+    f) Requiring indemnification of licensors and authors of that
+    material by anyone who conveys the material (or modified versions of
+    it) with contractual assumptions of liability to the recipient, for
+    any liability that these contractual assumptions directly impose on
+    those licensors and authors.
+
+  All other non-permissive additional terms are considered "further
+restrictions" within the meaning of section 10.  If the Program as you
+received it, or any part of it, contains a notice stating that it is
+governed by this License along with a term that is a further
+restriction, you may remove that term.  If a license document contains
+a further restriction but permits relicensing or conveying under this
+License, you may add to a covered work material governed by the terms
+of that license document, provided that the further restriction does
+not survive such relicensing or conveying.
+
+  If you add terms to a covered work in accord with this section, you
+must place, in the relevant source files, a statement of the
+additional terms that apply to those files, or a notice indicating
+where to find the applicable terms.
+
+  Additional terms, permissive or non-permissive, may be stated in the
+form of a separately written license, or stated as exceptions;
+the above requirements apply either way.
+
+  8. Termination.
+
+  You may not propagate or modify a covered work except as expressly
+provided under this License.  Any attempt otherwise to propagate or
+modify it is void, and will automatically terminate your rights under
+this License (including any patent licenses granted under the third
+paragraph of section 11).
+
+  However, if you cease all violation of this License, then your
+license from a particular copyright holder is reinstated (a)
+provisionally, unless and until the copyright holder explicitly and
+finally terminates your license, and (b) permanently, if the copyright
+holder fails to notify you of the violation by some reasonable means
+prior to 60 days after the cessation.
+
+  Moreover, your license from a particular copyright holder is
+reinstated permanently if the copyright holder notifies you of the
+violation by some reasonable means, this is the first time you have
+received notice of violation of this License (for any work) from that
+copyright holder, and you cure the violation prior to 30 days after
+your receipt of the notice.
+
+  Termination of your rights under this section does not terminate the
+licenses of parties who have received copies or rights from you under
+this License.  If your rights have been terminated and not permanently
+reinstated, you do not qualify to receive new licenses for the same
+material under section 10.
+
+  9. Acceptance Not Required for Having Copies.
+
+  You are not required to accept this License in order to receive or
+run a copy of the Program.  Ancillary propagation of a covered work
+occurring solely as a consequence of using peer-to-peer transmission
+to receive a copy likewise does not require acceptance.  However,
+nothing other than this License grants you permission to propagate or
+modify any covered work.  These actions infringe copyright if you do
+not accept this License.  Therefore, by modifying or propagating a
+covered work, you indicate your acceptance of this License to do so.
+
+  10. Automatic Licensing of Downstream Recipients.
+
+  Each time you convey a covered work, the recipient automatically
+receives a license from the original licensors, to run, modify and
+propagate that work, subject to this License.  You are not responsible
+for enforcing compliance by third parties with this License.
+
+  An "entity transaction" is a transaction transferring control of an
+organization, or substantially all assets of one, or subdividing an
+organization, or merging organizations.  If propagation of a covered
+work results from an entity transaction, each party to that
+transaction who receives a copy of the work also receives whatever
+licenses to the work the party's predecessor in interest had or could
+give under the previous paragraph, plus a right to possession of the
+Corresponding Source of the work from the predecessor in interest, if
+the predecessor has it or can get it with reasonable efforts.
+
+  You may not impose any further restrictions on the exercise of the
+rights granted or affirmed under this License.  For example, you may
+not impose a license fee, royalty, or other charge for exercise of
+rights granted under this License, and you may not initiate litigation
+(including a cross-claim or counterclaim in a lawsuit) alleging that
+any patent claim is infringed by making, using, selling, offering for
+sale, or importing the Program or any portion of it.
+
+  11. Patents.
+
+  A "contributor" is a copyright holder who authorizes use under this
+License of the Program or a work on which the Program is based.  The
+work thus licensed is called the contributor's "contributor version".
+
+  A contributor's "essential patent claims" are all patent claims
+owned or controlled by the contributor, whether already acquired or
+hereafter acquired, that would be infringed by some manner, permitted
+by this License, of making, using, or selling its contributor version,
+but do not include claims that would be infringed only as a
+consequence of further modification of the contributor version.  For
+purposes of this definition, "control" includes the right to grant
+patent sublicenses in a manner consistent with the requirements of
+this License.
+
+  Each contributor grants you a non-exclusive, worldwide, royalty-free
+patent license under the contributor's essential patent claims, to
+make, use, sell, offer for sale, import and otherwise run, modify and
+propagate the contents of its contributor version.
+
+  In the following three paragraphs, a "patent license" is any express
+agreement or commitment, however denominated, not to enforce a patent
+(such as an express permission to practice a patent or covenant not to
+sue for patent infringement).  To "grant" such a patent license to a
+party means to make such an agreement or commitment not to enforce a
+patent against the party.
+
+  If you convey a covered work, knowingly relying on a patent license,
+and the Corresponding Source of the work is not available for anyone
+to copy, free of charge and under the terms of this License, through a
+publicly available network server or other readily accessible means,
+then you must either (1) cause the Corresponding Source to be so
+available, or (2) arrange to deprive yourself of the benefit of the
+patent license for this particular work, or (3) arrange, in a manner
+consistent with the requirements of this License, to extend the patent
+license to downstream recipients.  "Knowingly relying" means you have
+actual knowledge that, but for the patent license, your conveying the
+covered work in a country, or your recipient's use of the covered work
+in a country, would infringe one or more identifiable patents in that
+country that you have reason to believe are valid.
+
+  If, pursuant to or in connection with a single transaction or
+arrangement, you convey, or propagate by procuring conveyance of, a
+covered work, and grant a patent license to some of the parties
+receiving the covered work authorizing them to use, propagate, modify
+or convey a specific copy of the covered work, then the patent license
+you grant is automatically extended to all recipients of the covered
+work and works based on it.
+
+  A patent license is "discriminatory" if it does not include within
+the scope of its coverage, prohibits the exercise of, or is
+conditioned on the non-exercise of one or more of the rights that are
+specifically granted under this License.  You may not convey a covered
+work if you are a party to an arrangement with a third party that is
+in the business of distributing software, under which you make payment
+to the third party based on the extent of your activity of conveying
+the work, and under which the third party grants, to any of the
+parties who would receive the covered work from you, a discriminatory
+patent license (a) in connection with copies of the covered work
+conveyed by you (or copies made from those copies), or (b) primarily
+for and in connection with specific products or compilations that
+contain the covered work, unless you entered into that arrangement,
+or that patent license was granted, prior to 28 March 2007.
+
+  Nothing in this License shall be construed as excluding or limiting
+any implied license or other defenses to infringement that may
+otherwise be available to you under applicable patent law.
+
+  12. No Surrender of Others' Freedom.
+
+  If conditions are imposed on you (whether by court order, agreement or
+otherwise) that contradict the conditions of this License, they do not
+excuse you from the conditions of this License.  If you cannot convey a
+covered work so as to satisfy simultaneously your obligations under this
+License and any other pertinent obligations, then as a consequence you may
+not convey it at all.  For example, if you agree to terms that obligate you
+to collect a royalty for further conveying from those to whom you convey
+the Program, the only way you could satisfy both those terms and this
+License would be to refrain entirely from conveying the Program.
+
+  13. Use with the GNU Affero General Public License.
+
+  Notwithstanding any other provision of this License, you have
+permission to link or combine any covered work with a work licensed
+under version 3 of the GNU Affero General Public License into a single
+combined work, and to convey the resulting work.  The terms of this
+License will continue to apply to the part which is the covered work,
+but the special requirements of the GNU Affero General Public License,
+section 13, concerning interaction through a network will apply to the
+combination as such.
+
+  14. Revised Versions of this License.
+
+  The Free Software Foundation may publish revised and/or new versions of
+the GNU General Public License from time to time.  Such new versions will
+be similar in spirit to the present version, but may differ in detail to
+address new problems or concerns.
+
+  Each version is given a distinguishing version number.  If the
+Program specifies that a certain numbered version of the GNU General
+Public License "or any later version" applies to it, you have the
+option of following the terms and conditions either of that numbered
+version or of any later version published by the Free Software
+Foundation.  If the Program does not specify a version number of the
+GNU General Public License, you may choose any version ever published
+by the Free Software Foundation.
+
+  If the Program specifies that a proxy can decide which future
+versions of the GNU General Public License can be used, that proxy's
+public statement of acceptance of a version permanently authorizes you
+to choose that version for the Program.
+
+  Later license versions may give you additional or different
+permissions.  However, no additional obligations are imposed on any
+author or copyright holder as a result of your choosing to follow a
+later version.
+
+  15. Disclaimer of Warranty.
+
+  THERE IS NO WARRANTY FOR THE PROGRAM, TO THE EXTENT PERMITTED BY
+APPLICABLE LAW.  EXCEPT WHEN OTHERWISE STATED IN WRITING THE COPYRIGHT
+HOLDERS AND/OR OTHER PARTIES PROVIDE THE PROGRAM "AS IS" WITHOUT WARRANTY
+OF ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE.  THE ENTIRE RISK AS TO THE QUALITY AND PERFORMANCE OF THE PROGRAM
+IS WITH YOU.  SHOULD THE PROGRAM PROVE DEFECTIVE, YOU ASSUME THE COST OF
+ALL NECESSARY SERVICING, REPAIR OR CORRECTION.
+
+  16. Limitation of Liability.
+
+  IN NO EVENT UNLESS REQUIRED BY APPLICABLE LAW OR AGREED TO IN WRITING
+WILL ANY COPYRIGHT HOLDER, OR ANY OTHER PARTY WHO MODIFIES AND/OR CONVEYS
+THE PROGRAM AS PERMITTED ABOVE, BE LIABLE TO YOU FOR DAMAGES, INCLUDING ANY
+GENERAL, SPECIAL, INCIDENTAL OR CONSEQUENTIAL DAMAGES ARISING OUT OF THE
+USE OR INABILITY TO USE THE PROGRAM (INCLUDING BUT NOT LIMITED TO LOSS OF
+DATA OR DATA BEING RENDERED INACCURATE OR LOSSES SUSTAINED BY YOU OR THIRD
+PARTIES OR A FAILURE OF THE PROGRAM TO OPERATE WITH ANY OTHER PROGRAMS),
+EVEN IF SUCH HOLDER OR OTHER PARTY HAS BEEN ADVISED OF THE POSSIBILITY OF
+SUCH DAMAGES.
+
+  17. Interpretation of Sections 15 and 16.
+
+  If the disclaimer of warranty and limitation of liability provided
+above cannot be given local legal effect according to their terms,
+reviewing courts shall apply local law that most closely approximates
+an absolute waiver of all civil liability in connection with the
+Program, unless a warranty or assumption of liability accompanies a
+copy of the Program in return for a fee.
+
+                     END OF TERMS AND CONDITIONS
+
+            How to Apply These Terms to Your New Programs
+
+  If you develop a new program, and you want it to be of the greatest
+possible use to the public, the best way to achieve this is to make it
+free software which everyone can redistribute and change under these terms.
+
+  To do so, attach the following notices to the program.  It is safest
+to attach them to the start of each source file to most effectively
+state the exclusion of warranty; and each file should have at least
+the "copyright" line and a pointer to where the full notice is found.
+
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) <year>  <name of author>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Also add information on how to contact you by electronic and paper mail.
+
+  If the program does terminal interaction, make it output a short
+notice like this when it starts in an interactive mode:
+
+    <program>  Copyright (C) <year>  <name of author>
+    This program comes with ABSOLUTELY NO WARRANTY; for details type `show w'.
+    This is free software, and you are welcome to redistribute it
+    under certain conditions; type `show c' for details.
+
+The hypothetical commands `show w' and `show c' should show the appropriate
+parts of the General Public License.  Of course, your program's commands
+might be different; for a GUI interface, you would use an "about box".
+
+  You should also get your employer (if you work as a programmer) or school,
+if any, to sign a "copyright disclaimer" for the program, if necessary.
+For more information on this, and how to apply and follow the GNU GPL, see
+<http://www.gnu.org/licenses/>.
+
+  The GNU General Public License does not permit incorporating your program
+into proprietary programs.  If your program is a subroutine library, you
+may consider it more useful to permit linking proprietary applications with
+the library.  If this is what you want to do, use the GNU Lesser General
+Public License instead of this License.  But first, please read
+<http://www.gnu.org/philosophy/why-not-lgpl.html>.
+
+__EOF__
+
+    cat > COPYING.libgcc << \__EOF__
+Copyright (C) 1989-2025 Free Software Foundation, Inc.
+
+This file is part of GCC.
+
+GCC is free software; you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free
+Software Foundation; either version 3, or (at your option) any later
+version.
+
+GCC is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or
+FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+
+Under Section 7 of GPL version 3, you are granted additional
+permissions described in the GCC Runtime Library Exception, version
+3.1, as published by the Free Software Foundation.
+
+You should have received a copy of the GNU General Public License and
+a copy of the GCC Runtime Library Exception along with this program;
+see the files COPYING3 and COPYING.RUNTIME respectively.  If not, see
+<http://www.gnu.org/licenses/>.
+
+
+__EOF__
+
+    cat > COPYING.libstdc++ << \__EOF__
+Copyright (C) 1997-2025 Free Software Foundation, Inc.
+
+This file is part of the GNU ISO C++ Library.  This library is free
+software; you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the
+Free Software Foundation; either version 3, or (at your option)
+any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+Under Section 7 of GPL version 3, you are granted additional
+permissions described in the GCC Runtime Library Exception, version
+3.1, as published by the Free Software Foundation.
+
+You should have received a copy of the GNU General Public License and
+a copy of the GCC Runtime Library Exception along with this program;
+see the files COPYING3 and COPYING.RUNTIME respectively.  If not, see
+<http://www.gnu.org/licenses/>.
+
+
+__EOF__
+
+    cat > COPYING.RUNTIME << \__EOF__
+GCC RUNTIME LIBRARY EXCEPTION
+
+Version 3.1, 31 March 2009
+
+Copyright (C) 2009 Free Software Foundation, Inc. <http://fsf.org/>
+
+Everyone is permitted to copy and distribute verbatim copies of this
+license document, but changing it is not allowed.
+
+This GCC Runtime Library Exception ("Exception") is an additional
+permission under section 7 of the GNU General Public License, version
+3 ("GPLv3"). It applies to a given file (the "Runtime Library") that
+bears a notice placed by the copyright holder of the file stating that
+the file is governed by GPLv3 along with this Exception.
+
+When you use GCC to compile a program, GCC may combine portions of
+certain GCC header files and runtime libraries with the compiled
+program. The purpose of this Exception is to allow compilation of
+non-GPL (including proprietary) programs to use, in this way, the
+header files and runtime libraries covered by this Exception.
+
+0. Definitions.
+
+A file is an "Independent Module" if it either requires the Runtime
+Library for execution after a Compilation Process, or makes use of an
+interface provided by the Runtime Library, but is not otherwise based
+on the Runtime Library.
+
+"GCC" means a version of the GNU Compiler Collection, with or without
+modifications, governed by version 3 (or a specified later version) of
+the GNU General Public License (GPL) with the option of using any
+subsequent versions published by the FSF.
+
+"GPL-compatible Software" is software whose conditions of propagation,
+modification and use would permit combination with GCC in accord with
+the license of GCC.
+
+"Target Code" refers to output from any compiler for a real or virtual
+target processor architecture, in executable form or suitable for
+input to an assembler, loader, linker and/or execution
+phase. Notwithstanding that, Target Code does not include data in any
+format that is used as a compiler intermediate representation, or used
+for producing a compiler intermediate representation.
+
+The "Compilation Process" transforms code entirely represented in
+non-intermediate languages designed for human-written code, and/or in
+Java Virtual Machine byte code, into Target Code. Thus, for example,
+use of source code generators and preprocessors need not be considered
+part of the Compilation Process, since the Compilation Process can be
+understood as starting with the output of the generators or
+preprocessors.
+
+A Compilation Process is "Eligible" if it is done using GCC, alone or
+with other GPL-compatible software, or if it is done without using any
+work based on GCC. For example, using non-GPL-compatible Software to
+optimize any GCC intermediate representations would not qualify as an
+Eligible Compilation Process.
+
+1. Grant of Additional Permission.
+
+You have permission to propagate a work of Target Code formed by
+combining the Runtime Library with Independent Modules, even if such
+propagation would otherwise violate the terms of GPLv3, provided that
+all Target Code was generated by Eligible Compilation Processes. You
+may then convey such a combination under terms of your choice,
+consistent with the licensing of the Independent Modules.
+
+2. No Weakening of GCC Copyleft.
+
+The availability of this Exception does not imply any general
+presumption that third-party software is unaffected by the copyleft
+requirements of the license of GCC.
+
+
+__EOF__
+
+    cat > exec.c << \__EOF__
+/* Copyright (c) 2018 Pablo Marcos Oltra <pablo.marcos.oltra@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/*
+ * This exec.so library is intended to restore the environment of the AppImage's
+ * parent process. This is done to avoid library clashing of bundled libraries
+ * with external processes, e.g when running the web browser.
+ *
+ * The intended usage is as follows:
+ *
+ * 1. This library is injected to the dynamic loader through LD_PRELOAD
+ *    automatically in AppRun **only** if `exec.so` exists.
+ *
+ * 2. This library will intercept calls to new processes and will detect whether
+ *    those calls are for binaries within the AppImage bundle or external ones.
+ *    The exec family (`execve`, `execv`, `execvp`, `execvpe`, `execl`,
+ *    `execlp`, `execle`, `fexecve`) and `posix_spawn`/`posix_spawnp` are
+ *    interposed, since glibc implements them on internal entry points.
+ *
+ * 3. In case it's an internal process, it will not change anything.
+ *    In case it's an external process, it will restore the variables listed
+ *    in `APPIMAGE_ORIG_VARS` to the values saved by the AppRun hook in
+ *    `APPIMAGE_ORIG_<name>`, leaving the rest of the caller's environment
+ *    untouched. Variables without a saved value were unset before and are
+ *    removed. Without that list it falls back to the conservative approach
+ *    of restoring the whole environment of the AppImage parent by reading
+ *    `/proc/[pid]/environ`.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h> /* MAXSYMLINKS */
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+
+typedef int (*execve_func_t)(const char *filename, char *const argv[], char *const envp[]);
+typedef int (*fexecve_func_t)(int fd, char *const argv[], char *const envp[]);
+typedef int (*posix_spawn_func_t)(pid_t *pid, const char *path, const posix_spawn_file_actions_t *file_actions,
+                                  const posix_spawnattr_t *attrp, char *const argv[], char *const envp[]);
+
+#define VISIBLE __attribute__ ((visibility ("default")))
+
+#if !defined(DEBUG) && (defined(EXEC_TEST) || defined(ENV_TEST))
+#define DEBUG 1
+#endif
+
+#ifdef DEBUG
+#define DEBUG_PRINT(...) \
+    if (getenv("APPIMAGE_EXEC_DEBUG")) { \
+        fprintf(stderr, "APPIMAGE_EXEC>> " __VA_ARGS__); \
+    }
+#else
+#define DEBUG_PRINT(...)  /**/
+#endif
+
+
+#define ORIG_PREFIX "APPIMAGE_ORIG_"
+#define ORIG_PREFIX_LEN (sizeof(ORIG_PREFIX) - 1)
+#define ORIG_VARS ORIG_PREFIX "VARS"
+
+/* variable changed by the AppRun hook and its original value */
+struct orig_var {
+    const char *name;
+    size_t name_len;
+    const char *entry;  /* "name=value", or NULL if it was unset */
+};
+
+/* variables listed in APPIMAGE_ORIG_VARS, read once when the library is loaded */
+static struct orig_var *orig_vars = NULL;
+static size_t orig_vars_num = 0;
+
+/* environment of the parent process, only read if APPIMAGE_ORIG_VARS is not set */
+static char* const *parent_env = NULL;
+
+/* Read /proc/[pid]/environ into a single memory block
+ * holding the pointer array followed by the strings. */
+static char* const* read_env_from_process(pid_t pid)
+{
+    char path[64];
+    size_t len = 0, size = 4096;
+    ssize_t n;
+
+    snprintf(path, sizeof(path), "/proc/%d/environ", pid);
+    DEBUG_PRINT("Reading env from parent process: %s\n", path);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        DEBUG_PRINT("Error reading file: %s (%s)\n", path, strerror(errno));
+        return NULL;
+    }
+
+    char *buffer = malloc(size);
+    while ((n = read(fd, buffer + len, size - len - 1)) != 0) {
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            DEBUG_PRINT("Error reading file: %s (%s)\n", path, strerror(errno));
+            close(fd);
+            free(buffer);
+            return NULL;
+        }
+        len += n;
+        if (len == size - 1) {
+            size *= 2;
+            buffer = realloc(buffer, size);
+        }
+    }
+    close(fd);
+    buffer[len] = 0;
+
+    /* count variables */
+    size_t num_vars = 0;
+    for (char *ptr = buffer; ptr < buffer + len && *ptr; ptr += strlen(ptr) + 1)
+        num_vars++;
+
+    char **env = malloc((num_vars + 1) * sizeof(char*) + len + 1);
+    char *strings = (char *)(env + num_vars + 1);
+    memcpy(strings, buffer, len + 1);
+    free(buffer);
+
+    for (size_t i = 0; i < num_vars; i++) {
+        env[i] = strings;
+        DEBUG_PRINT("\tenv var copied: %s\n", env[i]);
+        strings += strlen(strings) + 1;
+    }
+    env[num_vars] = NULL;
+
+    return env;
+}
+
+/* Parse the colon separated APPIMAGE_ORIG_VARS list. The saved values are
+ * used in place: "APPIMAGE_ORIG_NAME=value" minus the prefix is "NAME=value". */
+static void read_orig_vars(const char *list)
+{
+    char *names = strdup(list);
+    size_t num = 1;
+    for (const char *p = names; *p; p++)
+        num += *p == ':';
+    orig_vars = calloc(num, sizeof(struct orig_var));
+
+    for (char *name = strtok(names, ":"); name; name = strtok(NULL, ":")) {
+        struct orig_var *var = &orig_vars[orig_vars_num++];
+        var->name = name;
+        var->name_len = strlen(name);
+
+        for (char **env = environ; *env; env++) {
+            if (strncmp(*env, ORIG_PREFIX, ORIG_PREFIX_LEN) == 0 &&
+                strncmp(*env + ORIG_PREFIX_LEN, name, var->name_len) == 0 &&
+                (*env)[ORIG_PREFIX_LEN + var->name_len] == '=') {
+                var->entry = *env + ORIG_PREFIX_LEN;
+                break;
+            }
+        }
+        DEBUG_PRINT("Original value of %s: %s\n", name, var->entry ? var->entry : "(unset)");
+    }
+}
+
+/* real entry points and canonical APPDIR, resolved once at load time */
+static execve_func_t real_execve = NULL;
+static execve_func_t real_execvpe = NULL;
+static fexecve_func_t real_fexecve = NULL;
+static posix_spawn_func_t real_posix_spawn = NULL;
+static posix_spawn_func_t real_posix_spawnp = NULL;
+static char *appdir = NULL;
+static size_t appdir_len = 0;
+/* $APPDIR as given, if it differs from the canonical path */
+static char *appdir_alias = NULL;
+static size_t appdir_alias_len = 0;
+
+/* Statistics, enabled with APPIMAGE_EXEC_STATS=<path or file descriptor>.
+ * Every process appends one JSON line with its own counts when it exits or
+ * replaces itself through exec, so the counters are never reset otherwise. */
+enum exec_entry {
+    ENTRY_EXECVE, ENTRY_EXECV, ENTRY_EXECVPE, ENTRY_EXECVP, ENTRY_EXECL,
+    ENTRY_EXECLP, ENTRY_EXECLE, ENTRY_FEXECVE, ENTRY_POSIX_SPAWN, ENTRY_POSIX_SPAWNP,
+    ENTRY_NUM
+};
+
+static const char *const entry_names[ENTRY_NUM] = {
+    "execve", "execv", "execvpe", "execvp", "execl",
+    "execlp", "execle", "fexecve", "posix_spawn", "posix_spawnp"
+};
+
+struct exec_stats {
+    uint64_t calls[ENTRY_NUM];
+    uint64_t internal;
+    uint64_t external;
+    uint64_t unresolved;
+    uint64_t restore_failures;
+    uint64_t ns;
+};
+
+static struct exec_stats stats;
+static int stats_enabled = 0;
+static int stats_fd = -1;
+static char *stats_path = NULL;
+/* process the counters belong to; a vfork() child shares them with it */
+static pid_t stats_pid = 0;
+
+#define STAT_ADD(field, n) \
+    do { \
+        if (stats_enabled) \
+            __atomic_add_fetch(&stats.field, (n), __ATOMIC_RELAXED); \
+    } while (0)
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Formatting helpers for write_stats(), which must not use stdio */
+static char *put_str(char *p, const char *str)
+{
+    size_t len = strlen(str);
+    memcpy(p, str, len);
+    return p + len;
+}
+
+static char *put_u64(char *p, uint64_t value)
+{
+    char digits[20];
+    size_t len = 0;
+    do {
+        digits[len++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (len)
+        *p++ = digits[--len];
+    return p;
+}
+
+static char *put_field(char *p, const char *sep, const char *name, uint64_t *counter)
+{
+    p = put_str(p, sep);
+    p = put_str(p, "\"");
+    p = put_str(p, name);
+    p = put_str(p, "\":");
+    return put_u64(p, __atomic_load_n(counter, __ATOMIC_RELAXED));
+}
+
+/* Append the counters of this process as one JSON line */
+static void write_stats(void)
+{
+    char buf[1024 + 6 * PATH_MAX];
+    char exe[PATH_MAX];
+    char *p = buf;
+
+    ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    exe[len < 0 ? 0 : len] = 0;
+
+    p = put_str(p, "{\"pid\":");
+    p = put_u64(p, getpid());
+    p = put_str(p, ",\"exe\":\"");
+    for (const char *c = exe; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            *p++ = '\\';
+            *p++ = *c;
+        } else if ((unsigned char)*c < 0x20) {
+            p = put_str(p, "\\u00");
+            *p++ = "0123456789abcdef"[*c >> 4];
+            *p++ = "0123456789abcdef"[*c & 0xf];
+        } else {
+            *p++ = *c;
+        }
+    }
+    p = put_str(p, "\",\"calls\":{");
+    for (size_t i = 0; i < ENTRY_NUM; i++)
+        p = put_field(p, i ? "," : "", entry_names[i], &stats.calls[i]);
+    p = put_str(p, "}");
+    p = put_field(p, ",", "internal", &stats.internal);
+    p = put_field(p, ",", "external", &stats.external);
+    p = put_field(p, ",", "unresolved", &stats.unresolved);
+    p = put_field(p, ",", "restore_failures", &stats.restore_failures);
+    p = put_field(p, ",", "ns", &stats.ns);
+    p = put_str(p, "}\n");
+
+    int fd = stats_fd;
+    if (fd == -1)
+        fd = open(stats_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return;
+    for (char *q = buf; q < p; ) {
+        ssize_t n = write(fd, q, p - q);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        q += n;
+    }
+    if (fd != stats_fd)
+        close(fd);
+}
+
+/* a forked child starts counting from zero */
+static void stats_atfork_child(void)
+{
+    memset(&stats, 0, sizeof(stats));
+    stats_pid = getpid();
+}
+
+static void init_stats(const char *target)
+{
+    if (!*target)
+        return;
+    if (strspn(target, "0123456789") == strlen(target))
+        stats_fd = atoi(target);
+    else
+        stats_path = strdup(target);
+    stats_pid = getpid();
+    pthread_atfork(NULL, NULL, stats_atfork_child);
+    stats_enabled = 1;
+}
+
+/* Write the statistics before the process image is replaced. If the exec
+ * fails the process keeps running, so start counting from zero again. */
+static void stats_before_exec(void)
+{
+    if (stats_enabled && getpid() == stats_pid)
+        write_stats();
+}
+
+static void stats_after_exec(void)
+{
+    if (stats_enabled && getpid() == stats_pid)
+        memset(&stats, 0, sizeof(stats));
+}
+
+__attribute__((destructor)) static void exec_fini(void)
+{
+    if (stats_enabled && getpid() == stats_pid)
+        write_stats();
+}
+
+static void *load_symbol(const char *name)
+{
+    void *sym = dlsym(RTLD_NEXT, name);
+    if (!sym) {
+        DEBUG_PRINT("Error getting %s original symbol: %s\n", name, dlerror());
+    }
+    return sym;
+}
+
+/* Snapshot the parent environment while the parent is still the AppRun
+ * launcher; later getppid() may return a subreaper or init. */
+__attribute__((constructor)) static void exec_init(void)
+{
+    const char *stats_target = getenv("APPIMAGE_EXEC_STATS");
+    if (stats_target)
+        init_stats(stats_target);
+
+    const char *list = getenv(ORIG_VARS);
+    if (list)
+        read_orig_vars(list);
+    else
+        parent_env = read_env_from_process(getppid());
+
+    real_execve = (execve_func_t)load_symbol("execve");
+    real_execvpe = (execve_func_t)load_symbol("execvpe");
+    real_fexecve = (fexecve_func_t)load_symbol("fexecve");
+    real_posix_spawn = (posix_spawn_func_t)load_symbol("posix_spawn");
+    real_posix_spawnp = (posix_spawn_func_t)load_symbol("posix_spawnp");
+
+    const char *env_appdir = getenv("APPDIR");
+    if (env_appdir) {
+        appdir = realpath(env_appdir, NULL);
+        if (!appdir)
+            appdir = strdup(env_appdir);
+        appdir_len = strlen(appdir);
+        while (appdir_len > 1 && appdir[appdir_len - 1] == '/')
+            appdir[--appdir_len] = 0;
+        DEBUG_PRINT("APPDIR = %s\n", appdir);
+
+        size_t len = strlen(env_appdir);
+        while (len > 1 && env_appdir[len - 1] == '/')
+            len--;
+        if (env_appdir[0] == '/' && (len != appdir_len || strncmp(env_appdir, appdir, len) != 0)) {
+            appdir_alias = strndup(env_appdir, len);
+            appdir_alias_len = len;
+        }
+    }
+}
+
+/* The functions below run between vfork()/posix_spawn() and the real exec,
+ * where the child shares the parent's memory: they must neither allocate nor
+ * take locks. Scratch space lives on the stack, the parent environment was
+ * read at load time and only syscall wrappers are used to resolve paths. */
+
+/* Drop the last component of an absolute path, never going above "/" */
+static void pop_component(char *path)
+{
+    char *slash = strrchr(path, '/');
+    if (slash == path)
+        path[1] = 0;
+    else
+        *slash = 0;
+}
+
+/* Canonicalize a path like realpath(3) without allocating memory.
+ * "out" must hold PATH_MAX bytes. Returns 0 on success and -1 on error. */
+static int resolve_path(const char *path, char *out)
+{
+    char rest[PATH_MAX], link[PATH_MAX];
+    struct stat st;
+    int links = 0;
+
+    if (strlen(path) >= sizeof(rest))
+        return -1;
+    if (path[0] == '/') {
+        strcpy(out, "/");
+    } else if (!getcwd(out, PATH_MAX)) {
+        return -1;
+    }
+    strcpy(rest, path);
+
+    char *p = rest;
+    while (*p) {
+        while (*p == '/')
+            p++;
+        if (!*p)
+            break;
+        char *end = strchrnul(p, '/');
+        size_t clen = end - p;
+        if (clen == 1 && p[0] == '.') {
+            p = end;
+            continue;
+        }
+        if (clen == 2 && p[0] == '.' && p[1] == '.') {
+            pop_component(out);
+            p = end;
+            continue;
+        }
+
+        size_t len = strlen(out);
+        if (len + clen + 2 > PATH_MAX)
+            return -1;
+        if (len > 1)
+            out[len++] = '/';
+        memcpy(out + len, p, clen);
+        out[len + clen] = 0;
+        p = end;
+
+        if (lstat(out, &st) == -1)
+            return -1;
+        if (S_ISLNK(st.st_mode)) {
+            if (++links > MAXSYMLINKS)
+                return -1;
+            ssize_t n = readlink(out, link, sizeof(link) - 1);
+            if (n == -1)
+                return -1;
+            size_t restlen = strlen(p);
+            if (n + restlen + 1 > sizeof(rest))
+                return -1;
+            /* continue with the link target followed by the unresolved rest */
+            memmove(rest + n, p, restlen + 1);
+            memcpy(rest, link, n);
+            p = rest;
+            if (link[0] == '/')
+                strcpy(out, "/");
+            else
+                pop_component(out);
+        } else if (*p && !S_ISDIR(st.st_mode)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Find an executable in $PATH the way execvp() does, resolving the
+ * result into "out" (PATH_MAX bytes). Returns 0 on success. */
+static int find_in_path(const char *file, char *out)
+{
+    char candidate[PATH_MAX];
+    const char *path = getenv("PATH");
+    if (!path)
+        path = "/bin:/usr/bin";
+
+    size_t flen = strlen(file);
+    while (*path) {
+        const char *end = strchrnul(path, ':');
+        size_t dlen = end - path;
+        if (dlen == 0) {
+            /* empty entry means the current directory */
+            candidate[0] = '.';
+            dlen = 1;
+        } else if (dlen + flen + 2 <= sizeof(candidate)) {
+            memcpy(candidate, path, dlen);
+        } else {
+            dlen = 0;
+        }
+        if (dlen) {
+            candidate[dlen] = '/';
+            memcpy(candidate + dlen + 1, file, flen + 1);
+            if (access(candidate, X_OK) == 0 && resolve_path(candidate, out) == 0)
+                return 0;
+        }
+        path = *end ? end + 1 : end;
+    }
+    return -1;
+}
+
+/* Copy envp to "out" (room for all entries of envp plus the terminator),
+ * putting back the original values of the variables changed by the hook
+ * and dropping the APPIMAGE_ORIG_* bookkeeping. */
+static void restore_orig_vars(char *const envp[], char *out[])
+{
+    size_t n = 0;
+    for (; *envp; envp++) {
+        const char *entry = *envp;
+        if (strncmp(entry, ORIG_PREFIX, ORIG_PREFIX_LEN) == 0)
+            continue;
+
+        for (size_t i = 0; i < orig_vars_num; i++) {
+            const struct orig_var *var = &orig_vars[i];
+            if (strncmp(entry, var->name, var->name_len) == 0 && entry[var->name_len] == '=') {
+                entry = var->entry;
+                break;
+            }
+        }
+        if (entry)
+            out[n++] = (char *)entry;
+    }
+    out[n] = NULL;
+}
+
+/* Whether an absolute path has no ".", ".." or empty components */
+static int is_normalized(const char *path)
+{
+    for (const char *p = path; *p; p++) {
+        if (p[0] != '/')
+            continue;
+        if (p[1] == '/')
+            return 0;
+        if (p[1] == '.' && (p[2] == '/' || p[2] == 0 || (p[2] == '.' && (p[3] == '/' || p[3] == 0))))
+            return 0;
+    }
+    return 1;
+}
+
+/* Whether a path is "dir" itself or below it */
+static int is_below(const char *path, const char *dir, size_t dir_len)
+{
+    if (strncmp(path, dir, dir_len) != 0)
+        return 0;
+    /* "/tmp/.mount_abc2" is not inside "/tmp/.mount_abc" */
+    return dir_len == 1 || path[dir_len] == '/' || path[dir_len] == 0;
+}
+
+/* Whether no component of an absolute, normalized path is a symlink. The
+ * components up to APPDIR are known not to be, since it's canonicalized. */
+static int has_no_symlinks(const char *path)
+{
+    char prefix[PATH_MAX];
+    struct stat st;
+    size_t len = strlen(path);
+    if (len >= sizeof(prefix))
+        return 0;
+    memcpy(prefix, path, len + 1);
+
+    char *p = prefix + 1;
+    if (appdir && is_below(path, appdir, appdir_len))
+        p = prefix + appdir_len;
+
+    for (;; p++) {
+        if (*p != '/' && *p != 0)
+            continue;
+        char c = *p;
+        *p = 0;
+        if (lstat(prefix, &st) == -1 || S_ISLNK(st.st_mode))
+            return 0;
+        if (!c)
+            return 1;
+        *p = c;
+    }
+}
+
+static int is_external_process(const char *filename)
+{
+    if (!appdir)
+        return 0;
+
+    return !is_below(filename, appdir, appdir_len) &&
+           !(appdir_alias && is_below(filename, appdir_alias, appdir_alias_len));
+}
+
+/* Whether the program about to be executed lies outside the AppDir */
+static int is_external_exec(const char *filename, int search_path)
+{
+    /* Absolute, normalized paths without symlinked components (e.g.
+     * usr/bin/python -> python3, or a link to a directory of the AppDir)
+     * are classified as they are; only relative or symlinked paths go
+     * through the full resolution. */
+    char fullpath[PATH_MAX];
+    const char *path = filename;
+    int resolved;
+    if (search_path && !strchr(filename, '/')) {
+        resolved = find_in_path(filename, fullpath) == 0;
+        path = fullpath;
+    } else if (filename[0] == '/' && is_normalized(filename) && has_no_symlinks(filename)) {
+        resolved = 1;
+    } else {
+        resolved = resolve_path(filename, fullpath) == 0;
+        path = fullpath;
+    }
+    DEBUG_PRINT("filename %s, fullpath %s\n", filename, resolved ? path : "(unresolved)");
+    if (!resolved)
+        STAT_ADD(unresolved, 1);
+
+    return resolved && is_external_process(path);
+}
+
+/* Number of entries exec_env() needs in its "out" array */
+static size_t exec_env_size(char *const envp[])
+{
+    size_t n = 0;
+    if (appdir && orig_vars && envp) {
+        while (envp[n])
+            n++;
+    }
+    return n + 1;
+}
+
+static char *const *select_env(const char *filename, int search_path, char *const envp[], char *out[])
+{
+    if (!appdir || !is_external_exec(filename, search_path)) {
+        STAT_ADD(internal, 1);
+        return envp;
+    }
+    STAT_ADD(external, 1);
+
+    if (orig_vars && envp) {
+        DEBUG_PRINT("External process detected. Restoring original values of changed env vars\n");
+        restore_orig_vars(envp, out);
+        return out;
+    }
+    if (parent_env) {
+        DEBUG_PRINT("External process detected. Restoring env vars from parent\n");
+        return parent_env;
+    }
+    DEBUG_PRINT("Error restoring env vars from parent\n");
+    STAT_ADD(restore_failures, 1);
+    return envp;
+}
+
+/* Return the environment to execute "filename" with, using "out"
+ * (exec_env_size() entries) for a patched copy of envp */
+static char *const *exec_env(const char *filename, int search_path, char *const envp[], char *out[])
+{
+    if (!stats_enabled)
+        return select_env(filename, search_path, envp, out);
+
+    uint64_t start = now_ns();
+    char *const *env = select_env(filename, search_path, envp, out);
+    STAT_ADD(ns, now_ns() - start);
+    return env;
+}
+
+static int exec_common(execve_func_t function, const char *filename, char* const argv[], char* const envp[],
+                       int search_path)
+{
+    if (!function) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    char *env[exec_env_size(envp)];
+    char *const *exec_envp = exec_env(filename, search_path, envp, env);
+    stats_before_exec();
+    int ret = function(filename, argv, exec_envp);
+    stats_after_exec();
+    return ret;
+}
+
+static int spawn_common(posix_spawn_func_t function, pid_t *pid, const char *path,
+                        const posix_spawn_file_actions_t *file_actions, const posix_spawnattr_t *attrp,
+                        char *const argv[], char *const envp[], int search_path)
+{
+    if (!function)
+        return ENOSYS;
+
+    char *env[exec_env_size(envp)];
+    return function(pid, path, file_actions, attrp, argv, exec_env(path, search_path, envp, env));
+}
+
+/* Number of arguments of an execl() style call, including "arg" */
+static size_t count_args(const char *arg, va_list *ap)
+{
+    va_list aq;
+    size_t argc = 0;
+
+    va_copy(aq, *ap);
+    for (const char *p = arg; p; p = va_arg(aq, const char *))
+        argc++;
+    va_end(aq);
+
+    return argc;
+}
+
+/* Copy the arguments of an execl() style call into a NULL terminated array */
+static void collect_args(char *argv[], const char *arg, va_list *ap)
+{
+    size_t i = 0;
+    for (const char *p = arg; p; p = va_arg(*ap, const char *))
+        argv[i++] = (char *)p;
+    argv[i] = NULL;
+}
+
+VISIBLE int execve(const char *filename, char *const argv[], char *const envp[])
+{
+    DEBUG_PRINT("execve call hijacked: %s\n", filename);
+    STAT_ADD(calls[ENTRY_EXECVE], 1);
+    return exec_common(real_execve, filename, argv, envp, 0);
+}
+
+VISIBLE int execv(const char *filename, char *const argv[]) {
+    DEBUG_PRINT("execv call hijacked: %s\n", filename);
+    STAT_ADD(calls[ENTRY_EXECV], 1);
+    return exec_common(real_execve, filename, argv, environ, 0);
+}
+
+VISIBLE int execvpe(const char *filename, char *const argv[], char *const envp[])
+{
+    DEBUG_PRINT("execvpe call hijacked: %s\n", filename);
+    STAT_ADD(calls[ENTRY_EXECVPE], 1);
+    return exec_common(real_execvpe, filename, argv, envp, 1);
+}
+
+VISIBLE int execvp(const char *filename, char *const argv[]) {
+    DEBUG_PRINT("execvp call hijacked: %s\n", filename);
+    STAT_ADD(calls[ENTRY_EXECVP], 1);
+    return exec_common(real_execvpe, filename, argv, environ, 1);
+}
+
+VISIBLE int execl(const char *filename, const char *arg, ...)
+{
+    va_list ap;
+    va_start(ap, arg);
+    char *argv[count_args(arg, &ap) + 1];
+    collect_args(argv, arg, &ap);
+    va_end(ap);
+
+    DEBUG_PRINT("execl call hijacked: %s\n", filename);
+    STAT_ADD(calls[ENTRY_EXECL], 1);
+    return exec_common(real_execve, filename, argv, environ, 0);
+}
+
+VISIBLE int execlp(const char *filename, const char *arg, ...)
+{
+    va_list ap;
+    va_start(ap, arg);
+    char *argv[count_args(arg, &ap) + 1];
+    collect_args(argv, arg, &ap);
+    va_end(ap);
+
+    DEBUG_PRINT("execlp call hijacked: %s\n", filename);
+    STAT_ADD(calls[ENTRY_EXECLP], 1);
+    return exec_common(real_execvpe, filename, argv, environ, 1);
+}
+
+VISIBLE int execle(const char *filename, const char *arg, ...)
+{
+    va_list ap;
+    va_start(ap, arg);
+    char *argv[count_args(arg, &ap) + 1];
+    collect_args(argv, arg, &ap);
+    char *const *envp = va_arg(ap, char *const *);
+    va_end(ap);
+
+    DEBUG_PRINT("execle call hijacked: %s\n", filename);
+    STAT_ADD(calls[ENTRY_EXECLE], 1);
+    return exec_common(real_execve, filename, argv, envp, 0);
+}
+
+VISIBLE int fexecve(int fd, char *const argv[], char *const envp[])
+{
+    DEBUG_PRINT("fexecve call hijacked: %d\n", fd);
+    STAT_ADD(calls[ENTRY_FEXECVE], 1);
+    if (!real_fexecve) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    /* classify the file behind the descriptor through its /proc link */
+    char path[sizeof("/proc/self/fd/") + 3 * sizeof(int)];
+    char digits[3 * sizeof(int)];
+    size_t len = 0;
+    for (unsigned int n = fd; len == 0 || n; n /= 10)
+        digits[len++] = '0' + n % 10;
+    strcpy(path, "/proc/self/fd/");
+    char *p = path + strlen(path);
+    while (len)
+        *p++ = digits[--len];
+    *p = 0;
+
+    char *env[exec_env_size(envp)];
+    char *const *exec_envp = exec_env(path, 0, envp, env);
+    stats_before_exec();
+    int ret = real_fexecve(fd, argv, exec_envp);
+    stats_after_exec();
+    return ret;
+}
+
+VISIBLE int posix_spawn(pid_t *pid, const char *path, const posix_spawn_file_actions_t *file_actions,
+                        const posix_spawnattr_t *attrp, char *const argv[], char *const envp[])
+{
+    DEBUG_PRINT("posix_spawn call hijacked: %s\n", path);
+    STAT_ADD(calls[ENTRY_POSIX_SPAWN], 1);
+    return spawn_common(real_posix_spawn, pid, path, file_actions, attrp, argv, envp, 0);
+}
+
+VISIBLE int posix_spawnp(pid_t *pid, const char *file, const posix_spawn_file_actions_t *file_actions,
+                         const posix_spawnattr_t *attrp, char *const argv[], char *const envp[])
+{
+    DEBUG_PRINT("posix_spawnp call hijacked: %s\n", file);
+    STAT_ADD(calls[ENTRY_POSIX_SPAWNP], 1);
+    return spawn_common(real_posix_spawnp, pid, file, file_actions, attrp, argv, envp, 1);
+}
+
+#ifdef EXEC_TEST
+int main(int argc, char *argv[]) {
+    putenv("APPIMAGE_EXEC_DEBUG=1");
+    puts("EXEC TEST");
+    execv("/bin/true", argv);
+    return 0;
+}
+#elif defined(ENV_TEST)
+int main() {
+    putenv("APPIMAGE_EXEC_DEBUG=1");
+    puts("ENV TEST");
+    read_env_from_process(getppid());
+    return 0;
+}
+#endif
+
+__EOF__
+
+}
+# save_files() end
+
+show_usage() {
+    echo "Usage: $0 --appdir <path to AppDir>"
+    echo
+}
+
+while [ "$1" != "" ]; do
+    case "$1" in
+        --plugin-api-version)
+            echo "0"
+            exit 0
+            ;;
+        --appdir)
+            APPDIR="$2"
+            shift
+            shift
+            ;;
+        --help)
+            show_usage
+            exit 0
+            ;;
+        *)
+            echo "Invalid argument: $1"
+            echo
+            show_usage
+            exit 1
+            ;;
+    esac
+done
+
+if [ "$APPDIR" == "" ]; then
+    show_usage
+    exit 1
+fi
+
+APPDIR="$(realpath "$APPDIR")"
+
+echo "Installing AppRun hook 'checkrt'"
+mkdir -p "$APPDIR/apprun-hooks"
+
+cat > "$APPDIR/apprun-hooks/linuxdeploy-plugin-checkrt.sh" << \EOF
+#! /usr/bin/env bash
+
+if [ -z "$APPDIR" ]; then
+    APPDIR="$(dirname "$(realpath "$0")")"
+fi
+
+# remember the original value of a variable so that exec.so can restore it
+# for external processes; unset variables are only added to the list
+checkrt_save_env() {
+    case ":$APPIMAGE_ORIG_VARS:" in
+        *":$1:"*) return ;;
+    esac
+    export APPIMAGE_ORIG_VARS="${APPIMAGE_ORIG_VARS:+$APPIMAGE_ORIG_VARS:}$1"
+    if [ -n "${!1+x}" ]; then
+        export "APPIMAGE_ORIG_$1=${!1}"
+    fi
+}
+
+if [ -x "$APPDIR/checkrt/checkrt" ]; then
+    # preload the bundled libraries instead of searching their directories
+    # if the AppDir was deployed with CHECKRT_PRELOAD
+    CHECKRT_MODE=""
+    if [ -f "$APPDIR/checkrt/preload" ]; then
+        CHECKRT_MODE="--preload"
+    fi
+
+    # the libraries are followed by a token that lets checkrt
+    # skip the check in processes started from this AppDir
+    CHECKRT_OUTPUT="$($APPDIR/checkrt/checkrt --token $CHECKRT_MODE)"
+    CHECKRT_LIBS="${CHECKRT_OUTPUT%%$'\n'*}"
+
+    if [ "$CHECKRT_OUTPUT" != "$CHECKRT_LIBS" ]; then
+        checkrt_save_env CHECKRT_TOKEN
+        export CHECKRT_TOKEN="${CHECKRT_OUTPUT#*$'\n'}"
+    fi
+
+    # prepend to LD_PRELOAD or LD_LIBRARY_PATH unless inherited from a parent process
+    if [ -n "$CHECKRT_LIBS" ] && [ -n "$CHECKRT_MODE" ]; then
+        case ":$LD_PRELOAD:" in
+            *":$CHECKRT_LIBS:"*) ;;
+            *)
+                checkrt_save_env LD_PRELOAD
+                export LD_PRELOAD="${CHECKRT_LIBS}:${LD_PRELOAD}"
+                ;;
+        esac
+    elif [ -n "$CHECKRT_LIBS" ]; then
+        case "$LD_LIBRARY_PATH" in
+            "$CHECKRT_LIBS"|"$CHECKRT_LIBS":*) ;;
+            *)
+                checkrt_save_env LD_LIBRARY_PATH
+                export LD_LIBRARY_PATH="${CHECKRT_LIBS}:${LD_LIBRARY_PATH}"
+                ;;
+        esac
+    fi
+
+    unset CHECKRT_MODE CHECKRT_OUTPUT CHECKRT_LIBS
+fi
+
+# check for exec.so
+if [ -f "$APPDIR/checkrt/exec.so" ]; then
+    case ":$LD_PRELOAD:" in
+        *":$APPDIR/checkrt/exec.so:"*) ;;
+        *)
+            checkrt_save_env LD_PRELOAD
+            export LD_PRELOAD="$APPDIR/checkrt/exec.so:${LD_PRELOAD}"
+            ;;
+    esac
+fi
+
+# debugging
+if [ -n "$CHECKRT_DEBUG" ]; then
+    echo "[DEBUG] LD_LIBRARY_PATH=$LD_LIBRARY_PATH"
+    echo "[DEBUG] LD_PRELOAD=$LD_PRELOAD"
+fi
+EOF
+
+mkdir -p "$APPDIR/checkrt"
+cd "$APPDIR/checkrt"
+
+save_files
+
+# decompress a prebuilt file from stdin and verify its checksum
+unpack_file() {
+    base64 -d | gzip -dc > "$1.tmp" &&
+    echo "$2  $1.tmp" | sha256sum -c --status &&
+    chmod a+x "$1.tmp" &&
+    mv "$1.tmp" "$1"
+}
+
+# target architecture, named like the prebuilt binaries
+case "${ARCH:-$(uname -m)}" in
+    amd64|x86_64) arch="x86_64" ;;
+    i?86) arch="i686" ;;
+    arm64|aarch64) arch="aarch64" ;;
+    arm|armhf|armv7*|armv8l) arch="armhf" ;;
+    *) arch="${ARCH:-$(uname -m)}" ;;
+esac
+
+# test-run the prebuilt binaries on this system; the dynamic loader
+# complains about an exec.so that can't be preloaded but runs the program
+prebuilt_works() {
+    ./checkrt --help 2> /dev/null &&
+    [ -z "$(LD_PRELOAD="$PWD/exec.so" env true 2>&1)" ]
+}
+
+# use the prebuilt binaries unless a static checkrt was requested; compile
+# them if there are none for this architecture, they are damaged or they
+# don't run here (e.g. because the system's glibc is too old)
+if [ -z "$CHECKRT_STATIC" ] && declare -F "prebuilt_$arch" > /dev/null && "prebuilt_$arch" && prebuilt_works; then
+    echo "Using prebuilt checkrt and exec.so for $arch"
+else
+    rm -f checkrt checkrt.tmp exec.so exec.so.tmp
+
+    LDFLAGS="-Wl,--as-needed -static-libgcc -ldl -s"
+    CFLAGS="-O2"
+
+    echo "Compiling checkrt"
+    # CHECKRT_STATIC=1 builds a static checkrt without the dlmopen() fallback,
+    # which starts faster; it needs a static libc, preferably musl (musl-gcc)
+    # which gives a much smaller binary than glibc's libc.a
+    if [ -n "$CHECKRT_STATIC" ] && command -v musl-gcc > /dev/null &&
+       musl-gcc -Os -DCHECKRT_STATIC -static -pthread checkrt.c -o checkrt -s
+    then
+        echo "Built static checkrt with musl"
+    elif [ -n "$CHECKRT_STATIC" ] && cc $CFLAGS -DCHECKRT_STATIC -static -pthread checkrt.c -o checkrt -s; then
+        echo "Built static checkrt"
+    else
+        cc $CFLAGS -pthread checkrt.c -o checkrt $LDFLAGS
+    fi
+
+    echo "Compiling exec.so"
+    cc $CFLAGS -shared -fPIC exec.c -o exec.so $LDFLAGS
+fi
+
+rm checkrt.c checkrt.h exec.c
+
+./checkrt --copy
+
+cd "$APPDIR"
@@ -44,18 +44,67 @@ if [ -z "$APPDIR" ]; then
     APPDIR="$(dirname "$(realpath "$0")")"
 fi
 
+# remember the original value of a variable so that exec.so can restore it
+# for external processes; unset variables are only added to the list
+checkrt_save_env() {
+    case ":$APPIMAGE_ORIG_VARS:" in
+        *":$1:"*) return ;;
+    esac
+    export APPIMAGE_ORIG_VARS="${APPIMAGE_ORIG_VARS:+$APPIMAGE_ORIG_VARS:}$1"
+    if [ -n "${!1+x}" ]; then
+        export "APPIMAGE_ORIG_$1=${!1}"
+    fi
+}
+
 if [ -x "$APPDIR/checkrt/checkrt" ]; then
-    CHECKRT_LIBS="$($APPDIR/checkrt/checkrt)"
+    # preload the bundled libraries instead of searching their directories
+    # if the AppDir was deployed with CHECKRT_PRELOAD
+    CHECKRT_MODE=""
+    if [ -f "$APPDIR/checkrt/preload" ]; then
+        CHECKRT_MODE="--preload"
+    fi
 
-    # prepend to LD_LIBRARY_PATH
-    if [ -n "$CHECKRT_LIBS" ]; then
-        export LD_LIBRARY_PATH="${CHECKRT_LIBS}:${LD_LIBRARY_PATH}"
+    # the libraries are followed by a token that lets checkrt
+    # skip the check in processes started from this AppDir
+    CHECKRT_OUTPUT="$($APPDIR/checkrt/checkrt --token $CHECKRT_MODE)"
+    CHECKRT_LIBS="${CHECKRT_OUTPUT%%$'\n'*}"
+
+    if [ "$CHECKRT_OUTPUT" != "$CHECKRT_LIBS" ]; then
+        checkrt_save_env CHECKRT_TOKEN
+        export CHECKRT_TOKEN="${CHECKRT_OUTPUT#*$'\n'}"
+    fi
+
+    # prepend to LD_PRELOAD or LD_LIBRARY_PATH unless inherited from a parent process
+    if [ -n "$CHECKRT_LIBS" ] && [ -n "$CHECKRT_MODE" ]; then
+        case ":$LD_PRELOAD:" in
+            *":$CHECKRT_LIBS:"*) ;;
+            *)
+                checkrt_save_env LD_PRELOAD
+                export LD_PRELOAD="${CHECKRT_LIBS}:${LD_PRELOAD}"
+                ;;
+        esac
+    elif [ -n "$CHECKRT_LIBS" ]; then
+        case "$LD_LIBRARY_PATH" in
+            "$CHECKRT_LIBS"|"$CHECKRT_LIBS":*) ;;
+            *)
+                checkrt_save_env LD_LIBRARY_PATH
+                export LD_LIBRARY_PATH="${CHECKRT_LIBS}:${LD_LIBRARY_PATH}"
+                ;;
+        esac
     fi
+
+    unset CHECKRT_MODE CHECKRT_OUTPUT CHECKRT_LIBS
 fi
 
 # check for exec.so
 if [ -f "$APPDIR/checkrt/exec.so" ]; then
-    export LD_PRELOAD="$APPDIR/checkrt/exec.so:${LD_PRELOAD}"
+    case ":$LD_PRELOAD:" in
+        *":$APPDIR/checkrt/exec.so:"*) ;;
+        *)
+            checkrt_save_env LD_PRELOAD
+            export LD_PRELOAD="$APPDIR/checkrt/exec.so:${LD_PRELOAD}"
+            ;;
+    esac
 fi
 
 # debugging
@@ -70,15 +119,60 @@ cd "$APPDIR/checkrt"
 
 save_files
 
-LDFLAGS="-Wl,--as-needed -static-libgcc -ldl -s"
-CFLAGS="-O2"
+# decompress a prebuilt file from stdin and verify its checksum
+unpack_file() {
+    base64 -d | gzip -dc > "$1.tmp" &&
+    echo "$2  $1.tmp" | sha256sum -c --status &&
+    chmod a+x "$1.tmp" &&
+    mv "$1.tmp" "$1"
+}
 
-echo "Compiling checkrt"
-cc $CFLAGS checkrt.c -o checkrt $LDFLAGS
+# target architecture, named like the prebuilt binaries
+case "${ARCH:-$(uname -m)}" in
+    amd64|x86_64) arch="x86_64" ;;
+    i?86) arch="i686" ;;
+    arm64|aarch64) arch="aarch64" ;;
+    arm|armhf|armv7*|armv8l) arch="armhf" ;;
+    *) arch="${ARCH:-$(uname -m)}" ;;
+esac
+
+# test-run the prebuilt binaries on this system; the dynamic loader
+# complains about an exec.so that can't be preloaded but runs the program
+prebuilt_works() {
+    ./checkrt --help 2> /dev/null &&
+    [ -z "$(LD_PRELOAD="$PWD/exec.so" env true 2>&1)" ]
+}
+
+# use the prebuilt binaries unless a static checkrt was requested; compile
+# them if there are none for this architecture, they are damaged or they
+# don't run here (e.g. because the system's glibc is too old)
+if [ -z "$CHECKRT_STATIC" ] && declare -F "prebuilt_$arch" > /dev/null && "prebuilt_$arch" && prebuilt_works; then
+    echo "Using prebuilt checkrt and exec.so for $arch"
+else
+    rm -f checkrt checkrt.tmp exec.so exec.so.tmp
+
+    LDFLAGS="-Wl,--as-needed -static-libgcc -ldl -s"
+    CFLAGS="-O2"
+
+    echo "Compiling checkrt"
+    # CHECKRT_STATIC=1 builds a static checkrt without the dlmopen() fallback,
+    # which starts faster; it needs a static libc, preferably musl (musl-gcc)
+    # which gives a much smaller binary than glibc's libc.a
+    if [ -n "$CHECKRT_STATIC" ] && command -v musl-gcc > /dev/null &&
+       musl-gcc -Os -DCHECKRT_STATIC -static -pthread checkrt.c -o checkrt -s
+    then
+        echo "Built static checkrt with musl"
+    elif [ -n "$CHECKRT_STATIC" ] && cc $CFLAGS -DCHECKRT_STATIC -static -pthread checkrt.c -o checkrt -s; then
+        echo "Built static checkrt"
+    else
+        cc $CFLAGS -pthread checkrt.c -o checkrt $LDFLAGS
+    fi
+
+    echo "Compiling exec.so"
+    cc $CFLAGS -shared -fPIC exec.c -o exec.so $LDFLAGS
+fi
 
-echo "Compiling exec.so"
-cc $CFLAGS -shared -fPIC exec.c -o exec.so $LDFLAGS
-rm checkrt.c exec.c
+rm checkrt.c checkrt.h exec.c
 
 ./checkrt --copy
 